@@ -24,6 +24,8 @@
 
 #include "mtp_data.h"
 #include "mgcp_callagent.h"
+#include "link_index.h"
+#include "mtp_route.h"
 
 #include <osmocom/core/linuxlist.h>
 #include <osmocom/core/select.h>
@@ -38,11 +40,21 @@ struct snmp_mtp_session;
 struct msc_connection;
 struct mtp_m2ua_transport;
 
+#define UDP_MAX_BATCH	64
+
 struct mtp_udp_data {
 	struct osmo_wqueue write_queue;
 	struct osmo_timer_list snmp_poll;
 
 	struct llist_head links;
+	struct link_index_table link_table;
+
+	/* datagrams to read per wakeup and their buffers */
+	int rx_batch;
+	struct msgb *rx_msgs[UDP_MAX_BATCH];
+
+	/* queued MSUs to send with one sendmmsg */
+	int tx_batch;
 };
 
 struct mtp_udp_link {
@@ -52,6 +64,7 @@ struct mtp_udp_link {
 	/* UDP specific stuff */
 	struct bsc_data *bsc;
 	int link_index;
+	struct link_index_entry index_entry;
 	int reset_timeout;
 
 	char *dest;
@@ -82,6 +95,9 @@ struct bsc_data {
 	struct llist_head linksets;
 	int num_linksets;
 
+	/* MTP3 routing by DPC */
+	struct mtp_route_table routes;
+
 	/* inject */
 	int allow_inject;
 	struct osmo_fd inject_fd;
@@ -129,5 +145,6 @@ int mtp_handle_pcap(struct mtp_link *, int dir, const uint8_t *data, int length)
 struct bsc_data *bsc_data_create();
 
 struct mtp_udp_link *mtp_udp_link_init(struct mtp_link *link);
+void mtp_udp_link_set_index(struct mtp_udp_link *link, int link_index);
 
 #endif
@@ -31,6 +31,18 @@
 #include <osmocom/sccp/sccp.h>
 
 struct ss7_application;
+struct msc_connection;
+
+/*
+ * The connections of an application are hashed by the local and remote
+ * SCCP reference. The references are 24 bit and allocated sequentially
+ * by most equipment so the lower bits spread well enough.
+ */
+#define SCCP_CON_HASH_BITS	12
+#define SCCP_CON_HASH_SIZE	(1 << SCCP_CON_HASH_BITS)
+
+/* default number of preallocated connections per application */
+#define SCCP_CON_POOL_SIZE	4096
 
 /*
  * One SCCP connection.
@@ -39,6 +51,10 @@ struct ss7_application;
 struct active_sccp_con {
 	struct llist_head entry;
 
+	/* hash chains for the lookup by reference */
+	struct llist_head src_hash;
+	struct llist_head dst_hash;
+
 	struct sccp_source_reference src_ref;
 	struct sccp_source_reference dst_ref;
 
@@ -58,10 +74,18 @@ struct active_sccp_con {
 	/* Link to the SS7 Application */
 	struct ss7_application *app;
 
+	/* the MSC of the pool that got the CR */
+	struct msc_connection *msc;
+
 	/* sls id */
 	int sls;
 };
 
+int sccp_con_table_init(struct ss7_application *);
+int sccp_con_pool_init(struct ss7_application *, int size);
+struct active_sccp_con *alloc_con(struct ss7_application *);
+void add_con(struct ss7_application *, struct active_sccp_con *con);
+void con_set_dst_ref(struct active_sccp_con *con, struct sccp_source_reference *ref);
 void free_con(struct active_sccp_con *con);
 struct active_sccp_con *find_con_by_dest_ref(struct ss7_application *, struct sccp_source_reference *ref);
 struct active_sccp_con *find_con_by_src_ref(struct ss7_application *,struct sccp_source_reference *src_ref);
@@ -71,6 +95,10 @@ unsigned int sls_for_src_ref(struct ss7_application *, struct sccp_source_refere
 
 void app_resources_released(struct ss7_application *ss7);
 void app_clear_connections(struct ss7_application *ss7);
-void app_forward_sccp(struct ss7_application *ss7, struct msgb *_msg, int sls);
+int app_forward_sccp(struct ss7_application *ss7, struct msgb *_msg, int sls);
+
+/* MSC pool of the application */
+struct msc_connection *app_select_msc(struct ss7_application *, uint32_t hash);
+int app_mscs_up(struct ss7_application *);
 
 #endif
@@ -47,6 +47,12 @@ struct ss7_application;
  */
 int bss_patch_filter_msg(struct ss7_application *app, struct msgb *msg, struct sccp_parse_result *result, int dir);
 
+/*
+ * Only peek at a DT1 from the BSC. Returns 1 if it can be forwarded to
+ * the MSC as it is and 0 if it needs bss_patch_filter_msg.
+ */
+int bss_dt1_passthrough(struct msgb *msg);
+
 /*
  * Copy inpt->l2h to target->l2h but rewrite the SCCP header on the way
  */
@@ -32,6 +32,9 @@ enum {
 	MTP_LSET_TOTA_DRP_MSG,
 	MTP_LSET_SCCP_OUT_MSG,
 	MTP_LSET_ISUP_OUT_MSG,
+	MTP_LSET_RESTART,
+	MTP_LSET_TFA_OUT_MSG,
+	MTP_LSET_TFP_OUT_MSG,
 };
 
 enum {
@@ -40,9 +43,26 @@ enum {
 	MTP_LNK_ERROR,
 	MTP_LNK_DRP,
 	MTP_LNK_SLTM_TOUT,
+	MTP_LNK_TX_QUEUED,
+	MTP_LNK_TX_DEQUEUED,
+	MTP_LNK_CONGESTION,
+	MTP_LNK_DRP_PRIO_0,
+	MTP_LNK_DRP_PRIO_1,
+	MTP_LNK_DRP_PRIO_2,
+	MTP_LNK_DRP_PRIO_3,
+};
+
+enum {
+	MSGB_POOL_HIT,
+	MSGB_POOL_MISS,
+	MSGB_POOL_RECYCLED,
+	MSGB_POOL_RELEASED,
+	MSGB_POOL_ALLOCATED,
+	MSGB_POOL_RETURNED,
 };
 
 const struct rate_ctr_group_desc *mtp_link_set_rate_ctr_desc();
 const struct rate_ctr_group_desc *mtp_link_rate_ctr_desc();
+const struct rate_ctr_group_desc *msgb_pool_rate_ctr_desc();
 
 #endif
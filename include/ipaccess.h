@@ -39,11 +39,27 @@ enum ipaccess_id_tags {
 	IPAC_IDTAG_UNIT			= 0x08,
 };
 
+/*
+ * Reassemble the IPA frames of a TCP stream. The socket is read in
+ * large chunks and every complete frame is handed out as its own msgb,
+ * a partial one stays in the buffer until the rest arrived.
+ */
+#define IPA_STREAM_SIZE		16384
+
+struct ipaccess_stream {
+	int start;
+	int len;
+	uint8_t data[IPA_STREAM_SIZE];
+};
+
+void ipaccess_stream_reset(struct ipaccess_stream *stream);
+int ipaccess_stream_read(struct ipaccess_stream *stream, int fd);
+struct msgb *ipaccess_stream_next(struct ipaccess_stream *stream, int *error);
+
 /*
  * methods for parsing and sending a message
  */
 int ipaccess_rcvmsg_base(struct msgb *msg, struct osmo_fd *bfd);
-struct msgb *ipaccess_read_msg(struct osmo_fd *bfd, int *error);
 void ipaccess_prepend_header(struct msgb *msg, int proto);
 int ipaccess_send_id_ack(int fd);
 int ipaccess_send_id_req(int fd);
@@ -0,0 +1,45 @@
+/* Lookup of links by the index used on the transport */
+/* (C) 2017 by Holger Hans Peter Freyther
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef link_index_h
+#define link_index_h
+
+#include <osmocom/core/linuxlist.h>
+
+/*
+ * The indexes are usually handed out sequentially so the lower bits
+ * select the bucket and a chain only grows beyond one entry with more
+ * than LINK_INDEX_HASH_SIZE links.
+ */
+#define LINK_INDEX_HASH_SIZE	256
+
+struct link_index_table {
+	struct llist_head buckets[LINK_INDEX_HASH_SIZE];
+};
+
+struct link_index_entry {
+	struct llist_head entry;
+	int index;
+};
+
+void link_index_table_init(struct link_index_table *table);
+
+/* add or move the entry to the given index */
+void link_index_set(struct link_index_table *table,
+		    struct link_index_entry *entry, int index);
+struct link_index_entry *link_index_find(struct link_index_table *table, int index);
+
+#endif
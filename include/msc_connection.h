@@ -21,6 +21,7 @@
 #define MSC_CONNECTION_H
 
 #include "mgcp_callagent.h"
+#include "ipaccess.h"
 
 #include <osmocom/core/linuxlist.h>
 #include <osmocom/core/timer.h>
@@ -52,9 +53,29 @@ struct msc_connection {
 	/* connection management */
 	int msc_link_down;
 	struct osmo_wqueue msc_connection;
+	struct ipaccess_stream ipa_stream;
 	struct osmo_timer_list reconnect_timer;
 	int first_contact;
 
+	/* bytes of the first queued frame already written */
+	int tx_offset;
+
+	/* delay in ms to collect frames before writing them */
+	int tx_coalesce;
+	struct osmo_timer_list coalesce_timer;
+
+	/* frames held back while the MSC is reconnecting */
+	struct llist_head replay_queue;
+	int replay_bytes;
+	int replay_max_bytes;
+	int replay_max_age;
+	unsigned long replay_sent;
+	unsigned long replay_dropped;
+
+	/* the SCCP connections are kept for up to replay_max_age */
+	int hold_connections;
+	struct osmo_timer_list hold_timer;
+
 	/* time to wait for first message from MSC */
 	struct osmo_timer_list msc_timeout;
 	int msc_time;
@@ -88,6 +109,13 @@ int msc_connection_start(struct msc_connection *msc);
 /* MGCP */
 void msc_mgcp_reset(struct msc_connection *msc);
 
+/* replay buffer */
+int msc_replay_take(struct msc_connection *msc, struct msgb *msg);
+void msc_replay_save_queue(struct msc_connection *msc);
+void msc_replay_refill(struct msc_connection *msc);
+void msc_replay_start(struct msc_connection *msc);
+void msc_replay_drop_connections(struct msc_connection *msc);
+
 /* Called by the MSC Connection */
 void msc_dispatch_sccp(struct msc_connection *msc, struct msgb *msg);
 
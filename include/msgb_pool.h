@@ -0,0 +1,60 @@
+/* Recycle msgb's of the hot paths */
+/* (C) 2017 by Holger Hans Peter Freyther
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef msgb_pool_h
+#define msgb_pool_h
+
+#include <osmocom/core/linuxlist.h>
+#include <osmocom/core/msgb.h>
+
+#include <stdint.h>
+
+struct rate_ctr_group;
+
+/* keep at most this many unused buffers of one size */
+#define MSGB_POOL_MAX_FREE	512
+
+struct msgb_pool_class {
+	unsigned int size;
+
+	/* msgb's that went through msgb_free */
+	struct llist_head free;
+	int nr_free;
+
+	/* handed out and not yet freed, alloc.total - free.total */
+	int outstanding;
+
+	struct rate_ctr_group *ctrg;
+};
+
+enum {
+	MSGB_POOL_SMALL,
+	MSGB_POOL_MEDIUM,
+	MSGB_POOL_LARGE,
+	_NUM_MSGB_POOL,
+};
+
+extern struct msgb_pool_class msgb_pool_classes[_NUM_MSGB_POOL];
+
+int msgb_pool_init(void *ctx);
+
+/*
+ * Like msgb_alloc_headroom. The msgb is released with msgb_free and
+ * will be recycled for the next allocation of the same size class.
+ */
+struct msgb *msgb_pool_alloc(uint16_t size, uint16_t headroom, const char *name);
+
+#endif
@@ -23,6 +23,9 @@
 #include <osmocom/core/msgb.h>
 #include <osmocom/core/timer.h>
 #include <osmocom/core/utils.h>
+#include <osmocom/core/write_queue.h>
+
+#include <time.h>
 
 struct bsc_data;
 struct mtp_link;
@@ -37,6 +40,108 @@ struct ss7_application;
 #define MTP_T2		30, 0
 #define START_DELAY	 8, 0
 
+/*
+ * Returned by mtp_link_set_data and the forward/relay routines when the
+ * msgb was handed to an outgoing link. The caller must not touch or free
+ * it anymore. Any other return value leaves the msgb with the caller.
+ */
+#define MTP_MSG_CONSUMED	1
+
+/*
+ * A copy of the msgb was handed to an outgoing link. The original is
+ * still owned by the caller but must not be handled locally.
+ */
+#define MTP_MSG_SENT		2
+
+/*
+ * headroom a received msgb needs to be relayed without a copy, large
+ * enough for the M2UA DATA header and the sctp_sndrcvinfo in front
+ */
+#define MTP_RELAY_HEADROOM	64
+
+/* MTP3 message priorities as in Q.704, 3 is the highest */
+enum mtp_msg_prio {
+	MTP_PRIO_0,
+	MTP_PRIO_1,
+	MTP_PRIO_2,
+	MTP_PRIO_3,
+	_NUM_MTP_PRIO,
+};
+
+#define MTP_TX_QUEUE_SIZE	256
+
+/*
+ * Kept in the msgb control buffer. When native is set l2h points to the
+ * routing label of the transport (M3UA Protocol Data) and not to a MTP3
+ * header, the service indicator is then taken from here.
+ */
+struct mtp_msg_cb {
+	int native;
+	int si;
+};
+
+#define MTP_MSG_CB(msg)	((struct mtp_msg_cb *) &(msg)->cb[0])
+
+/* management messages prebuilt for each linkset, see mtp_tmpl_alloc */
+enum mtp_tmpl_type {
+	MTP_TMPL_TFP,
+	MTP_TMPL_TFA,
+	MTP_TMPL_TRA,
+	MTP_TMPL_SLTA,
+	MTP_TMPL_SLTM,
+	MTP_TMPL_SCMG,
+	_NUM_MTP_TMPL,
+};
+
+#define MTP_TMPL_SIZE	32
+
+struct mtp_msg_tmpl {
+	int len;
+	uint8_t data[MTP_TMPL_SIZE];
+};
+
+/*
+ * The MTP3 header and the fixed part of the management messages. The
+ * routing label and the variable fields are patched into the copy. It
+ * is rebuilt when the point codes or the network indicator changed.
+ */
+struct mtp_tmpl_cache {
+	int valid;
+	int dpc, opc, sccp_opc;
+	int ni, spare;
+	struct mtp_msg_tmpl tmpl[_NUM_MTP_TMPL];
+};
+
+/*
+ * The MTP restart of a linkset. The routing data is collected until
+ * T18, then every destination of the routing table is announced with
+ * a TFA or TFP in batches and the TRA follows once T20 expired.
+ */
+enum mtp_restart_phase {
+	MTP_RESTART_IDLE,
+	MTP_RESTART_COLLECT,
+	MTP_RESTART_BROADCAST,
+	MTP_RESTART_WAIT_T20,
+};
+
+struct mtp_restart {
+	int phase;
+	int t20_expired;
+
+	/* TFx messages per main loop iteration and where to continue */
+	int tfx_batch;
+	int next_pc;
+	struct osmo_timer_list tfx_timer;
+
+	/* the last restart, the phases end in ms after its begin */
+	struct timespec start;
+	int collect_ms;
+	int broadcast_ms;
+	int tra_ms;
+	int nr_tfa;
+	int nr_tfp;
+};
+
 enum ss7_link_type {
 	SS7_LTYPE_NONE,
 	SS7_LTYPE_UDP,
@@ -54,10 +159,9 @@ struct mtp_link_set {
 
 
 	/**
-	 * Routing is very limited. We can only forward to one
-	 * other STP/Endpoint. For ISUP and SCCP we can statically
-	 * send it to another destination. We need to follow Q.704
-	 * more properly here.
+	 * MSUs for a DPC in the routing table of the bsc_data are
+	 * transferred as they are, see mtp_route.h. Everything else
+	 * is forwarded to the other side of the application.
 	 * DPC/OPC are the ones for the linkset,
 	 * sccp_dpc/isup_dpc are where we will send SCCP/ISUP messages
 	 * sccp_opc/isup_opc are what we announce in the TFP
@@ -91,6 +195,12 @@ struct mtp_link_set {
 	/* special handling */
 	int pass_all_isup;
 
+	/* the mtp_route's using this linkset */
+	struct llist_head routes;
+
+	/* prebuilt management messages */
+	struct mtp_tmpl_cache tmpl_cache;
+
 	/* statistics */
 	struct rate_ctr_group *ctrg;
 
@@ -99,6 +209,7 @@ struct mtp_link_set {
 	int timeout_t20;
 	struct osmo_timer_list T18;
 	struct osmo_timer_list T20;
+	struct mtp_restart restart;
 
 	/* custom data */
 	struct bsc_data *bsc;
@@ -129,6 +240,12 @@ struct mtp_link {
 	int blocked;
 
 	int first_sls;
+
+	/* share of the SLS relative to the other links of the set */
+	int weight;
+	int sls_quota;
+	int nr_sls;
+
 	int sltm_pending;
 	int was_up;
 
@@ -139,12 +256,32 @@ struct mtp_link {
 	/* statistics */
 	struct rate_ctr_group *ctrg;
 
+	/*
+	 * Messages waiting for room in the transport, one list per
+	 * priority. The congestion level rises with the depth and only
+	 * messages of at least that priority are queued.
+	 */
+	struct llist_head tx_queue[_NUM_MTP_PRIO];
+	int tx_depth;
+	int tx_max;
+	int congestion;
+
 	/* callback's to implement */
 	int (*write)(struct mtp_link *, struct msgb *msg);
 	int (*shutdown)(struct mtp_link *);
 	int (*reset)(struct mtp_link *data);
 	int (*clear_queue)(struct mtp_link *data);
 
+	/* optional, how many messages the transport takes right now */
+	int (*tx_room)(struct mtp_link *data);
+
+	/*
+	 * optional, for transports without a MTP3 header. Put the routing
+	 * label in front of the user data at msg->data, see mtp_msg_cb.
+	 */
+	int (*push_label)(struct mtp_link *data, struct msgb *msg,
+			  int opc, int dpc, int sls, int si);
+
 	/* for M3UA and others.. */
 	int skip_link_test;
 
@@ -158,8 +295,14 @@ void mtp_link_set_stop(struct mtp_link_set *set);
 void mtp_link_set_reset(struct mtp_link_set *set);
 int mtp_link_set_data(struct mtp_link *link, struct msgb *msg);
 int mtp_link_handle_data(struct mtp_link *link, struct msgb *msg);
+int mtp_link_set_user_data(struct mtp_link *link, struct msgb *msg,
+			   int opc, int dpc, int sls, int si);
+int mtp_link_handle_user_data(struct mtp_link *link, struct msgb *msg,
+			      int opc, int dpc, int sls, int si);
 int mtp_link_set_submit_sccp_data(struct mtp_link_set *set, int sls, const uint8_t *data, unsigned int length);
 int mtp_link_set_submit_isup_data(struct mtp_link_set *set, int sls, const uint8_t *data, unsigned int length);
+int mtp_link_set_relay_sccp_data(struct mtp_link_set *set, int sls, struct msgb *msg, uint8_t *data);
+int mtp_link_set_relay_isup_data(struct mtp_link_set *set, int sls, struct msgb *msg, uint8_t *data);
 
 void mtp_link_set_init_slc(struct mtp_link_set *set);
 
@@ -169,8 +312,8 @@ void mtp_link_unblock(struct mtp_link *link);
 
 /* to be implemented for MSU sending */
 void mtp_link_submit(struct mtp_link *link, struct msgb *msg);
-void mtp_link_set_forward_sccp(struct mtp_link_set *set, struct msgb *msg, int sls);
-void mtp_link_set_forward_isup(struct mtp_link_set *set, struct msgb *msg, int sls);
+int mtp_link_set_forward_sccp(struct mtp_link_set *set, struct msgb *msg, int sls);
+int mtp_link_set_forward_isup(struct mtp_link_set *set, struct msgb *msg, int sls);
 void mtp_link_restart(struct mtp_link *link);
 int mtp_link_set_send(struct mtp_link_set *set, struct msgb *msg);
 
@@ -178,6 +321,12 @@ int mtp_link_set_send(struct mtp_link_set *set, struct msgb *msg);
 void mtp_link_down(struct mtp_link *data);
 void mtp_link_up(struct mtp_link *data);
 
+/* transmit queue of the link */
+int mtp_msg_prio(struct msgb *msg);
+void mtp_link_tx(struct mtp_link *link, struct msgb *msg);
+void mtp_link_tx_drain(struct mtp_link *link);
+void mtp_link_tx_clear(struct mtp_link *link);
+
 void mtp_link_start_link_test(struct mtp_link *link);
 void mtp_link_stop_link_test(struct mtp_link *link);
 int mtp_link_slta(struct mtp_link *link, uint16_t l3_len, struct mtp_level_3_mng *mng);
@@ -186,6 +335,7 @@ void mtp_link_failure(struct mtp_link *fail);
 
 /* internal routines */
 struct msgb *mtp_msg_alloc(struct mtp_link_set *set);
+struct msgb *mtp_tmpl_alloc(struct mtp_link_set *set, enum mtp_tmpl_type type);
 
 /* link management */
 struct mtp_link_set *mtp_link_set_alloc(struct bsc_data *bsc);
@@ -196,5 +346,16 @@ struct mtp_link *mtp_link_num(struct mtp_link_set *set, int num);
 
 /* linkset handling */
 int mtp_link_verified(struct mtp_link *link);
+const char *mtp_restart_phase_name(int phase);
+
+/*
+ * Messages osmo_wqueue_enqueue still takes. It refuses the message
+ * that would make the queue reach max_length, for tx_room.
+ */
+static inline int mtp_wqueue_room(struct osmo_wqueue *queue)
+{
+	int room = queue->max_length - queue->current_length - 1;
+	return room > 0 ? room : 0;
+}
 
 #endif
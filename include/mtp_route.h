@@ -0,0 +1,102 @@
+/* MTP3 routing table */
+/* (C) 2017 by Holger Hans Peter Freyther
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef mtp_route_h
+#define mtp_route_h
+
+#include <osmocom/core/linuxlist.h>
+#include <osmocom/core/msgb.h>
+
+struct mtp_level_3_hdr;
+struct mtp_link_set;
+
+/* the point codes are 14 bit */
+#define MTP_ROUTE_NR_PC		(1 << 14)
+
+/* linksets of the same priority used for load sharing */
+#define MTP_ROUTE_MAX_ACTIVE	8
+
+/* one way to reach a destination */
+struct mtp_route {
+	/* in the mtp_route_dest and the mtp_link_set */
+	struct llist_head entry;
+	struct llist_head set_entry;
+
+	struct mtp_route_dest *dest;
+	struct mtp_link_set *set;
+
+	/* 0 is the most preferred one */
+	int priority;
+
+	/* a TFP was received for the destination on the set */
+	int prohibited;
+};
+
+struct mtp_route_dest {
+	int dpc;
+	struct llist_head routes;
+
+	/*
+	 * The available linksets of the best priority. This is updated
+	 * whenever a route changes state, the MSU path only picks one
+	 * of them by the SLS.
+	 */
+	int nr_active;
+	struct mtp_link_set *active[MTP_ROUTE_MAX_ACTIVE];
+};
+
+/* destinations are allocated when a route is configured */
+struct mtp_route_table {
+	struct mtp_route_dest *dests[MTP_ROUTE_NR_PC];
+};
+
+int mtp_route_add(struct mtp_route_table *table, int dpc,
+		  struct mtp_link_set *set, int priority);
+int mtp_route_del(struct mtp_route_table *table, int dpc,
+		  struct mtp_link_set *set);
+
+static inline struct mtp_route_dest *mtp_route_find(struct mtp_route_table *table, int dpc)
+{
+	return table->dests[dpc & (MTP_ROUTE_NR_PC - 1)];
+}
+
+static inline struct mtp_link_set *mtp_route_lookup(struct mtp_route_table *table,
+						    int dpc, int sls)
+{
+	struct mtp_route_dest *dest = mtp_route_find(table, dpc);
+
+	if (!dest || dest->nr_active == 0)
+		return NULL;
+	return dest->active[sls % dest->nr_active];
+}
+
+/* TFP/TFA received for dpc on the given set */
+int mtp_route_set_status(struct mtp_route_table *table, int dpc,
+			 struct mtp_link_set *set, int prohibited);
+
+/* the linkset went up or down, re-evaluate its routes */
+void mtp_route_update_set(struct mtp_link_set *set);
+
+/*
+ * Transfer a received MSU by the routing table. Returns 0 if the DPC
+ * is not in the table and the MSU should be handled locally, -1 if it
+ * is not reachable right now, MTP_MSG_CONSUMED when the msgb was sent
+ * and MTP_MSG_SENT when a copy of it was sent.
+ */
+int mtp_route_transfer(struct mtp_link_set *set, struct msgb *msg,
+		       struct mtp_level_3_hdr *hdr);
+
+#endif
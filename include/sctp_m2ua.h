@@ -19,6 +19,8 @@
 #define sctp_m2ua_h
 
 #include "mtp_data.h"
+#include "link_index.h"
+#include "sctp_queue.h"
 
 #include <osmocom/sigtran/xua_msg.h>
 #include <osmocom/core/write_queue.h>
@@ -26,6 +28,13 @@
 #include <netinet/in.h>
 #include <netinet/sctp.h>
 
+/* the traffic modes of RFC 3331 */
+#define M2UA_TRAFFIC_OVERRIDE	1
+#define M2UA_TRAFFIC_LOADSHARE	2
+
+/* ASPs that can share one interface identifier */
+#define M2UA_MAX_ASPS		8
+
 struct sctp_m2ua_conn;
 struct mtp_link;
 
@@ -39,22 +48,28 @@ struct sctp_m2ua_transport {
 	struct osmo_fd bsc;
 
 	struct llist_head links;
+	struct link_index_table link_table;
+
+	/* for the write queue of every ASP */
+	struct sctp_queue_cfg queue_cfg;
 };
 
 struct mtp_m2ua_link {
 	struct mtp_link *base;
 
 	/*
-	 * The state of the link, who is using it and
-	 * what will happen to it. For load-sharing we
-	 * will need to turn this into a list.
+	 * The state of the link and the ASPs that are using
+	 * it. In loadshare mode the SLS picks one of them, in
+	 * override mode there is only one.
 	 */
 	int active;
 	int asp_active;
 	int established;
-	struct sctp_m2ua_conn *conn;
+	int nr_conns;
+	struct sctp_m2ua_conn *conns[M2UA_MAX_ASPS];
 
 	int link_index;
+	struct link_index_entry index_entry;
 	struct llist_head entry;
 	struct sctp_m2ua_transport *transport;
 
@@ -70,7 +85,11 @@ struct sctp_m2ua_conn {
 	int asp_up;
 
 	struct osmo_wqueue queue;
+	struct sctp_queue_stats queue_stats;
 	struct sctp_m2ua_transport *trans;
+
+	/* negotiated outbound streams */
+	int nr_streams;
 };
 
 struct sctp_m2ua_transport *sctp_m2ua_transp_create(struct bsc_data *bsc);
@@ -79,6 +98,7 @@ struct mtp_m2ua_link *mtp_m2ua_link_create(struct sctp_m2ua_transport *transport
 					   struct mtp_link_set *);
 
 struct mtp_m2ua_link *mtp_m2ua_link_init(struct mtp_link *link);
+void mtp_m2ua_link_set_index(struct mtp_m2ua_link *link, int link_index);
 
 int sctp_m2ua_conn_count(struct sctp_m2ua_transport *tran);
 
@@ -4,38 +4,82 @@
 #pragma once
 
 #include "mtp_data.h"
+#include "sctp_queue.h"
 
 #include <osmocom/core/write_queue.h>
 
 #include <netinet/in.h>
 
-struct mtp_m3ua_client_link {
-	struct mtp_link *base;
+/* the traffic modes of RFC 4666 */
+#define M3UA_TRAFFIC_OVERRIDE	1
+#define M3UA_TRAFFIC_LOADSHARE	2
+#define M3UA_TRAFFIC_BROADCAST	3
+
+/* associations of one client link */
+#define M3UA_MAX_ASPS		8
+
+struct mtp_m3ua_client_link;
+
+/* one association to a SGP, the first one is created with the link */
+struct mtp_m3ua_asp {
+	struct llist_head entry;
+	struct mtp_m3ua_client_link *link;
+	int nr;
 
 	struct osmo_wqueue queue;
+	struct sctp_queue_stats queue_stats;
 	struct osmo_timer_list connect_timer;
 
+	char *dest;
+	struct sockaddr_in remote;
+
+	/* state of the association */
+	int aspsm_active;
+	int asptm_active;
+
+	/* negotiated outbound streams */
+	int nr_streams;
+
+	/* reliability handling */
+	struct osmo_timer_list aspac_ack_timer;
+};
+
+struct mtp_m3ua_client_link {
+	struct mtp_link *base;
+
 	char *source;
 	struct sockaddr_in local;
 
-	char *dest;
-	struct sockaddr_in remote;
 	int link_index;
 	int routing_context;
 	uint32_t traffic_mode;
 
+	/* the associations ordered by number */
+	struct llist_head asps;
 
-	/* state of the link */
-	int aspsm_active;
-	int asptm_active;
+	/*
+	 * The ASPs in the ASP-ACTIVE state. The link is up as long as one
+	 * of them is. Loadshare picks one of them by the SLS, override
+	 * only uses the first and broadcast sends to all of them.
+	 */
+	int nr_active;
+	struct mtp_m3ua_asp *active[M3UA_MAX_ASPS];
+
+	/* reset was called and the associations are kept up */
+	int running;
 
-	/* reliability handling */
-	struct osmo_timer_list aspac_ack_timer;
 	int aspac_ack_timeout;
+
+	/* for the write queue of every ASP */
+	struct sctp_queue_cfg queue_cfg;
 };
 
 struct mtp_m3ua_client_link *mtp_m3ua_client_link_init(struct mtp_link *link);
 
+struct mtp_m3ua_asp *mtp_m3ua_client_asp_num(struct mtp_m3ua_client_link *link, int nr);
+struct mtp_m3ua_asp *mtp_m3ua_client_asp_alloc(struct mtp_m3ua_client_link *link, int nr);
+void mtp_m3ua_client_asp_free(struct mtp_m3ua_asp *asp);
+
 
 const char *m3ua_traffic_mode_name(uint32_t mode);
 uint32_t m3ua_traffic_mode_num(const char *argv);
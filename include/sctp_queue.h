@@ -0,0 +1,95 @@
+/* SCTP write queue handling shared by M2UA and M3UA */
+/* (C) 2017 by Holger Hans Peter Freyther
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef sctp_queue_h
+#define sctp_queue_h
+
+#include <osmocom/core/write_queue.h>
+#include <osmocom/core/timer.h>
+
+#define SCTP_QUEUE_LENGTH	10
+#define SCTP_QUEUE_HIGH_WATER	8
+#define SCTP_QUEUE_LOW_WATER	4
+
+/* messages for one sendmmsg */
+#define SCTP_MAX_BATCH		64
+
+/* the bucket n counts the delays below 2^n ms, the last one the rest */
+#define SCTP_QUEUE_DELAY_BUCKETS 12
+
+/* the enqueue time in us, msg->cb[0] is used by the MTP layer */
+#define SCTP_QUEUE_CB(msg)	((msg)->cb[4])
+
+struct sctp_queue_cfg {
+	int length;
+	int high_water;
+	int low_water;
+
+	/* messages per write and how long a message may wait for them */
+	int batch;
+	int flush_delay;
+};
+
+/*
+ * The association is congested from the high water mark until the
+ * queue went down to the low water mark. While congested no room is
+ * reported to the MTP layer and it keeps the messages in its own
+ * priority queues.
+ */
+struct sctp_queue_stats {
+	int high_water;
+	int low_water;
+	int congested;
+
+	/*
+	 * With a flush delay the first message of an idle queue waits
+	 * in the flush_timer for more until the batch is full.
+	 */
+	int batch;
+	int flush_delay;
+	struct osmo_timer_list flush_timer;
+
+	unsigned int onsets;
+	unsigned int dropped;
+	unsigned int delay[SCTP_QUEUE_DELAY_BUCKETS];
+	unsigned int max_delay;
+};
+
+void sctp_queue_cfg_init(struct sctp_queue_cfg *cfg);
+int sctp_queue_cfg_set(struct sctp_queue_cfg *cfg, int length, int high, int low);
+int sctp_queue_cfg_batch(struct sctp_queue_cfg *cfg, int batch, int flush_delay);
+
+void sctp_queue_init(struct osmo_wqueue *queue, struct sctp_queue_stats *stats,
+		     const struct sctp_queue_cfg *cfg);
+void sctp_queue_configure(struct osmo_wqueue *queue, struct sctp_queue_stats *stats,
+			  const struct sctp_queue_cfg *cfg);
+void sctp_queue_stop(struct osmo_wqueue *queue, struct sctp_queue_stats *stats);
+
+/* like osmo_wqueue_enqueue, the msgb still belongs to the caller on failure */
+int sctp_queue_enqueue(struct osmo_wqueue *queue, struct sctp_queue_stats *stats,
+		       struct msgb *msg);
+
+/*
+ * To be called from the fd callback when the socket is writable. It
+ * sends up to a batch of messages with their sctp_sndrcvinfo in front
+ * of msg->l2h and returns how many are gone.
+ */
+int sctp_queue_flush(struct osmo_wqueue *queue, struct sctp_queue_stats *stats);
+
+/* how many messages may be written right now, 0 while congested */
+int sctp_queue_room(struct osmo_wqueue *queue, struct sctp_queue_stats *stats);
+
+#endif
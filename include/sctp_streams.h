@@ -0,0 +1,43 @@
+/* SCTP stream handling shared by M2UA and M3UA */
+/* (C) 2017 by Holger Hans Peter Freyther
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef sctp_streams_h
+#define sctp_streams_h
+
+#include <stdint.h>
+
+/*
+ * Stream 0 carries the management messages, DATA is spread over the
+ * other streams by the SLS. One stream for each of the 16 SLS keeps
+ * a lost packet from blocking the unrelated signalling links.
+ */
+#define SCTP_NR_STREAMS		17
+
+/* ask for the streams, to be called before connect/listen */
+int sctp_streams_request(int fd, int nr_streams);
+
+/* the outbound streams of the association, 1 if unknown */
+int sctp_streams_outbound(int fd);
+
+/* in-sequence delivery is kept per SLS */
+static inline uint16_t sctp_sls_to_stream(int nr_streams, int sls)
+{
+	if (nr_streams <= 1)
+		return 0;
+	return 1 + sls % (nr_streams - 1);
+}
+
+#endif
@@ -29,6 +29,9 @@ struct msc_connection;
 struct mtp_link_set;
 struct mtp_link;
 
+/* MSC connections an application can load-share across */
+#define APP_MAX_MSCS	8
+
 enum ss7_set_type {
 	SS7_SET_LINKSET,
 	SS7_SET_MSC,
@@ -66,6 +69,10 @@ struct ss7_application {
 	struct ss7_application_route route_src;
 	struct ss7_application_route route_dst;
 
+	/* pool of MSCs, the first one is route_dst.msc */
+	int nr_mscs;
+	struct msc_connection *mscs[APP_MAX_MSCS];
+
 	struct bsc_data *bsc;
 
 	/* isup handling */
@@ -73,6 +80,16 @@ struct ss7_application {
 
 	/* handling for the NAT/State handling */
 	struct llist_head sccp_connections;
+	struct llist_head *sccp_src_hash;
+	struct llist_head *sccp_dst_hash;
+
+	/* preallocated connections, see alloc_con */
+	int con_pool_size;
+	struct active_sccp_con *con_pool;
+	struct llist_head con_free;
+	int con_in_use;
+	int con_high_water;
+	int con_pool_exhausted;
 	struct osmo_timer_list reset_timeout;
 	struct mtp_link_set *target_link;
 	int forward_only;
@@ -104,6 +121,9 @@ int ss7_application_setup(struct ss7_application *, int type,
 
 int ss7_application_start(struct ss7_application *);
 
+/* MSC pool handling */
+int ss7_application_add_msc(struct ss7_application *, int msc_num);
+
 /* config changes */
 void ss7_application_pass_isup(struct ss7_application *, int pass);
 
@@ -0,0 +1,36 @@
+/* In place parsing of xUA DATA messages */
+/* (C) 2017 by Holger Hans Peter Freyther
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef xua_data_h
+#define xua_data_h
+
+#include <osmocom/core/msgb.h>
+
+#include <stdint.h>
+
+struct xua_common_hdr;
+
+/*
+ * The DATA messages are looked at where they were received, without
+ * a xua_msg. This returns the common header if the version matches and
+ * the message length fits into the msgb, NULL otherwise.
+ */
+struct xua_common_hdr *xua_data_hdr(struct msgb *msg, int version);
+
+/* the value of the first parameter with the tag and its length */
+uint8_t *xua_data_find_tag(struct xua_common_hdr *hdr, uint16_t tag, uint16_t *len);
+
+#endif
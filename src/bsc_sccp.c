@@ -24,12 +24,103 @@
 
 #include <cellmgr_debug.h>
 #include <ss7_application.h>
-#include <ss7_application.h>
 
 #include <osmocom/core/talloc.h>
 
 #include <string.h>
 
+static unsigned int con_hash(struct sccp_source_reference *ref)
+{
+	uint32_t key = sccp_src_ref_to_int(ref);
+
+	return (key ^ (key >> SCCP_CON_HASH_BITS)) & (SCCP_CON_HASH_SIZE - 1);
+}
+
+int sccp_con_table_init(struct ss7_application *app)
+{
+	int i;
+
+	app->sccp_src_hash = talloc_array(app, struct llist_head, SCCP_CON_HASH_SIZE);
+	app->sccp_dst_hash = talloc_array(app, struct llist_head, SCCP_CON_HASH_SIZE);
+	if (!app->sccp_src_hash || !app->sccp_dst_hash)
+		return -1;
+
+	for (i = 0; i < SCCP_CON_HASH_SIZE; ++i) {
+		INIT_LLIST_HEAD(&app->sccp_src_hash[i]);
+		INIT_LLIST_HEAD(&app->sccp_dst_hash[i]);
+	}
+
+	return 0;
+}
+
+/*
+ * All connections of an application come from a preallocated array
+ * so a storm of CRs does not turn into malloc churn. The pool can only
+ * be resized when no connection is active.
+ */
+int sccp_con_pool_init(struct ss7_application *app, int size)
+{
+	int i;
+
+	if (app->con_in_use > 0) {
+		LOGP(DINP, LOGL_ERROR,
+		     "Can not resize the pool with %d active connections.\n",
+		     app->con_in_use);
+		return -1;
+	}
+
+	talloc_free(app->con_pool);
+	INIT_LLIST_HEAD(&app->con_free);
+	app->con_pool_size = size;
+	app->con_high_water = 0;
+	app->con_pool = talloc_zero_array(app, struct active_sccp_con, size);
+	if (!app->con_pool)
+		return -1;
+
+	for (i = 0; i < size; ++i)
+		llist_add_tail(&app->con_pool[i].entry, &app->con_free);
+	return 0;
+}
+
+struct active_sccp_con *alloc_con(struct ss7_application *app)
+{
+	struct active_sccp_con *con;
+
+	if (llist_empty(&app->con_free)) {
+		app->con_pool_exhausted += 1;
+		return NULL;
+	}
+
+	con = llist_entry(app->con_free.next, struct active_sccp_con, entry);
+	llist_del(&con->entry);
+	memset(con, 0, sizeof(*con));
+
+	app->con_in_use += 1;
+	if (app->con_in_use > app->con_high_water)
+		app->con_high_water = app->con_in_use;
+	return con;
+}
+
+/*
+ * The connection is only known by the source reference of the BSC
+ * until the MSC has confirmed it.
+ */
+void add_con(struct ss7_application *app, struct active_sccp_con *con)
+{
+	con->app = app;
+	llist_add_tail(&con->entry, &app->sccp_connections);
+	llist_add(&con->src_hash, &app->sccp_src_hash[con_hash(&con->src_ref)]);
+	INIT_LLIST_HEAD(&con->dst_hash);
+}
+
+void con_set_dst_ref(struct active_sccp_con *con, struct sccp_source_reference *ref)
+{
+	llist_del(&con->dst_hash);
+	con->dst_ref = *ref;
+	con->has_dst_ref = 1;
+	llist_add(&con->dst_hash, &con->app->sccp_dst_hash[con_hash(ref)]);
+}
+
 struct active_sccp_con *find_con_by_dest_ref(struct ss7_application *fw, struct sccp_source_reference *ref)
 {
 	struct active_sccp_con *con;
@@ -39,12 +130,13 @@ struct active_sccp_con *find_con_by_dest_ref(struct ss7_application *fw, struct
 		return NULL;
 	}
 
-	llist_for_each_entry(con, &fw->sccp_connections, entry) {
+	llist_for_each_entry(con, &fw->sccp_dst_hash[con_hash(ref)], dst_hash) {
 		if (memcmp(&con->dst_ref, ref, sizeof(*ref)) == 0)
 			return con;
 	}
 
-	LOGP(DINP, LOGL_ERROR, "No connection fond with: 0x%x as dest\n", sccp_src_ref_to_int(ref));
+	/* the DT1 fast path looks up unknown references as well */
+	LOGP(DINP, LOGL_DEBUG, "No connection found with: 0x%x as dest\n", sccp_src_ref_to_int(ref));
 	return NULL;
 }
 
@@ -57,7 +149,7 @@ struct active_sccp_con *find_con_by_src_ref(struct ss7_application *fw, struct s
 	if (!src_ref)
 		return NULL;
 
-	llist_for_each_entry(con, &fw->sccp_connections, entry) {
+	llist_for_each_entry(con, &fw->sccp_src_hash[con_hash(src_ref)], src_hash) {
 		if (memcmp(&con->src_ref, src_ref, sizeof(*src_ref)) == 0)
 			return con;
 	}
@@ -71,7 +163,7 @@ struct active_sccp_con *find_con_by_src_dest_ref(struct ss7_application *fw,
 {
 	struct active_sccp_con *con;
 
-	llist_for_each_entry(con, &fw->sccp_connections, entry) {
+	llist_for_each_entry(con, &fw->sccp_src_hash[con_hash(src_ref)], src_hash) {
 		if (memcmp(src_ref, &con->src_ref, sizeof(*src_ref)) == 0 &&
 		    memcmp(dst_ref, &con->dst_ref, sizeof(*dst_ref)) == 0) {
 			return con;
@@ -97,7 +189,11 @@ unsigned int sls_for_src_ref(struct ss7_application *fw, struct sccp_source_refe
 void free_con(struct active_sccp_con *con)
 {
 	llist_del(&con->entry);
+	llist_del(&con->src_hash);
+	llist_del(&con->dst_hash);
 	osmo_timer_del(&con->rlc_timeout);
-	talloc_free(con);
+
+	llist_add(&con->entry, &con->app->con_free);
+	con->app->con_in_use -= 1;
 }
 
@@ -162,6 +162,55 @@ int bss_patch_filter_msg(struct ss7_application *app, struct msgb *msg,
 	return -1;
 }
 
+int bss_dt1_passthrough(struct msgb *msg)
+{
+	struct sccp_data_form1 *form1;
+	unsigned int ptr, len;
+	uint8_t *data;
+
+	if (msgb_l2len(msg) < sizeof(*form1) + 1)
+		return 0;
+
+	form1 = (struct sccp_data_form1 *) msg->l2h;
+	if (form1->type != SCCP_MSG_TYPE_DT1)
+		return 0;
+
+	/* the pointer is relative to itself */
+	ptr = offsetof(struct sccp_data_form1, variable_start) + form1->variable_start;
+	if (ptr >= msgb_l2len(msg))
+		return 0;
+
+	len = msg->l2h[ptr];
+	data = &msg->l2h[ptr + 1];
+	if (len < 3 || ptr + 1 + len > msgb_l2len(msg))
+		return 0;
+
+	/* the same messages handle_bss_mgmt and handle_bss_dtap look at */
+	switch (data[0]) {
+	case BSSAP_MSG_BSS_MANAGEMENT:
+		switch (data[2]) {
+		case BSS_MAP_MSG_ASSIGMENT_RQST:
+		case BSS_MAP_MSG_ASSIGMENT_COMPLETE:
+		case BSS_MAP_MSG_CLEAR_COMPLETE:
+			return 0;
+		}
+		return 1;
+	case BSSAP_MSG_DTAP:
+		if (len < 3 + 2)
+			return 0;
+		if ((data[3] & 0x0f) != GSM48_PDISC_CC)
+			return 1;
+		switch (data[4] & 0xbf) {
+		case GSM48_MT_CC_CALL_CONF:
+		case GSM48_MT_CC_SETUP:
+			return 0;
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
 static int handle_bss_mgmt(struct ss7_application *app, struct msgb *msg,
 				struct sccp_parse_result *sccp)
 {
@@ -32,6 +32,9 @@ static const struct rate_ctr_desc mtp_lset_cfg_description[] = {
 	[MTP_LSET_SCCP_OUT_MSG]	= { "sccp.out",       "SCCP messages out  "},
 	[MTP_LSET_ISUP_OUT_MSG]	= { "isup.out",       "ISUP messages out  "},
 	[MTP_LSET_TOTA_DRP_MSG] = { "total.dropped",  "Total dropped msgs "},
+	[MTP_LSET_RESTART]	= { "restart",        "MTP restarts       "},
+	[MTP_LSET_TFA_OUT_MSG]	= { "tfa.out",        "TFA sent on restart"},
+	[MTP_LSET_TFP_OUT_MSG]	= { "tfp.out",        "TFP sent on restart"},
 };
 
 static const struct rate_ctr_desc mtp_link_cfg_description[] = {
@@ -40,6 +43,22 @@ static const struct rate_ctr_desc mtp_link_cfg_description[] = {
 	[MTP_LNK_ERROR]		= { "total.error",    "Errors occured     "},
 	[MTP_LNK_DRP]		= { "total.dropped",  "Messages dropped   "},
 	[MTP_LNK_SLTM_TOUT]	= { "sltm.timeouts",  "SLTM timeouts      "},
+	[MTP_LNK_TX_QUEUED]	= { "tx.queued",      "Queued for sending "},
+	[MTP_LNK_TX_DEQUEUED]	= { "tx.dequeued",    "Left the queue     "},
+	[MTP_LNK_CONGESTION]	= { "tx.congestion",  "Congestion onsets  "},
+	[MTP_LNK_DRP_PRIO_0]	= { "tx.dropped.0",   "Dropped priority 0 "},
+	[MTP_LNK_DRP_PRIO_1]	= { "tx.dropped.1",   "Dropped priority 1 "},
+	[MTP_LNK_DRP_PRIO_2]	= { "tx.dropped.2",   "Dropped priority 2 "},
+	[MTP_LNK_DRP_PRIO_3]	= { "tx.dropped.3",   "Dropped priority 3 "},
+};
+
+static const struct rate_ctr_desc msgb_pool_cfg_description[] = {
+	[MSGB_POOL_HIT]		= { "alloc.hit",      "Reused buffers     "},
+	[MSGB_POOL_MISS]	= { "alloc.miss",     "Allocated buffers  "},
+	[MSGB_POOL_RECYCLED]	= { "free.recycled",  "Recycled buffers   "},
+	[MSGB_POOL_RELEASED]	= { "free.released",  "Released buffers   "},
+	[MSGB_POOL_ALLOCATED]	= { "alloc.total",    "Handed out buffers "},
+	[MSGB_POOL_RETURNED]	= { "free.total",     "Returned buffers   "},
 };
 
 static const struct rate_ctr_group_desc mtp_lset_ctrg_desc = {
@@ -56,6 +75,13 @@ static const struct rate_ctr_group_desc mtp_link_ctrg_desc = {
 	.ctr_desc		= mtp_link_cfg_description,
 };
 
+static const struct rate_ctr_group_desc msgb_pool_ctrg_desc = {
+	.group_name_prefix	= "msgb_pool",
+	.group_description	= "Message buffer pool",
+	.num_ctr		= ARRAY_SIZE(msgb_pool_cfg_description),
+	.ctr_desc		= msgb_pool_cfg_description,
+};
+
 const struct rate_ctr_group_desc *mtp_link_set_rate_ctr_desc()
 {
 	return &mtp_lset_ctrg_desc;
@@ -65,3 +91,8 @@ const struct rate_ctr_group_desc *mtp_link_rate_ctr_desc()
 {
 	return &mtp_link_ctrg_desc;
 }
+
+const struct rate_ctr_group_desc *msgb_pool_rate_ctr_desc()
+{
+	return &msgb_pool_ctrg_desc;
+}
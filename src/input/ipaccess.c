@@ -35,6 +35,7 @@
 #include <osmocom/core/msgb.h>
 #include <osmocom/core/talloc.h>
 #include <ipaccess.h>
+#include <msgb_pool.h>
 
 
 #ifndef ARRAY_SIZE
@@ -87,47 +88,71 @@ int ipaccess_rcvmsg_base(struct msgb *msg,
 	return ret;
 }
 
+void ipaccess_stream_reset(struct ipaccess_stream *stream)
+{
+	stream->start = 0;
+	stream->len = 0;
+}
+
 /*
- * read one ipa message from the socket
- * return NULL in case of error
+ * Read what the socket has. Returns the number of bytes read, 0 when
+ * the peer closed the connection and -errno on failure, -EAGAIN if
+ * there was nothing to read.
  */
-struct msgb *ipaccess_read_msg(struct osmo_fd *bfd, int *error)
+int ipaccess_stream_read(struct ipaccess_stream *stream, int fd)
 {
-	struct msgb *msg = msgb_alloc(TS1_ALLOC_SIZE, "Abis/IP");
-	struct ipaccess_head *hh;
-	int len, ret = 0;
+	int ret;
 
-	if (!msg) {
-		*error = -ENOMEM;
-		return NULL;
+	/* move the partial frame to the front */
+	if (stream->start > 0) {
+		memmove(stream->data, &stream->data[stream->start], stream->len);
+		stream->start = 0;
 	}
 
-	/* first read our 3-byte header */
-	hh = (struct ipaccess_head *) msg->data;
-	ret = recv(bfd->fd, msg->data, 3, 0);
-	if (ret < 0) {
-		msgb_free(msg);
-		*error = ret;
+	ret = recv(fd, &stream->data[stream->len],
+		   sizeof(stream->data) - stream->len, MSG_DONTWAIT);
+	if (ret < 0)
+		return -errno;
+
+	stream->len += ret;
+	return ret;
+}
+
+/*
+ * The next complete frame with l2h behind the header, NULL if there is
+ * none. Then error is set if the stream can not be parsed any further.
+ */
+struct msgb *ipaccess_stream_next(struct ipaccess_stream *stream, int *error)
+{
+	struct ipaccess_head *hh;
+	struct msgb *msg;
+	int len;
+
+	*error = 0;
+	if (stream->len < sizeof(*hh))
 		return NULL;
-	} else if (ret == 0) {
-		msgb_free(msg);
-		*error = ret;
+
+	hh = (struct ipaccess_head *) &stream->data[stream->start];
+	len = sizeof(*hh) + ntohs(hh->len);
+	if (len > TS1_ALLOC_SIZE) {
+		*error = -EMSGSIZE;
 		return NULL;
 	}
 
-	msgb_put(msg, ret);
+	if (stream->len < len)
+		return NULL;
 
-	/* then read te length as specified in header */
-	msg->l2h = msg->data + sizeof(*hh);
-	len = ntohs(hh->len);
-	ret = recv(bfd->fd, msg->l2h, len, 0);
-	if (ret < len) {
-		msgb_free(msg);
-		*error = -EIO;
+	msg = msgb_pool_alloc(TS1_ALLOC_SIZE, 0, "Abis/IP");
+	if (!msg) {
+		*error = -ENOMEM;
 		return NULL;
 	}
-	msgb_put(msg, ret);
 
+	memcpy(msgb_put(msg, len), hh, len);
+	msg->l2h = msg->data + sizeof(*hh);
+
+	stream->start += len;
+	stream->len -= len;
 	return msg;
 }
 
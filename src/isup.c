@@ -228,10 +228,8 @@ int mtp_link_set_isup(struct mtp_link_set *set, struct msgb *msg, int sls)
 		return -1;
 	}
 
-	if (set->pass_all_isup) {
-		mtp_link_set_forward_isup(set, msg, sls);
-		return 0;
-	}
+	if (set->pass_all_isup)
+		return mtp_link_set_forward_isup(set, msg, sls);
 
 	hdr = (struct isup_msg_hdr *) msg->l3h;
 	payload_size = msgb_l3len(msg) - sizeof(*hdr);
@@ -256,8 +254,7 @@ int mtp_link_set_isup(struct mtp_link_set *set, struct msgb *msg, int sls)
 		rc = handle_simple_resp(set, sls, hdr->cic, ISUP_MSG_RLC);
 		break;
 	default:
-		mtp_link_set_forward_isup(set, msg, sls);
-		rc = 0;
+		rc = mtp_link_set_forward_isup(set, msg, sls);
 		break;
 	}
 
@@ -0,0 +1,53 @@
+/* Lookup of links by the index used on the transport */
+/* (C) 2017 by Holger Hans Peter Freyther
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <link_index.h>
+
+static struct llist_head *bucket(struct link_index_table *table, int index)
+{
+	return &table->buckets[index & (LINK_INDEX_HASH_SIZE - 1)];
+}
+
+void link_index_table_init(struct link_index_table *table)
+{
+	int i;
+
+	for (i = 0; i < LINK_INDEX_HASH_SIZE; ++i)
+		INIT_LLIST_HEAD(&table->buckets[i]);
+}
+
+void link_index_set(struct link_index_table *table,
+		    struct link_index_entry *entry, int index)
+{
+	/* a zeroed entry has not been added yet */
+	if (entry->entry.next)
+		llist_del(&entry->entry);
+
+	entry->index = index;
+	llist_add_tail(&entry->entry, bucket(table, index));
+}
+
+struct link_index_entry *link_index_find(struct link_index_table *table, int index)
+{
+	struct link_index_entry *entry;
+
+	llist_for_each_entry(entry, bucket(table, index), entry)
+		if (entry->index == index)
+			return entry;
+
+	return NULL;
+}
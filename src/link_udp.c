@@ -26,6 +26,7 @@
 #include <snmp_mtp.h>
 #include <cellmgr_debug.h>
 #include <counter.h>
+#include <msgb_pool.h>
 
 #include <osmocom/core/talloc.h>
 
@@ -33,67 +34,103 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include <errno.h>
 #include <string.h>
 #include <unistd.h>
 
+#define UDP_READ_SIZE	2096
+
 static struct mtp_udp_link *find_link(struct mtp_udp_data *data, uint16_t link_index)
 {
-	struct mtp_udp_link *lnk;
+	struct link_index_entry *entry;
 
-	llist_for_each_entry(lnk, &data->links, entry)
-		if (lnk->link_index == link_index)
-			return lnk;
+	entry = link_index_find(&data->link_table, link_index);
+	if (!entry)
+		return NULL;
+	return container_of(entry, struct mtp_udp_link, index_entry);
+}
 
-	return NULL;
+void mtp_udp_link_set_index(struct mtp_udp_link *lnk, int link_index)
+{
+	lnk->link_index = link_index;
+	link_index_set(&lnk->data->link_table, &lnk->index_entry, link_index);
 }
 
 
-static int udp_write_cb(struct osmo_fd *fd, struct msgb *msg)
+/*
+ * Send up to tx_batch queued MSUs with one sendmmsg. The link was
+ * resolved by udp_link_write and is stored in msg->dst.
+ */
+static void udp_flush(struct mtp_udp_data *data)
 {
-	struct mtp_udp_data *data;
+	struct mmsghdr msgs[UDP_MAX_BATCH];
+	struct iovec iov[UDP_MAX_BATCH];
+	struct msgb *queued[UDP_MAX_BATCH];
 	struct mtp_udp_link *link;
-	int rc;
+	struct msgb *msg;
+	int i, nr, rc, batch;
+
+	batch = data->tx_batch;
+	if (batch < 1 || batch > UDP_MAX_BATCH)
+		batch = 1;
+
+	nr = 0;
+	memset(msgs, 0, sizeof(msgs[0]) * batch);
+	llist_for_each_entry(msg, &data->write_queue.msg_queue, list) {
+		if (nr == batch)
+			break;
+
+		link = msg->dst;
+		iov[nr].iov_base = msg->data;
+		iov[nr].iov_len = msg->len;
+		msgs[nr].msg_hdr.msg_iov = &iov[nr];
+		msgs[nr].msg_hdr.msg_iovlen = 1;
+		msgs[nr].msg_hdr.msg_name = &link->remote;
+		msgs[nr].msg_hdr.msg_namelen = sizeof(link->remote);
+		queued[nr++] = msg;
+	}
 
-	data = fd->data;
-	link = find_link(data, msg->cb[0]);
-	if (!link) {
-		LOGP(DINP, LOGL_ERROR, "Failed to find link with %lu\n", msg->cb[0]);
-		return -1;
+	rc = sendmmsg(data->write_queue.bfd.fd, msgs, nr, 0);
+	if (rc < 0) {
+		if (errno == EAGAIN)
+			return;
+
+		/* give up on the first message like a failed sendto */
+		LOGP(DINP, LOGL_ERROR, "Failed to write msg to socket: %d\n", errno);
+		rc = 1;
 	}
 
-	LOGP(DINP, LOGL_DEBUG, "Sending MSU: %s\n", osmo_hexdump(msg->data, msg->len));
-	mtp_handle_pcap(link->base, NET_OUT, msg->l2h, msgb_l2len(msg));
+	for (i = 0; i < rc; ++i) {
+		msg = queued[i];
+		link = msg->dst;
 
-	/* the assumption is we have connected the socket to the remote */
-	rc = sendto(fd->fd, msg->data, msg->len, 0,
-		     (struct sockaddr *) &link->remote, sizeof(link->remote));
-	if (rc != msg->len) {
-		LOGP(DINP, LOGL_ERROR, "Failed to write msg to socket: %d\n", rc);
-		return -1;
+		LOGP(DINP, LOGL_DEBUG, "Sending MSU: %s\n", osmo_hexdump(msg->data, msg->len));
+		mtp_handle_pcap(link->base, NET_OUT, msg->l2h, msgb_l2len(msg));
+
+		llist_del(&msg->list);
+		data->write_queue.current_length -= 1;
+		msgb_free(msg);
 	}
 
-	return 0;
+	if (llist_empty(&data->write_queue.msg_queue))
+		data->write_queue.bfd.when &= ~BSC_FD_WRITE;
+
+	/* refill from the queues of the links */
+	llist_for_each_entry(link, &data->links, entry)
+		mtp_link_tx_drain(link->base);
 }
 
-static int udp_read_cb(struct osmo_fd *fd)
+/*
+ * Handle one datagram that was read into msg->data. The msgb remains
+ * owned by the caller unless MTP_MSG_CONSUMED is returned.
+ */
+static int udp_handle_msg(struct mtp_udp_data *data, struct msgb *msg, int rc)
 {
-	struct mtp_udp_data *data;
 	struct mtp_udp_link *ulnk;
 	struct mtp_link *link;
 	struct udp_data_hdr *hdr;
-	struct msgb *msg;
-	int rc;
 	unsigned int length;
 
-	msg = msgb_alloc_headroom(4096, 128, "UDP datagram");
-	if (!msg) {
-		LOGP(DINP, LOGL_ERROR, "Failed to allocate memory.\n");
-		return -1;
-	}
-	    
-
-	data = (struct mtp_udp_data *) fd->data;
-	rc = read(fd->fd, msg->data, 2096);
 	if (rc < sizeof(*hdr)) {
 		LOGP(DINP, LOGL_ERROR, "Failed to read at least size of the header: %d\n", rc);
 		rc = -1;
@@ -163,13 +200,90 @@ static int udp_read_cb(struct osmo_fd *fd)
 	     link->nr, link->name, link->set->nr, link->set->name,
 	     osmo_hexdump(msg->data, msg->len));
 	mtp_handle_pcap(link, NET_IN, msg->l2h, msgb_l2len(msg));
-	mtp_link_set_data(link, msg);
+	if (mtp_link_set_data(link, msg) == MTP_MSG_CONSUMED)
+		return MTP_MSG_CONSUMED;
 
 exit:
-	msgb_free(msg);
 	return rc;
 }
 
+/*
+ * Drain up to rx_batch datagrams with one recvmmsg. The buffers are
+ * kept in the mtp_udp_data and are reused for the next wakeup.
+ */
+static int udp_read_cb(struct osmo_fd *fd)
+{
+	struct mtp_udp_data *data;
+	struct mmsghdr msgs[UDP_MAX_BATCH];
+	struct iovec iov[UDP_MAX_BATCH];
+	struct msgb *msg;
+	int i, nr, batch;
+
+	data = (struct mtp_udp_data *) fd->data;
+	batch = data->rx_batch;
+	if (batch < 1 || batch > UDP_MAX_BATCH)
+		batch = 1;
+
+	memset(msgs, 0, sizeof(msgs[0]) * batch);
+	for (i = 0; i < batch; ++i) {
+		msg = data->rx_msgs[i];
+		if (!msg) {
+			msg = msgb_pool_alloc(4096, 128, "UDP datagram");
+			if (!msg) {
+				LOGP(DINP, LOGL_ERROR, "Failed to allocate memory.\n");
+				break;
+			}
+			data->rx_msgs[i] = msg;
+		}
+
+		iov[i].iov_base = msg->data;
+		iov[i].iov_len = UDP_READ_SIZE;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	if (i == 0)
+		return -1;
+
+	nr = recvmmsg(fd->fd, msgs, i, MSG_DONTWAIT, NULL);
+	if (nr <= 0) {
+		LOGP(DINP, LOGL_ERROR, "Failed to read from the socket: %d\n", errno);
+		return -1;
+	}
+
+	for (i = 0; i < nr; ++i) {
+		msg = data->rx_msgs[i];
+		if (udp_handle_msg(data, msg, msgs[i].msg_len) == MTP_MSG_CONSUMED) {
+			/* relayed as it is, refill the slot on the next read */
+			data->rx_msgs[i] = NULL;
+			continue;
+		}
+
+		msgb_reset(msg);
+		msgb_reserve(msg, 128);
+	}
+
+	return 0;
+}
+
+static int udp_fd_cb(struct osmo_fd *fd, unsigned int what)
+{
+	struct mtp_udp_data *data = fd->data;
+
+	if (what & BSC_FD_READ)
+		udp_read_cb(fd);
+	if (what & BSC_FD_WRITE)
+		udp_flush(data);
+	return 0;
+}
+
+static int udp_link_tx_room(struct mtp_link *link)
+{
+	struct mtp_udp_link *ulnk = link->data;
+
+	return mtp_wqueue_room(&ulnk->data->write_queue);
+}
+
 static int udp_link_dummy(struct mtp_link *link)
 {
 	/* nothing todo */
@@ -202,17 +316,19 @@ static int udp_link_write(struct mtp_link *link, struct msgb *msg)
 {
 	struct mtp_udp_link *ulnk;
 	struct udp_data_hdr *hdr;
+	int prio;
 
 	ulnk = (struct mtp_udp_link *) link->data;
 
+	prio = mtp_msg_prio(msg);
 	hdr = (struct udp_data_hdr *) msgb_push(msg, sizeof(*hdr));
 	hdr->format_type = UDP_FORMAT_SIMPLE_UDP;
-	hdr->data_type = UDP_DATA_MSU_PRIO_0;
+	hdr->data_type = UDP_DATA_MSU_PRIO_0 + prio;
 	hdr->data_link_index = htons(ulnk->link_index);
 	hdr->user_context = 0;
 	hdr->data_length = htonl(msgb_l2len(msg));
 
-	msg->cb[0] = ulnk->link_index;
+	msg->dst = ulnk;
 
 	if (osmo_wqueue_enqueue(&ulnk->data->write_queue, msg) != 0) {
 		LOGP(DINP, LOGL_ERROR, "Failed to enqueue msg on link %d/%s of %d/%s.\n",
@@ -247,13 +363,15 @@ static void snmp_poll(void *_data)
 int link_global_init(struct mtp_udp_data *data)
 {
 	INIT_LLIST_HEAD(&data->links);
+	link_index_table_init(&data->link_table);
 	osmo_wqueue_init(&data->write_queue, 100);
+	data->rx_batch = 1;
+	data->tx_batch = 1;
 
-	/* socket creation */
+	/* socket creation, the queue is flushed by udp_fd_cb */
 	data->write_queue.bfd.data = data;
 	data->write_queue.bfd.when = BSC_FD_READ;
-	data->write_queue.read_cb = udp_read_cb;
-	data->write_queue.write_cb = udp_write_cb;
+	data->write_queue.bfd.cb = udp_fd_cb;
 
 	return 0;
 }
@@ -383,6 +501,7 @@ struct mtp_udp_link *mtp_udp_link_init(struct mtp_link *blnk)
 
 	lnk->base->reset = udp_link_reset;
 	lnk->base->write = udp_link_write;
+	lnk->base->tx_room = udp_link_tx_room;
 
 	/* prepare the remote */
 	memset(&lnk->remote, 0, sizeof(lnk->remote));
@@ -390,6 +509,7 @@ struct mtp_udp_link *mtp_udp_link_init(struct mtp_link *blnk)
 
 	/* add it to the list of udp connections */
 	llist_add_tail(&lnk->entry, &lnk->data->links);
+	mtp_udp_link_set_index(lnk, 0);
 
 	return lnk;
 }
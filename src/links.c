@@ -56,6 +56,7 @@ void mtp_link_down(struct mtp_link *link)
 	if (was_up && !one_up)
 		mtp_linkset_down(link->set);
 	link->clear_queue(link);
+	mtp_link_tx_clear(link);
 	mtp_link_stop_link_test(link);
 	mtp_link_set_init_slc(link->set);
 }
@@ -131,7 +132,7 @@ int link_init(struct bsc_data *bsc, struct mtp_link_set *set)
 		blnk = mtp_link_alloc(set);
 		lnk = mtp_udp_link_init(blnk);
 
-		lnk->link_index = i;
+		mtp_udp_link_set_index(lnk, i);
 
 		/* now connect to the transport */
 		if (snmp_mtp_peer_name(lnk->session, bsc->udp_ip) != 0)
@@ -29,6 +29,7 @@
 #include <cellmgr_debug.h>
 #include <bsc_sccp.h>
 #include <ss7_application.h>
+#include <msgb_pool.h>
 
 #include <osmocom/core/application.h>
 #include <osmocom/core/rate_ctr.h>
@@ -62,6 +63,8 @@ int main(int argc, char **argv)
 	struct ss7_application *app;
 
 	rate_ctr_init(NULL);
+	if (msgb_pool_init(NULL) != 0)
+		return -1;
 
 	thread_init();
 
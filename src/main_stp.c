@@ -29,6 +29,7 @@
 #include <cellmgr_debug.h>
 #include <sctp_m2ua.h>
 #include <ss7_application.h>
+#include <msgb_pool.h>
 
 #include <osmocom/sigtran/xua_msg.h>
 #include <osmocom/sigtran/m2ua_types.h>
@@ -206,6 +207,8 @@ int main(int argc, char **argv)
 	struct ss7_application *app;
 
 	rate_ctr_init(NULL);
+	if (msgb_pool_init(NULL) != 0)
+		return -1;
 
 	thread_init();
 
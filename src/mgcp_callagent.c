@@ -20,6 +20,7 @@
 
 #include <mgcp_callagent.h>
 #include <cellmgr_debug.h>
+#include <msgb_pool.h>
 
 #include <arpa/inet.h>
 #include <sys/socket.h>
@@ -54,7 +55,7 @@ static int mgcp_do_read(struct osmo_fd *fd)
 
 	agent = fd->data;
 
-	mgcp = msgb_alloc_headroom(4096, 128, "mgcp_from_gw");
+	mgcp = msgb_pool_alloc(4096, 128, "mgcp_from_gw");
 	if (!mgcp) {
 		LOGP(DMGCP, LOGL_ERROR, "Failed to allocate MGCP message.\n");
 		return -1;
@@ -39,20 +39,77 @@
 #include <sys/socket.h>
 #include <netinet/tcp.h>
 
+#include <sys/uio.h>
+
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
 
 #define RECONNECT_TIME		10, 0
+#define HOLD_RECONNECT_TIME	0, 500000
 #define NAT_MUX 0xfc
 
+/* frames for one writev */
+#define MSC_MAX_IOV		64
+
 static void msc_send_id_response(struct msc_connection *bsc);
 static void msc_send(struct msc_connection *bsc, struct msgb *msg, int proto);
 static void msc_schedule_reconnect(struct msc_connection *bsc);
 static int msc_conn_bind(struct msc_connection *bsc);
 static void msc_handle_id_response(struct msc_connection *bsc, struct msgb *msg);
 
+/*
+ * A short loss of the MSC connection should not clear the calls. With
+ * a replay buffer the connections are kept for up to its maximum age
+ * and the traffic is replayed after the reconnect.
+ */
+static void msc_hold_start(struct msc_connection *fw)
+{
+	if (fw->replay_max_bytes <= 0 || fw->replay_max_age <= 0)
+		return;
+
+	LOGP(DMSC, LOGL_NOTICE, "Keeping the connections of MSC %d/%s for %d ms.\n",
+	     fw->nr, fw->name, fw->replay_max_age);
+	fw->hold_connections = 1;
+	osmo_timer_schedule(&fw->hold_timer, fw->replay_max_age / 1000,
+			    (fw->replay_max_age % 1000) * 1000);
+}
+
+/* the MSC did not come back in time or the replay buffer is full */
+static void msc_hold_timeout(void *_fw_data)
+{
+	struct msc_connection *fw = _fw_data;
+
+	LOGP(DMSC, LOGL_ERROR, "Releasing the kept connections of MSC %d/%s.\n",
+	     fw->nr, fw->name);
+	fw->hold_connections = 0;
+	msc_replay_drop_connections(fw);
+	release_bsc_resources(fw);
+	if (fw->msc_link_down)
+		ss7_application_msc_down(fw->app);
+}
+
+/* returns 1 if the connections survived the reconnect */
+static int msc_hold_resume(struct msc_connection *fw)
+{
+	if (!fw->hold_connections)
+		return 0;
+
+	LOGP(DMSC, LOGL_NOTICE, "Resuming the kept connections of MSC %d/%s.\n",
+	     fw->nr, fw->name);
+	osmo_timer_del(&fw->hold_timer);
+	fw->hold_connections = 0;
+	return 1;
+}
+
+/* release the connections soon, it must not happen inside of msc_send */
+static void msc_hold_check(struct msc_connection *fw)
+{
+	if (fw->hold_connections && fw->replay_bytes > fw->replay_max_bytes)
+		osmo_timer_schedule(&fw->hold_timer, 0, 0);
+}
+
 void msc_close_connection(struct msc_connection *fw)
 {
 	struct osmo_fd *bfd = &fw->msc_connection.bfd;
@@ -63,13 +120,24 @@ void msc_close_connection(struct msc_connection *fw)
 		bfd->fd = -1;
 	}
 
+	if (!fw->msc_link_down && !fw->hold_connections)
+		msc_hold_start(fw);
+
 	fw->msc_link_down = 1;
-	release_bsc_resources(fw);
+	if (!fw->hold_connections)
+		release_bsc_resources(fw);
 	osmo_timer_del(&fw->ping_timeout);
 	osmo_timer_del(&fw->pong_timeout);
 	osmo_timer_del(&fw->msc_timeout);
+	osmo_timer_del(&fw->coalesce_timer);
+	if (fw->replay_max_bytes > 0)
+		msc_replay_save_queue(fw);
+	msc_hold_check(fw);
 	osmo_wqueue_clear(&fw->msc_connection);
-	ss7_application_msc_down(fw->app);
+	ipaccess_stream_reset(&fw->ipa_stream);
+	fw->tx_offset = 0;
+	if (!fw->hold_connections)
+		ss7_application_msc_down(fw->app);
 	msc_schedule_reconnect(fw);
 }
 
@@ -120,28 +188,10 @@ static void msc_ping_timeout(void *_fw_data)
 	osmo_timer_schedule(&fw->pong_timeout, fw->pong_time, 0);
 }
 
-/*
- * callback with IP access data
- */
-static int ipaccess_a_fd_cb(struct osmo_fd *bfd)
+static void msc_handle_ipa(struct msc_connection *fw, struct osmo_fd *bfd,
+			   struct msgb *msg)
 {
-	int error;
 	struct ipaccess_head *hh;
-	struct msc_connection *fw;
-	struct msgb *msg;
-
-	fw = bfd->data;
-	msg = ipaccess_read_msg(bfd, &error);
-
-	if (!msg) {
-		if (error == 0)
-			fprintf(stderr, "The connection to the MSC was lost, exiting\n");
-		else
-			fprintf(stderr, "Error in the IPA stream.\n");
-
-		msc_close_connection(fw);
-		return -1;
-	}
 
 	LOGP(DMSC, LOGL_DEBUG, "From MSC: %s proto: %d\n", osmo_hexdump(msg->data, msg->len), msg->l2h[0]);
 
@@ -152,12 +202,17 @@ static int ipaccess_a_fd_cb(struct osmo_fd *bfd)
 	/* initialize the networking. This includes sending a GSM08.08 message */
 	if (hh->proto == IPAC_PROTO_IPACCESS) {
 		if (fw->first_contact) {
-			LOGP(DMSC, LOGL_NOTICE, "Connected to MSC. Sending reset.\n");
+			LOGP(DMSC, LOGL_NOTICE, "Connected to MSC.\n");
 			osmo_timer_del(&fw->msc_timeout);
 			fw->first_contact = 0;
 			fw->msc_link_down = 0;
-			ss7_application_msc_up(fw->app);
-			msc_send_reset(fw);
+			if (msc_hold_resume(fw)) {
+				msc_ping_timeout(fw);
+			} else {
+				ss7_application_msc_up(fw->app);
+				msc_send_reset(fw);
+			}
+			msc_replay_start(fw);
 		}
 		if (msg->l2h[0] == IPAC_MSGT_ID_GET && fw->token) {
 			msc_send_id_response(fw);
@@ -168,14 +223,14 @@ static int ipaccess_a_fd_cb(struct osmo_fd *bfd)
 		}
 
 		msgb_free(msg);
-		return 0;
+		return;
 	}
 
 	if (fw->mode == MSC_MODE_SERVER && !fw->auth) {
 		LOGP(DMSC, LOGL_ERROR,
 			"Ignoring non ipa message for unauth user.\n");
 		msgb_free(msg);
-		return -1;
+		return;
 	}
 
 	if (hh->proto == IPAC_PROTO_SCCP) {
@@ -188,21 +243,138 @@ static int ipaccess_a_fd_cb(struct osmo_fd *bfd)
 	}
 
 	msgb_free(msg);
+}
+
+/*
+ * callback with IP access data, handle all complete frames
+ */
+static int ipaccess_a_fd_cb(struct osmo_fd *bfd)
+{
+	int rc, error;
+	struct msc_connection *fw;
+	struct msgb *msg;
+
+	fw = bfd->data;
+	rc = ipaccess_stream_read(&fw->ipa_stream, bfd->fd);
+	if (rc == -EAGAIN || rc == -EINTR)
+		return 0;
+
+	if (rc <= 0) {
+		if (rc == 0)
+			fprintf(stderr, "The connection to the MSC was lost, exiting\n");
+		else
+			fprintf(stderr, "Error in the IPA stream.\n");
+
+		msc_close_connection(fw);
+		return -1;
+	}
+
+	/* closing the connection empties the stream */
+	while ((msg = ipaccess_stream_next(&fw->ipa_stream, &error)))
+		msc_handle_ipa(fw, bfd, msg);
+
+	if (error != 0) {
+		LOGP(DMSC, LOGL_ERROR, "Error in the IPA stream: %d\n", error);
+		msc_close_connection(fw);
+		return -1;
+	}
+
 	return 0;
 }
 
-static int ipaccess_write_cb(struct osmo_fd *fd, struct msgb *msg)
+/*
+ * Write as many queued frames as possible with one writev. A partial
+ * write is resumed from tx_offset on the next call.
+ */
+static int msc_flush(struct msc_connection *fw)
 {
-	int rc;
+	struct osmo_wqueue *queue = &fw->msc_connection;
+	struct iovec iov[MSC_MAX_IOV];
+	struct msgb *msg, *tmp;
+	int nr, rc, len;
+
+	nr = 0;
+	llist_for_each_entry(msg, &queue->msg_queue, list) {
+		if (nr == MSC_MAX_IOV)
+			break;
+
+		iov[nr].iov_base = msg->data;
+		iov[nr].iov_len = msg->len;
+		if (nr == 0) {
+			iov[nr].iov_base = msg->data + fw->tx_offset;
+			iov[nr].iov_len = msg->len - fw->tx_offset;
+		}
+		nr += 1;
+	}
+
+	if (nr == 0) {
+		queue->bfd.when &= ~BSC_FD_WRITE;
+		return 0;
+	}
 
-	LOGP(DMSC, LOGL_DEBUG, "Sending to MSC: %s\n", osmo_hexdump(msg->data, msg->len));
-	rc = write(fd->fd, msg->data, msg->len);
-	if (rc != msg->len)
-		LOGP(DMSC, LOGL_ERROR, "Could not write to MSC.\n");
+	rc = writev(queue->bfd.fd, iov, nr);
+	if (rc < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 0;
 
+		LOGP(DMSC, LOGL_ERROR, "Could not write to MSC: %d\n", errno);
+		msc_close_connection(fw);
+		return -1;
+	}
+
+	/* release the written frames, remember where the last one stopped */
+	len = rc;
+	llist_for_each_entry_safe(msg, tmp, &queue->msg_queue, list) {
+		int left = msg->len - fw->tx_offset;
+
+		if (len < left) {
+			fw->tx_offset += len;
+			break;
+		}
+
+		LOGP(DMSC, LOGL_DEBUG, "Sending to MSC: %s\n",
+		     osmo_hexdump(msg->data, msg->len));
+
+		len -= left;
+		fw->tx_offset = 0;
+		llist_del(&msg->list);
+		queue->current_length -= 1;
+		msgb_free(msg);
+	}
+
+	msc_replay_refill(fw);
+	if (llist_empty(&queue->msg_queue))
+		queue->bfd.when &= ~BSC_FD_WRITE;
 	return rc;
 }
 
+static void msc_coalesce_timeout(void *_fw_data)
+{
+	struct msc_connection *fw = _fw_data;
+
+	if (fw->msc_connection.bfd.fd < 0)
+		return;
+	if (!llist_empty(&fw->msc_connection.msg_queue))
+		fw->msc_connection.bfd.when |= BSC_FD_WRITE;
+}
+
+static int msc_conn_cb(struct osmo_fd *fd, unsigned int what)
+{
+	struct msc_connection *fw = fd->data;
+
+	if (what & BSC_FD_READ) {
+		ipaccess_a_fd_cb(fd);
+
+		/* a handler might have closed the connection */
+		if (fd->fd < 0)
+			return 0;
+	}
+
+	if (what & BSC_FD_WRITE)
+		msc_flush(fw);
+	return 0;
+}
+
 /* called in the case of a non blocking connect */
 static int msc_connection_connect(struct osmo_fd *fd, unsigned int what)
 {
@@ -234,7 +406,7 @@ static int msc_connection_connect(struct osmo_fd *fd, unsigned int what)
 
 
 	/* go to full operation */
-	fd->cb = osmo_wqueue_bfd_cb;
+	fd->cb = msc_conn_cb;
 	fd->when = BSC_FD_READ;
 	if (!llist_empty(&fw->msc_connection.msg_queue))
 		fd->when |= BSC_FD_WRITE;
@@ -313,7 +485,7 @@ static int connect_to_msc(struct osmo_fd *fd, const char *ip, int port, int tos)
 		return ret;
 	} else {
 		fd->when = BSC_FD_READ;
-		fd->cb = osmo_wqueue_bfd_cb;
+		fd->cb = msc_conn_cb;
 	}
 
 	ret = osmo_fd_register(fd);
@@ -338,7 +510,7 @@ static void msc_reconnect(void *_data)
 	rc = connect_to_msc(&fw->msc_connection.bfd, fw->ip, fw->port, fw->dscp);
 	if (rc < 0) {
 		fprintf(stderr, "Opening the MSC connection failed. Trying again\n");
-		osmo_timer_schedule(&fw->reconnect_timer, RECONNECT_TIME);
+		msc_schedule_reconnect(fw);
 		return;
 	}
 
@@ -351,7 +523,12 @@ static void msc_schedule_reconnect(struct msc_connection *fw)
 {
 	if (fw->mode == MSC_MODE_SERVER)
 		return;
-	osmo_timer_schedule(&fw->reconnect_timer, RECONNECT_TIME);
+
+	/* try harder while the connections are kept */
+	if (fw->hold_connections)
+		osmo_timer_schedule(&fw->reconnect_timer, HOLD_RECONNECT_TIME);
+	else
+		osmo_timer_schedule(&fw->reconnect_timer, RECONNECT_TIME);
 }
 
 /*
@@ -378,21 +555,47 @@ static void msc_mgcp_read_cb(struct mgcp_callagent *agent, struct msgb *msg)
 	msc_send(fw, msg, NAT_MUX);
 }
 
-static void msc_send(struct msc_connection *fw, struct msgb *msg, int proto)
+static void msc_queue(struct msc_connection *fw, struct msgb *msg)
 {
-	if (fw->msc_link_down) {
-		LOGP(DMSC, LOGL_NOTICE, "Dropping data due lack of MSC connection.\n");
+	struct osmo_fd *bfd = &fw->msc_connection.bfd;
+	int writing = bfd->when & BSC_FD_WRITE;
+
+	if (osmo_wqueue_enqueue(&fw->msc_connection, msg) != 0) {
+		LOGP(DMSC, LOGL_FATAL, "Failed to queue MSG for the MSC.\n");
 		msgb_free(msg);
 		return;
 	}
 
+	/* collect a burst of frames before writing them together */
+	if (fw->tx_coalesce > 0 && !writing && bfd->cb == msc_conn_cb) {
+		if (fw->msc_connection.current_length < MSC_MAX_IOV) {
+			bfd->when &= ~BSC_FD_WRITE;
+			if (!osmo_timer_pending(&fw->coalesce_timer))
+				osmo_timer_schedule(&fw->coalesce_timer, 0,
+						    fw->tx_coalesce * 1000);
+		} else {
+			osmo_timer_del(&fw->coalesce_timer);
+		}
+	}
+}
+
+static void msc_send(struct msc_connection *fw, struct msgb *msg, int proto)
+{
 	ipaccess_prepend_header(msg, proto);
 
-	if (osmo_wqueue_enqueue(&fw->msc_connection, msg) != 0) {
-		LOGP(DMSC, LOGL_FATAL, "Failed to queue MSG for the MSC.\n");
+	/* keep it for the reconnect or behind the frames being replayed */
+	if (proto != IPAC_PROTO_IPACCESS && msc_replay_take(fw, msg)) {
+		msc_hold_check(fw);
+		return;
+	}
+
+	if (fw->msc_link_down) {
+		LOGP(DMSC, LOGL_NOTICE, "Dropping data due lack of MSC connection.\n");
 		msgb_free(msg);
 		return;
 	}
+
+	msc_queue(fw, msg);
 }
 
 void msc_send_rlc(struct msc_connection *fw,
@@ -417,6 +620,9 @@ void msc_send_reset(struct msc_connection *fw)
 	struct msgb *msg;
 
 	if (fw->msc_link_down) {
+		/* the kept connections are gone, reset after the reconnect */
+		if (fw->hold_connections)
+			osmo_timer_schedule(&fw->hold_timer, 0, 0);
 		LOGP(DMSC, LOGL_NOTICE, "Not sending reset due lack of connection.\n");
 		return;
 	}
@@ -433,7 +639,9 @@ void msc_send_reset(struct msc_connection *fw)
 	if (!msg)
 		return;
 
-	msc_send(fw, msg, IPAC_PROTO_SCCP);
+	/* the reset goes ahead of anything still waiting to be replayed */
+	ipaccess_prepend_header(msg, IPAC_PROTO_SCCP);
+	msc_queue(fw, msg);
 	msc_ping_timeout(fw);
 }
 
@@ -476,11 +684,15 @@ struct msc_connection *msc_connection_create(struct bsc_data *bsc, int mgcp)
 	osmo_wqueue_init(&msc->msc_connection, 100);
 	msc->reconnect_timer.cb = msc_reconnect;
 	msc->reconnect_timer.data = msc;
-	msc->msc_connection.read_cb = ipaccess_a_fd_cb;
-	msc->msc_connection.write_cb = ipaccess_write_cb;
+	msc->msc_connection.bfd.cb = msc_conn_cb;
 	msc->msc_connection.bfd.data = msc;
 	msc->msc_connection.bfd.fd = -1;
 	msc->msc_link_down = 1;
+	msc->coalesce_timer.cb = msc_coalesce_timeout;
+	msc->coalesce_timer.data = msc;
+	INIT_LLIST_HEAD(&msc->replay_queue);
+	msc->hold_timer.cb = msc_hold_timeout;
+	msc->hold_timer.data = msc;
 
 	/* handle the timeout */
 	msc->ping_time = -1;
@@ -617,7 +829,9 @@ static void msc_handle_id_response(struct msc_connection *msc, struct msgb *msg)
 
 	LOGP(DMSC, LOGL_NOTICE, "Authenticated the connection.\n");
 	msc->auth = 1;
-	ss7_application_msc_up(msc->app);
+	if (!msc_hold_resume(msc))
+		ss7_application_msc_up(msc->app);
+	msc_replay_start(msc);
 	return;
 clean:
 	msc_close_connection(msc);
@@ -651,6 +865,7 @@ static int msc_conn_accept(struct osmo_fd *bsc_fd, unsigned int what)
 	/* adopt the connection */
 	msc->msc_connection.bfd.fd = ret;
 	msc->msc_connection.bfd.when = BSC_FD_READ;
+	msc->msc_connection.bfd.cb = msc_conn_cb;
 	ret = osmo_fd_register(&msc->msc_connection.bfd);
 	if (ret < 0) {
 		LOGP(DMSC, LOGL_ERROR, "Failed to register fd.\n");
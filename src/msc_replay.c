@@ -0,0 +1,244 @@
+/* Hold the MSC traffic while the connection is re-established */
+/*
+ * (C) 2017 by Holger Hans Peter Freyther
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <msc_connection.h>
+#include <ipaccess.h>
+#include <cellmgr_debug.h>
+
+#include <osmocom/core/write_queue.h>
+#include <osmocom/gsm/protocol/gsm_08_08.h>
+#include <osmocom/sccp/sccp_types.h>
+
+#include <time.h>
+
+/* when a frame was put into the replay buffer */
+#define MSC_REPLAY_CB(msg)	(msg)->cb[0]
+
+static unsigned long now_ms(void)
+{
+	struct timespec tp;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &tp) != 0)
+		return 0;
+	return tp.tv_sec * 1000UL + tp.tv_nsec / 1000000;
+}
+
+static void replay_drop(struct msc_connection *fw, struct msgb *msg)
+{
+	llist_del(&msg->list);
+	fw->replay_bytes -= msg->len;
+	fw->replay_dropped += 1;
+	msgb_free(msg);
+}
+
+/* forget the frames that are too old to be useful for the MSC */
+static void replay_expire(struct msc_connection *fw)
+{
+	struct msgb *msg, *tmp;
+	unsigned long now;
+
+	/* the hold of the connections ends at the same age */
+	if (fw->replay_max_age <= 0 || fw->hold_connections)
+		return;
+
+	now = now_ms();
+	llist_for_each_entry_safe(msg, tmp, &fw->replay_queue, list) {
+		if (now - MSC_REPLAY_CB(msg) < fw->replay_max_age)
+			break;
+		replay_drop(fw, msg);
+	}
+}
+
+/*
+ * Without the connections only connectionless data outlives the RESET
+ * that is sent after the reconnect, a stale RESET or RESET ACK would
+ * undo the new one.
+ */
+static int replay_wanted(struct msgb *msg)
+{
+	struct ipaccess_head *hh = (struct ipaccess_head *) msg->data;
+	struct sccp_data_unitdata *udt;
+	uint8_t *data;
+	int len = msg->len - sizeof(*hh);
+
+	if (hh->proto != IPAC_PROTO_SCCP || len < (int) sizeof(*udt))
+		return 0;
+
+	udt = (struct sccp_data_unitdata *) hh->data;
+	if (udt->type != SCCP_MSG_TYPE_UDT)
+		return 0;
+	if ((int) sizeof(*udt) + udt->variable_data + 3 > len)
+		return 0;
+
+	data = &udt->variable_data + udt->variable_data;
+	if (data[0] >= 3 && data[1] == BSSAP_MSG_BSS_MANAGEMENT &&
+	    (data[3] == BSS_MAP_MSG_RESET || data[3] == BSS_MAP_MSG_RESET_ACKNOWLEDGE))
+		return 0;
+	return 1;
+}
+
+static void replay_trim(struct msc_connection *fw)
+{
+	struct msgb *old;
+
+	replay_expire(fw);
+	while (fw->replay_bytes > fw->replay_max_bytes) {
+		old = llist_entry(fw->replay_queue.next, struct msgb, list);
+		replay_drop(fw, old);
+	}
+}
+
+/*
+ * Queue a frame with the IPA header, the oldest ones make room. While
+ * the connections are held nothing is evicted, the caller releases the
+ * connections once the buffer is full.
+ */
+static void replay_enqueue(struct msc_connection *fw, struct msgb *msg)
+{
+	if (msg->len > fw->replay_max_bytes) {
+		fw->replay_dropped += 1;
+		msgb_free(msg);
+		return;
+	}
+
+	MSC_REPLAY_CB(msg) = now_ms();
+	llist_add_tail(&msg->list, &fw->replay_queue);
+	fw->replay_bytes += msg->len;
+
+	if (!fw->hold_connections)
+		replay_trim(fw);
+}
+
+/*
+ * Take a frame with the IPA header that can not go to the write queue
+ * right now. While the link is down the buffer is bounded by bytes and
+ * age. It holds the connectionless data and, while the connections are
+ * held, the connection-oriented data as well. After the reconnect the
+ * new traffic queues up behind the frames that are still being
+ * replayed. It belongs to the new connection and is never evicted.
+ * Returns 1 if the msgb was taken.
+ */
+int msc_replay_take(struct msc_connection *fw, struct msgb *msg)
+{
+	if (fw->msc_link_down) {
+		if (fw->replay_max_bytes <= 0)
+			return 0;
+		if (!fw->hold_connections && !replay_wanted(msg))
+			return 0;
+
+		replay_enqueue(fw, msg);
+		return 1;
+	}
+
+	if (llist_empty(&fw->replay_queue))
+		return 0;
+
+	llist_add_tail(&msg->list, &fw->replay_queue);
+	fw->replay_bytes += msg->len;
+	return 1;
+}
+
+/*
+ * Keep the data that did not make it to the MSC, see msc_replay_take
+ * for what is kept. A partially written frame is sent again from the
+ * start on the new connection. The frames are older than anything
+ * still waiting in the replay buffer and go in front of it.
+ */
+void msc_replay_save_queue(struct msc_connection *fw)
+{
+	struct osmo_wqueue *queue = &fw->msc_connection;
+	struct ipaccess_head *hh;
+	struct msgb *msg, *tmp;
+	unsigned long now = now_ms();
+	LLIST_HEAD(saved);
+	int keep;
+
+	fw->tx_offset = 0;
+	llist_for_each_entry_safe(msg, tmp, &queue->msg_queue, list) {
+		llist_del(&msg->list);
+		queue->current_length -= 1;
+
+		hh = (struct ipaccess_head *) msg->data;
+		if (fw->hold_connections)
+			keep = hh->proto != IPAC_PROTO_IPACCESS;
+		else
+			keep = replay_wanted(msg);
+		if (!keep) {
+			msgb_free(msg);
+			continue;
+		}
+
+		MSC_REPLAY_CB(msg) = now;
+		llist_add_tail(&msg->list, &saved);
+		fw->replay_bytes += msg->len;
+	}
+
+	llist_splice(&saved, &fw->replay_queue);
+	if (!fw->hold_connections)
+		replay_trim(fw);
+}
+
+/* the held connections were released, their frames are of no use */
+void msc_replay_drop_connections(struct msc_connection *fw)
+{
+	struct msgb *msg, *tmp;
+
+	llist_for_each_entry_safe(msg, tmp, &fw->replay_queue, list)
+		if (!replay_wanted(msg))
+			replay_drop(fw, msg);
+
+	replay_trim(fw);
+}
+
+/* feed the write queue from the replay buffer without overflowing it */
+void msc_replay_refill(struct msc_connection *fw)
+{
+	struct osmo_wqueue *queue = &fw->msc_connection;
+	struct msgb *msg, *tmp;
+	int count = 0;
+
+	llist_for_each_entry_safe(msg, tmp, &fw->replay_queue, list) {
+		if (queue->current_length + 1 >= queue->max_length)
+			break;
+
+		llist_del(&msg->list);
+		fw->replay_bytes -= msg->len;
+		llist_add_tail(&msg->list, &queue->msg_queue);
+		queue->current_length += 1;
+		count += 1;
+	}
+
+	if (count == 0)
+		return;
+
+	fw->replay_sent += count;
+	queue->bfd.when |= BSC_FD_WRITE;
+}
+
+/* the link is up again, a RESET has to be queued before */
+void msc_replay_start(struct msc_connection *fw)
+{
+	replay_expire(fw);
+	if (llist_empty(&fw->replay_queue))
+		return;
+
+	LOGP(DMSC, LOGL_NOTICE, "Replaying %d bytes to MSC %d/%s.\n",
+	     fw->replay_bytes, fw->nr, fw->name);
+	msc_replay_refill(fw);
+}
@@ -0,0 +1,127 @@
+/* Recycle msgb's of the hot paths */
+/* (C) 2017 by Holger Hans Peter Freyther
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <msgb_pool.h>
+#include <counter.h>
+#include <cellmgr_debug.h>
+
+#include <osmocom/core/rate_ctr.h>
+#include <osmocom/core/talloc.h>
+
+struct msgb_pool_class msgb_pool_classes[_NUM_MSGB_POOL] = {
+	[MSGB_POOL_SMALL] = {
+		.size = 256,
+		.free = LLIST_HEAD_INIT(msgb_pool_classes[MSGB_POOL_SMALL].free),
+	},
+	[MSGB_POOL_MEDIUM] = {
+		.size = 2048,
+		.free = LLIST_HEAD_INIT(msgb_pool_classes[MSGB_POOL_MEDIUM].free),
+	},
+	[MSGB_POOL_LARGE] = {
+		.size = 4096,
+		.free = LLIST_HEAD_INIT(msgb_pool_classes[MSGB_POOL_LARGE].free),
+	},
+};
+
+static void pool_ctr_inc(struct msgb_pool_class *cls, int ctr)
+{
+	if (cls->ctrg)
+		rate_ctr_inc(&cls->ctrg->ctr[ctr]);
+}
+
+static struct msgb_pool_class *class_for_size(unsigned int size)
+{
+	int i;
+
+	for (i = 0; i < _NUM_MSGB_POOL; ++i)
+		if (msgb_pool_classes[i].size >= size)
+			return &msgb_pool_classes[i];
+	return NULL;
+}
+
+/*
+ * The msgb's are handed to the write queues and are released with
+ * msgb_free from inside libosmocore. Returning -1 from the talloc
+ * destructor keeps the memory alive and we can put it back into the
+ * free list of its size class.
+ */
+static int msgb_pool_destructor(struct msgb *msg)
+{
+	struct msgb_pool_class *cls;
+
+	cls = class_for_size(msg->data_len);
+	cls->outstanding -= 1;
+	pool_ctr_inc(cls, MSGB_POOL_RETURNED);
+
+	if (cls->nr_free >= MSGB_POOL_MAX_FREE) {
+		pool_ctr_inc(cls, MSGB_POOL_RELEASED);
+		return 0;
+	}
+
+	msgb_reset(msg);
+	llist_add(&msg->list, &cls->free);
+	cls->nr_free += 1;
+	pool_ctr_inc(cls, MSGB_POOL_RECYCLED);
+	return -1;
+}
+
+struct msgb *msgb_pool_alloc(uint16_t size, uint16_t headroom, const char *name)
+{
+	struct msgb_pool_class *cls;
+	struct msgb *msg;
+
+	cls = class_for_size(size);
+	if (!cls)
+		return msgb_alloc_headroom(size, headroom, name);
+
+	if (!llist_empty(&cls->free)) {
+		msg = llist_entry(cls->free.next, struct msgb, list);
+		llist_del(&msg->list);
+		cls->nr_free -= 1;
+		talloc_set_name_const(msg, name);
+		pool_ctr_inc(cls, MSGB_POOL_HIT);
+	} else {
+		msg = msgb_alloc(cls->size, name);
+		if (!msg)
+			return NULL;
+		talloc_set_destructor(msg, msgb_pool_destructor);
+		pool_ctr_inc(cls, MSGB_POOL_MISS);
+	}
+
+	cls->outstanding += 1;
+	pool_ctr_inc(cls, MSGB_POOL_ALLOCATED);
+	msgb_reserve(msg, headroom);
+	return msg;
+}
+
+int msgb_pool_init(void *ctx)
+{
+	int i;
+
+	for (i = 0; i < _NUM_MSGB_POOL; ++i) {
+		msgb_pool_classes[i].ctrg =
+			rate_ctr_group_alloc(ctx, msgb_pool_rate_ctr_desc(),
+					     msgb_pool_classes[i].size);
+		if (!msgb_pool_classes[i].ctrg) {
+			LOGP(DINP, LOGL_ERROR,
+			     "Failed to allocate the msgb pool counters.\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
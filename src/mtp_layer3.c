@@ -19,11 +19,13 @@
  *
  */
 #include <mtp_data.h>
+#include <mtp_route.h>
 #include <osmocom/mtp/mtp_level3.h>
 #include <bsc_data.h>
 #include <cellmgr_debug.h>
 #include <isup_types.h>
 #include <counter.h>
+#include <msgb_pool.h>
 
 #include <osmocom/core/talloc.h>
 
@@ -32,16 +34,22 @@
 #include <arpa/inet.h>
 
 #include <string.h>
+#include <time.h>
+
+/* wait for the link to send out the user traffic first */
+#define MTP_RESTART_TFX_BACKOFF	10000
 
 static int mtp_int_submit(struct mtp_link_set *set, int opc, int dpc, int sls, int type, const uint8_t *data, unsigned int length);
+static int mtp_int_relay(struct mtp_link_set *set, int opc, int dpc, int sls, int type, struct msgb *msg, uint8_t *data);
 
 static void linkset_t18_cb(void *_set);
 static void linkset_t20_cb(void *_set);
+static void linkset_tfx_cb(void *_set);
 
 struct msgb *mtp_msg_alloc(struct mtp_link_set *set)
 {
 	struct mtp_level_3_hdr *hdr;
-	struct msgb *msg = msgb_alloc_headroom(4096, 128, "mtp-msg");
+	struct msgb *msg = msgb_pool_alloc(4096, 128, "mtp-msg");
 	if (!msg) {
 		LOGP(DINP, LOGL_ERROR, "Failed to allocate mtp msg\n");
 		return NULL;
@@ -55,23 +63,144 @@ struct msgb *mtp_msg_alloc(struct mtp_link_set *set)
 	return msg;
 }
 
+static uint8_t *tmpl_put(struct mtp_msg_tmpl *tmpl, int len)
+{
+	uint8_t *data = &tmpl->data[tmpl->len];
+
+	tmpl->len += len;
+	return data;
+}
+
+static void tmpl_hdr(struct mtp_msg_tmpl *tmpl, struct mtp_link_set *set,
+		     int ser_ind, int opc)
+{
+	struct mtp_level_3_hdr *hdr;
+
+	hdr = (struct mtp_level_3_hdr *) tmpl_put(tmpl, sizeof(*hdr));
+	hdr->ser_ind = ser_ind;
+	hdr->addr = MTP_ADDR(0x0, set->dpc, opc);
+	hdr->ni = set->ni;
+	hdr->spare = set->spare;
+}
+
+static void tmpl_prohib(struct mtp_msg_tmpl *tmpl, struct mtp_link_set *set, int msg)
+{
+	struct mtp_level_3_prohib *prb;
+
+	tmpl_hdr(tmpl, set, MTP_SI_MNT_SNM_MSG, set->opc);
+	prb = (struct mtp_level_3_prohib *) tmpl_put(tmpl, sizeof(*prb));
+	prb->cmn.h0 = MTP_PROHIBIT_MSG_GRP;
+	prb->cmn.h1 = msg;
+}
+
+static void mtp_tmpl_build(struct mtp_link_set *set)
+{
+	const uint8_t test_ptrn[14] = { 'G', 'S', 'M', 'M', 'M', 'S', };
+	struct mtp_tmpl_cache *cache = &set->tmpl_cache;
+	struct sccp_data_unitdata *udt;
+	struct mtp_level_3_cmn *cmn;
+	struct mtp_level_3_mng *mng;
+	struct mtp_msg_tmpl *tmpl;
+	uint8_t *data;
+
+	memset(cache, 0, sizeof(*cache));
+	cache->dpc = set->dpc;
+	cache->opc = set->opc;
+	cache->sccp_opc = set->sccp_opc;
+	cache->ni = set->ni;
+	cache->spare = set->spare;
+
+	tmpl_prohib(&cache->tmpl[MTP_TMPL_TFP], set, MTP_PROHIBIT_MSG_SIG);
+	tmpl_prohib(&cache->tmpl[MTP_TMPL_TFA], set, MTP_PROHIBIT_MSG_TFA);
+
+	tmpl = &cache->tmpl[MTP_TMPL_TRA];
+	tmpl_hdr(tmpl, set, MTP_SI_MNT_SNM_MSG, set->opc);
+	cmn = (struct mtp_level_3_cmn *) tmpl_put(tmpl, sizeof(*cmn));
+	cmn->h0 = MTP_TRF_RESTR_MSG_GRP;
+	cmn->h1 = MTP_RESTR_MSG_ALLWED;
+
+	/* the test pattern is copied from the SLTM */
+	tmpl = &cache->tmpl[MTP_TMPL_SLTA];
+	tmpl_hdr(tmpl, set, MTP_SI_MNT_REG_MSG, set->opc);
+	mng = (struct mtp_level_3_mng *) tmpl_put(tmpl, sizeof(*mng));
+	mng->cmn.h0 = MTP_TST_MSG_GRP;
+	mng->cmn.h1 = MTP_TST_MSG_SLTA;
+
+	tmpl = &cache->tmpl[MTP_TMPL_SLTM];
+	tmpl_hdr(tmpl, set, MTP_SI_MNT_REG_MSG, set->opc);
+	mng = (struct mtp_level_3_mng *) tmpl_put(tmpl, sizeof(*mng));
+	mng->cmn.h0 = MTP_TST_MSG_GRP;
+	mng->cmn.h1 = MTP_TST_MSG_SLTM;
+	mng->length = ARRAY_SIZE(test_ptrn);
+	memcpy(tmpl_put(tmpl, ARRAY_SIZE(test_ptrn)), test_ptrn, ARRAY_SIZE(test_ptrn));
+
+	/* generate the UDT message... libsccp does not offer formating yet */
+	tmpl = &cache->tmpl[MTP_TMPL_SCMG];
+	tmpl_hdr(tmpl, set, MTP_SI_MNT_SCCP, set->sccp_opc);
+	udt = (struct sccp_data_unitdata *) tmpl_put(tmpl, sizeof(*udt));
+	udt->type = SCCP_MSG_TYPE_UDT;
+	udt->proto_class = SCCP_PROTOCOL_CLASS_0;
+	udt->variable_called = 3;
+	udt->variable_calling = 5;
+	udt->variable_data = 7;
+
+	/* put the called and calling address. It is LV */
+	data = tmpl_put(tmpl, 2 + 1);
+	data[0] = 2;
+	data[1] = 0x42;
+	data[2] = 0x1;
+
+	data = tmpl_put(tmpl, 2 + 1);
+	data[0] = 2;
+	data[1] = 0x42;
+	data[2] = 0x1;
+
+	data = tmpl_put(tmpl, 1);
+	data[0] = sizeof(struct sccp_con_ctrl_prt_mgt);
+	tmpl_put(tmpl, sizeof(struct sccp_con_ctrl_prt_mgt));
+
+	cache->valid = 1;
+}
+
+/*
+ * Copy the template into a pooled msgb, the caller patches the routing
+ * label and the variable fields.
+ */
+struct msgb *mtp_tmpl_alloc(struct mtp_link_set *set, enum mtp_tmpl_type type)
+{
+	struct mtp_tmpl_cache *cache = &set->tmpl_cache;
+	struct msgb *msg;
+
+	if (!cache->valid || cache->dpc != set->dpc || cache->opc != set->opc
+	    || cache->sccp_opc != set->sccp_opc || cache->ni != set->ni
+	    || cache->spare != set->spare)
+		mtp_tmpl_build(set);
+
+	msg = msgb_pool_alloc(4096, 128, "mtp-msg");
+	if (!msg) {
+		LOGP(DINP, LOGL_ERROR, "Failed to allocate mtp msg\n");
+		return NULL;
+	}
+
+	msg->l2h = msgb_put(msg, cache->tmpl[type].len);
+	memcpy(msg->l2h, cache->tmpl[type].data, cache->tmpl[type].len);
+	return msg;
+}
+
 static struct msgb *mtp_create_slta(struct mtp_link_set *set, int sls,
 				    struct mtp_level_3_mng *in_mng, int l3_len)
 {
 	struct mtp_level_3_hdr *hdr;
 	struct mtp_level_3_mng *mng;
-	struct msgb *out = mtp_msg_alloc(set);
+	struct msgb *out = mtp_tmpl_alloc(set, MTP_TMPL_SLTA);
 
 	if (!out)
 		return NULL;
 
 	hdr = (struct mtp_level_3_hdr *) out->l2h;
-	hdr->ser_ind = MTP_SI_MNT_REG_MSG;
 	hdr->addr = MTP_ADDR(sls, set->dpc, set->opc);
 
-	mng = (struct mtp_level_3_mng *) msgb_put(out, sizeof(*mng));
-	mng->cmn.h0 = MTP_TST_MSG_GRP;
-	mng->cmn.h1 = MTP_TST_MSG_SLTA;
+	mng = (struct mtp_level_3_mng *) &hdr->data[0];
 	mng->length =  l3_len - 2;
 	msgb_put(out, mng->length);
 	memcpy(mng->data, in_mng->data, mng->length);
@@ -80,96 +209,61 @@ static struct msgb *mtp_create_slta(struct mtp_link_set *set, int sls,
 }
 
 
-static struct msgb *mtp_base_alloc(struct mtp_link *link, int msg, int apoc)
+static struct msgb *mtp_base_alloc(struct mtp_link *link, int type, int apoc)
 {
 	struct mtp_level_3_hdr *hdr;
 	struct mtp_level_3_prohib *prb;
-	struct msgb *out = mtp_msg_alloc(link->set);
+	struct msgb *out = mtp_tmpl_alloc(link->set, type);
 
 	if (!out)
 		return NULL;
 
 	hdr = (struct mtp_level_3_hdr *) out->l2h;
-	hdr->ser_ind = MTP_SI_MNT_SNM_MSG;
 	hdr->addr = MTP_ADDR(link->first_sls, link->set->dpc, link->set->opc);
-	prb = (struct mtp_level_3_prohib *) msgb_put(out, sizeof(*prb));
-	prb->cmn.h0 = MTP_PROHIBIT_MSG_GRP;
-	prb->cmn.h1 = msg;
+	prb = (struct mtp_level_3_prohib *) &hdr->data[0];
 	prb->apoc = MTP_MAKE_APOC(apoc);
 	return out;
 }
 
 static struct msgb *mtp_tfp_alloc(struct mtp_link *link, int apoc)
 {
-	return mtp_base_alloc(link, MTP_PROHIBIT_MSG_SIG, apoc);
+	return mtp_base_alloc(link, MTP_TMPL_TFP, apoc);
 }
 
 static struct msgb *mtp_tfa_alloc(struct mtp_link *link, int apoc)
 {
-	return mtp_base_alloc(link, MTP_PROHIBIT_MSG_TFA, apoc);
+	return mtp_base_alloc(link, MTP_TMPL_TFA, apoc);
 }
 
 static struct msgb *mtp_tra_alloc(struct mtp_link *link, int opc)
 {
 	struct mtp_level_3_hdr *hdr;
-	struct mtp_level_3_cmn *cmn;
-	struct msgb *out = mtp_msg_alloc(link->set);
+	struct msgb *out = mtp_tmpl_alloc(link->set, MTP_TMPL_TRA);
 
 	if (!out)
 		return NULL;
 
 	hdr = (struct mtp_level_3_hdr *) out->l2h;
-	hdr->ser_ind = MTP_SI_MNT_SNM_MSG;
 	hdr->addr = MTP_ADDR(0x0, link->set->dpc, opc);
-	cmn = (struct mtp_level_3_cmn *) msgb_put(out, sizeof(*cmn));
-	cmn->h0 = MTP_TRF_RESTR_MSG_GRP;
-	cmn->h1 = MTP_RESTR_MSG_ALLWED;
 	return out;
 }
 
 static struct msgb *mtp_sccp_alloc_scmg(struct mtp_link_set *set,
 					int type, int assn, int apoc, int sls)
 {
-	struct sccp_data_unitdata *udt;
 	struct sccp_con_ctrl_prt_mgt *prt;
 	struct mtp_level_3_hdr *hdr;
-	uint8_t *data;
-
-
-	struct msgb *out = mtp_msg_alloc(set);
+	struct msgb *out = mtp_tmpl_alloc(set, MTP_TMPL_SCMG);
 
 	if (!out)
 		return NULL;
 
 	hdr = (struct mtp_level_3_hdr *) out->l2h;
-	hdr->ser_ind = MTP_SI_MNT_SCCP;
 
 	/* this appears to be round robin or such.. */
 	hdr->addr = MTP_ADDR(sls % 16, set->dpc, set->sccp_opc);
 
-	/* generate the UDT message... libsccp does not offer formating yet */
-	udt = (struct sccp_data_unitdata *) msgb_put(out, sizeof(*udt));
-	udt->type = SCCP_MSG_TYPE_UDT;
-	udt->proto_class = SCCP_PROTOCOL_CLASS_0;
-	udt->variable_called = 3;
-	udt->variable_calling = 5;
-	udt->variable_data = 7;
-
-	/* put the called and calling address. It is LV */
-	data = msgb_put(out, 2 + 1);
-	data[0] = 2;
-	data[1] = 0x42;
-	data[2] = 0x1;
-
-	data = msgb_put(out, 2 + 1);
-	data[0] = 2;
-	data[1] = 0x42;
-	data[2] = 0x1;
-
-	data = msgb_put(out, 1);
-	data[0] = sizeof(*prt);
-
-	prt = (struct sccp_con_ctrl_prt_mgt *) msgb_put(out, sizeof(*prt));
+	prt = (struct sccp_con_ctrl_prt_mgt *) (out->tail - sizeof(*prt));
 	prt->sst = type;
 	prt->assn = assn;
 	prt->apoc = apoc;
@@ -186,10 +280,13 @@ void mtp_link_set_stop(struct mtp_link_set *set)
 
 	osmo_timer_del(&set->T18);
 	osmo_timer_del(&set->T20);
+	osmo_timer_del(&set->restart.tfx_timer);
+	set->restart.phase = MTP_RESTART_IDLE;
 
 	set->sccp_up = 0;
 	set->running = 0;
 	set->linkset_up = 0;
+	mtp_route_update_set(set);
 }
 
 void mtp_link_set_reset(struct mtp_link_set *set)
@@ -202,8 +299,7 @@ void mtp_link_set_reset(struct mtp_link_set *set)
 		mtp_link_start_link_test(lnk);
 }
 
-/* unused right now but we want to use it again */
-int send_tfp(struct mtp_link *link, int apoc)
+static int send_tfp(struct mtp_link *link, int apoc)
 {
 	struct msgb *msg;
 	msg = mtp_tfp_alloc(link, apoc);
@@ -243,6 +339,13 @@ int mtp_link_verified(struct mtp_link *link)
 		return 0;
 
 	set->linkset_up = 1;
+	set->restart.phase = MTP_RESTART_COLLECT;
+	set->restart.t20_expired = 0;
+	set->restart.collect_ms = set->restart.broadcast_ms = set->restart.tra_ms = 0;
+	set->restart.nr_tfa = set->restart.nr_tfp = 0;
+	clock_gettime(CLOCK_MONOTONIC, &set->restart.start);
+	rate_ctr_inc(&set->ctrg->ctr[MTP_LSET_RESTART]);
+
 	if (set->timeout_t18 != 0)
 		osmo_timer_schedule(&set->T18, set->timeout_t18, 0);
 	if (set->timeout_t20 != 0)
@@ -269,22 +372,151 @@ int mtp_link_verified(struct mtp_link *link)
 	return 0;
 }
 
+static const char *restart_phase_names[] = {
+	[MTP_RESTART_IDLE]	= "idle",
+	[MTP_RESTART_COLLECT]	= "collecting routing data",
+	[MTP_RESTART_BROADCAST]	= "sending TFA/TFP",
+	[MTP_RESTART_WAIT_T20]	= "waiting for T20",
+};
+
+const char *mtp_restart_phase_name(int phase)
+{
+	if (phase < 0 || phase >= ARRAY_SIZE(restart_phase_names))
+		return "unknown";
+	return restart_phase_names[phase];
+}
+
+static int restart_ms(struct mtp_link_set *set)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - set->restart.start.tv_sec) * 1000
+		+ (now.tv_nsec - set->restart.start.tv_nsec) / 1000000;
+}
+
+static void linkset_restart_failed(struct mtp_link_set *set)
+{
+	LOGP(DINP, LOGL_ERROR,
+	     "Linkset restart but no link available on linkset %d\n", set->nr);
+	osmo_timer_del(&set->T20);
+	osmo_timer_del(&set->restart.tfx_timer);
+	set->restart.phase = MTP_RESTART_IDLE;
+	set->linkset_up = 0;
+}
+
+static void linkset_send_tra(struct mtp_link_set *set, struct mtp_link *link)
+{
+	/* Send the TRA for all PCs */
+	if (send_tra(link, set->opc) != 0)
+		return;
+
+	if (set->restart.phase != MTP_RESTART_IDLE) {
+		set->restart.tra_ms = restart_ms(set);
+		set->restart.phase = MTP_RESTART_IDLE;
+	}
+
+	LOGP(DINP, LOGL_NOTICE,
+	     "The linkset %d/%s is considered running.\n", set->nr, set->name);
+}
+
 static void linkset_t18_cb(void *_set)
 {
 	struct mtp_link_set *set = _set;
 	struct mtp_link *link = set->slc[0];
 
 	if (!link) {
-		LOGP(DINP, LOGL_ERROR,
-		     "Linkset restart but no link available on linkset %d\n", set->nr);
-		osmo_timer_del(&set->T20);
-		set->linkset_up = 0;
+		linkset_restart_failed(set);
 		return;
 	}
 
-	/* TODO: now send out routing states */
 	LOGP(DINP, LOGL_NOTICE, "The linkset %d has collected routing data.\n", set->nr);
 	set->sccp_up = 1;
+	mtp_route_update_set(set);
+
+	/* a TRA outside of a restart, the routing data was sent already */
+	if (set->restart.phase != MTP_RESTART_COLLECT)
+		return;
+
+	set->restart.collect_ms = restart_ms(set);
+	set->restart.phase = MTP_RESTART_BROADCAST;
+	set->restart.next_pc = 0;
+	linkset_tfx_cb(set);
+}
+
+/*
+ * Tell the adjacent SP about every destination of the routing table.
+ * Destinations we reach through it are prohibited for it.
+ */
+static int linkset_send_tfx(struct mtp_link_set *set, struct mtp_link *link,
+			    struct mtp_route_dest *dest)
+{
+	int i, allowed = dest->nr_active > 0;
+
+	for (i = 0; i < dest->nr_active; ++i)
+		if (dest->active[i] == set)
+			allowed = 0;
+
+	if (allowed) {
+		if (send_tfa(link, dest->dpc) != 0)
+			return -1;
+		set->restart.nr_tfa += 1;
+		rate_ctr_inc(&set->ctrg->ctr[MTP_LSET_TFA_OUT_MSG]);
+	} else {
+		if (send_tfp(link, dest->dpc) != 0)
+			return -1;
+		set->restart.nr_tfp += 1;
+		rate_ctr_inc(&set->ctrg->ctr[MTP_LSET_TFP_OUT_MSG]);
+	}
+
+	return 0;
+}
+
+/*
+ * Send a batch of TFx per main loop iteration so the user traffic of
+ * the other linksets keeps flowing while a large table is announced.
+ */
+static void linkset_tfx_cb(void *_set)
+{
+	struct mtp_link_set *set = _set;
+	struct mtp_route_table *table = &set->bsc->routes;
+	struct mtp_route_dest *dest;
+	struct mtp_link *link = set->slc[0];
+	int sent = 0;
+
+	if (!link) {
+		linkset_restart_failed(set);
+		return;
+	}
+
+	if (link->tx_depth > 0) {
+		osmo_timer_schedule(&set->restart.tfx_timer, 0, MTP_RESTART_TFX_BACKOFF);
+		return;
+	}
+
+	for (; set->restart.next_pc < MTP_ROUTE_NR_PC; ++set->restart.next_pc) {
+		if (sent == set->restart.tfx_batch)
+			break;
+
+		dest = table->dests[set->restart.next_pc];
+		if (!dest || dest->dpc == set->dpc)
+			continue;
+		if (linkset_send_tfx(set, link, dest) == 0)
+			sent += 1;
+	}
+
+	if (set->restart.next_pc < MTP_ROUTE_NR_PC) {
+		osmo_timer_schedule(&set->restart.tfx_timer, 0, 0);
+		return;
+	}
+
+	set->restart.broadcast_ms = restart_ms(set);
+	set->restart.phase = MTP_RESTART_WAIT_T20;
+	LOGP(DINP, LOGL_NOTICE, "Sent %d TFA and %d TFP on linkset %d/%s.\n",
+	     set->restart.nr_tfa, set->restart.nr_tfp, set->nr, set->name);
+
+	if (set->restart.t20_expired)
+		linkset_send_tra(set, link);
 }
 
 static void linkset_t20_cb(void *_set)
@@ -293,26 +525,25 @@ static void linkset_t20_cb(void *_set)
 	struct mtp_link *link = set->slc[0];
 
 	if (!link) {
-		LOGP(DINP, LOGL_ERROR,
-		     "Linkset restart but no link available on linkset %d\n", set->nr);
-		osmo_timer_del(&set->T20);
-		set->linkset_up = 0;
+		linkset_restart_failed(set);
 		return;
 	}
 
-	/* Send the TRA for all PCs */
-	if (send_tra(link, set->opc) != 0)
+	/* the TRA follows the TFx */
+	if (set->restart.phase == MTP_RESTART_COLLECT
+	    || set->restart.phase == MTP_RESTART_BROADCAST) {
+		set->restart.t20_expired = 1;
 		return;
+	}
 
-	LOGP(DINP, LOGL_NOTICE,
-	     "The linkset %d/%s is considered running.\n", set->nr, set->name);
-	return;
+	linkset_send_tra(set, link);
 }
 
 static int mtp_link_sign_msg(struct mtp_link_set *set, struct mtp_level_3_hdr *hdr, int l3_len)
 {
 	struct mtp_level_3_cmn *cmn;
-	uint16_t *apc;
+	struct mtp_level_3_prohib *prb;
+	int apc;
 
 	if (hdr->ni != set->ni || l3_len < 1) {
 		LOGP(DINP, LOGL_ERROR, "Unhandled data (ni: %d len: %d)\n",
@@ -346,15 +577,20 @@ static int mtp_link_sign_msg(struct mtp_link_set *set, struct mtp_level_3_hdr *h
 	case MTP_PROHIBIT_MSG_GRP:
 		switch (cmn->h1) {
 		case MTP_PROHIBIT_MSG_SIG:
-			if (l3_len < 3) {
-				LOGP(DINP, LOGL_ERROR, "TFP is too short on %d/%s.\n", set->nr, set->name);
+		case MTP_PROHIBIT_MSG_TFA:
+			if (l3_len < sizeof(*prb)) {
+				LOGP(DINP, LOGL_ERROR, "TFP/TFA is too short on %d/%s.\n", set->nr, set->name);
 				return -1;
 			}
 
-			apc = (uint16_t *) &hdr->data[1];
+			prb = (struct mtp_level_3_prohib *) &hdr->data[0];
+			apc = ntohs(prb->apoc) & MTP_ADDR_MASK;
 			LOGP(DINP, LOGL_INFO,
-			     "TFP for the affected point code %d on %d/%s\n",
-			     *apc, set->nr, set->name);
+			     "%s for the affected point code %d on %d/%s\n",
+			     cmn->h1 == MTP_PROHIBIT_MSG_SIG ? "TFP" : "TFA",
+			     apc, set->nr, set->name);
+			mtp_route_set_status(&set->bsc->routes, apc, set,
+					     cmn->h1 == MTP_PROHIBIT_MSG_SIG);
 			return 0;
 			break;
 		}
@@ -413,14 +649,14 @@ static int mtp_link_regular_msg(struct mtp_link *link, struct mtp_level_3_hdr *h
 	return -1;
 }
 
-static int mtp_link_sccp_data(struct mtp_link_set *set, struct mtp_level_3_hdr *hdr, struct msgb *msg, int l3_len)
+static int mtp_link_sccp_data(struct mtp_link_set *set, int sls, struct msgb *msg, uint8_t *data, int l3_len)
 {
 	struct msgb *out;
 	struct sccp_con_ctrl_prt_mgt *prt;
 	struct sccp_parse_result sccp;
 	int type;
 
-	msg->l2h = &hdr->data[0];
+	msg->l2h = data;
 	if (msgb_l2len(msg) != l3_len) {
 		LOGP(DINP, LOGL_ERROR, "Size is wrong after playing with the l2h header.\n");
 		return -1;
@@ -461,18 +697,16 @@ static int mtp_link_sccp_data(struct mtp_link_set *set, struct mtp_level_3_hdr *
 			type = SCCP_SSA;
 		}
 
-		out = mtp_sccp_alloc_scmg(set, type, prt->assn, prt->apoc,
-					  MTP_LINK_SLS(hdr->addr));
+		out = mtp_sccp_alloc_scmg(set, type, prt->assn, prt->apoc, sls);
 		if (!out)
 			return -1;
 
-		mtp_link_submit(set->slc[MTP_LINK_SLS(hdr->addr)], out);
+		mtp_link_submit(set->slc[sls], out);
 		return 0;
 	}
 
 	rate_ctr_inc(&set->ctrg->ctr[MTP_LSET_SCCP_IN_MSG]);
-	mtp_link_set_forward_sccp(set, msg, MTP_LINK_SLS(hdr->addr));
-	return 0;
+	return mtp_link_set_forward_sccp(set, msg, sls);
 }
 
 int mtp_link_handle_data(struct mtp_link *link, struct msgb *msg)
@@ -497,6 +731,13 @@ int mtp_link_handle_data(struct mtp_link *link, struct msgb *msg)
 	rate_ctr_inc(&link->ctrg->ctr[MTP_LNK_IN]);
 	rate_ctr_inc(&link->set->ctrg->ctr[MTP_LSET_TOTA_IN_MSG]);
 
+	/* user parts for a DPC in the routing table are transferred */
+	if (hdr->ser_ind != MTP_SI_MNT_SNM_MSG && hdr->ser_ind != MTP_SI_MNT_REG_MSG) {
+		rc = mtp_route_transfer(link->set, msg, hdr);
+		if (rc != 0)
+			return rc;
+	}
+
 	switch (hdr->ser_ind) {
 	case MTP_SI_MNT_SNM_MSG:
 		rc = mtp_link_sign_msg(link->set, hdr, l3_len);
@@ -505,7 +746,8 @@ int mtp_link_handle_data(struct mtp_link *link, struct msgb *msg)
 		rc = mtp_link_regular_msg(link, hdr, l3_len);
 		break;
 	case MTP_SI_MNT_SCCP:
-		rc = mtp_link_sccp_data(link->set, hdr, msg, l3_len);
+		rc = mtp_link_sccp_data(link->set, MTP_LINK_SLS(hdr->addr),
+					msg, &hdr->data[0], l3_len);
 		break;
 	case MTP_SI_MNT_ISUP:
 		msg->l3h = &hdr->data[0];
@@ -520,6 +762,64 @@ int mtp_link_handle_data(struct mtp_link *link, struct msgb *msg)
 	return rc;
 }
 
+/*
+ * User part data of a transport that carries the routing label itself
+ * (M3UA). The label is passed in and l3h points to the user data, no
+ * MTP3 header is looked at. Returns like mtp_link_handle_data.
+ */
+int mtp_link_handle_user_data(struct mtp_link *link, struct msgb *msg,
+			      int opc, int dpc, int sls, int si)
+{
+	struct mtp_level_3_hdr *hdr;
+	int rc = -1;
+
+	if (!msg->l3h)
+		return -1;
+
+	if (!link->set->running) {
+		LOGP(DINP, LOGL_ERROR,
+		     "Link %d/%s of %d/%s is not running. Call mtp_link_reset first.\n",
+		     link->nr, link->name, link->set->nr, link->set->name);
+		return -1;
+	}
+
+	sls %= 16;
+
+	/* the routing table transfers MTP3 MSUs, the label goes in front */
+	if (mtp_route_find(&link->set->bsc->routes, dpc)) {
+		if (msg->l3h - msg->data < sizeof(*hdr))
+			return -1;
+
+		hdr = (struct mtp_level_3_hdr *) (msg->l3h - sizeof(*hdr));
+		hdr->ser_ind = si;
+		hdr->ni = link->set->ni;
+		hdr->spare = link->set->spare;
+		hdr->addr = MTP_ADDR(sls, dpc, opc);
+		msg->l2h = (uint8_t *) hdr;
+		return mtp_link_handle_data(link, msg);
+	}
+
+	rate_ctr_inc(&link->ctrg->ctr[MTP_LNK_IN]);
+	rate_ctr_inc(&link->set->ctrg->ctr[MTP_LSET_TOTA_IN_MSG]);
+
+	switch (si) {
+	case MTP_SI_MNT_SCCP:
+		rc = mtp_link_sccp_data(link->set, sls, msg, msg->l3h,
+					msgb_l3len(msg));
+		break;
+	case MTP_SI_MNT_ISUP:
+		rate_ctr_inc(&link->set->ctrg->ctr[MTP_LSET_IUSP_IN_MSG]);
+		rc = mtp_link_set_isup(link->set, msg, sls);
+		break;
+	default:
+		LOGP(DINP, LOGL_ERROR, "Unhandled user part %d on %d/%s.\n",
+		     si, link->set->nr, link->set->name);
+		break;
+	}
+
+	return rc;
+}
+
 int mtp_link_set_submit_sccp_data(struct mtp_link_set *set, int sls, const uint8_t *data, unsigned int length)
 {
 
@@ -549,6 +849,41 @@ int mtp_link_set_submit_isup_data(struct mtp_link_set *set, int sls,
 			sls, MTP_SI_MNT_ISUP, data, length);
 }
 
+/*
+ * Relay a received MSU to this linkset. The payload at data stays where
+ * it is, the routing label in front of it is rewritten and the msgb
+ * is handed to the link. Returns MTP_MSG_CONSUMED when the msgb was
+ * taken, otherwise the caller keeps it.
+ */
+int mtp_link_set_relay_sccp_data(struct mtp_link_set *set, int sls,
+				 struct msgb *msg, uint8_t *data)
+{
+	if (!set->sccp_up) {
+		LOGP(DINP, LOGL_ERROR, "SCCP msg after TRA and before SSA. Dropping it on %d/%s\n",
+		     set->nr, set->name);
+		return -1;
+	}
+
+	if (sls == -1) {
+		sls = set->last_sls;
+		set->last_sls = (set->last_sls + 1) % 16;
+	}
+
+	rate_ctr_inc(&set->ctrg->ctr[MTP_LSET_SCCP_OUT_MSG]);
+	return mtp_int_relay(set, set->sccp_opc,
+			set->sccp_dpc == -1 ? set->dpc : set->sccp_dpc,
+			sls, MTP_SI_MNT_SCCP, msg, data);
+}
+
+int mtp_link_set_relay_isup_data(struct mtp_link_set *set, int sls,
+				 struct msgb *msg, uint8_t *data)
+{
+	rate_ctr_inc(&set->ctrg->ctr[MTP_LSET_ISUP_OUT_MSG]);
+	return mtp_int_relay(set, set->isup_opc,
+			set->isup_dpc == -1 ? set->dpc : set->isup_dpc,
+			sls, MTP_SI_MNT_ISUP, msg, data);
+}
+
 int mtp_link_set_send(struct mtp_link_set *set, struct msgb *msg)
 {
 	int sls;
@@ -572,11 +907,30 @@ static int mtp_int_submit(struct mtp_link_set *set, int opc, int dpc,
 {
 	uint8_t *put_ptr;
 	struct mtp_level_3_hdr *hdr;
+	struct mtp_link *link;
 	struct msgb *msg;
 
-	if (!set->slc[sls % 16])
+	link = set->slc[sls % 16];
+	if (!link)
 		return -1;
 
+	/* the transport has its own routing label */
+	if (link->push_label) {
+		msg = msgb_pool_alloc(4096, 128, "mtp-msg");
+		if (!msg)
+			return -1;
+
+		msg->l3h = msgb_put(msg, length);
+		memcpy(msg->l3h, data, length);
+		if (link->push_label(link, msg, opc, dpc, sls % 16, type) != 0) {
+			msgb_free(msg);
+			return -1;
+		}
+
+		mtp_link_submit(link, msg);
+		return 0;
+	}
+
 	msg = mtp_msg_alloc(set);
 	if (!msg)
 		return -1;
@@ -590,54 +944,155 @@ static int mtp_int_submit(struct mtp_link_set *set, int opc, int dpc,
 	put_ptr = msgb_put(msg, length);
 	memcpy(put_ptr, data, length);
 
-	mtp_link_submit(set->slc[sls % 16], msg);
+	mtp_link_submit(link, msg);
 	return 0;
 }
 
-static struct mtp_link *find_next_link(struct mtp_link_set *set,
-					struct mtp_link *data)
+static int mtp_int_relay(struct mtp_link_set *set, int opc, int dpc,
+			 int sls, int type, struct msgb *msg, uint8_t *data)
 {
-	int found = 0;
-	struct mtp_link *next;
+	struct mtp_level_3_hdr *hdr;
+	struct mtp_link *link;
 
-	if (llist_empty(&set->links))
-		return NULL;
+	link = set->slc[sls % 16];
+	if (!link)
+		return -1;
+
+	/* the transport header would not fit in front, copy it */
+	if (data - msg->data < sizeof(*hdr)
+	    || data - msg->head < sizeof(*hdr) + MTP_RELAY_HEADROOM)
+		return mtp_int_submit(set, opc, dpc, sls, type,
+				      data, msg->tail - data);
+
+	if (link->push_label) {
+		msgb_pull(msg, data - msg->data);
+		msg->l3h = data;
+		if (link->push_label(link, msg, opc, dpc, sls % 16, type) != 0)
+			return -1;
+
+		mtp_link_submit(link, msg);
+		return MTP_MSG_CONSUMED;
+	}
+
+	hdr = (struct mtp_level_3_hdr *) (data - sizeof(*hdr));
+	hdr->ser_ind = type;
+	hdr->ni = set->ni;
+	hdr->spare = set->spare;
+	hdr->addr = MTP_ADDR(sls % 16, dpc, opc);
+
+	msgb_pull(msg, (uint8_t *) hdr - msg->data);
+	msg->l2h = (uint8_t *) hdr;
+	msg->l3h = hdr->data;
+
+	mtp_link_submit(link, msg);
+	return MTP_MSG_CONSUMED;
+}
 
-	if (data == NULL)
-		found = 1;
+/*
+ * Give every available link a share of the 16 SLS that matches its
+ * weight. The remainder goes to the links with the largest fraction.
+ */
+static void calc_sls_quota(struct mtp_link_set *set)
+{
+	struct mtp_link *link, *best;
+	int total = 0, assigned = 0;
 
-	/* try to find the next one */
-	llist_for_each_entry(next, &set->links, entry) {
-		if (found && next->available)
-			return next;
-		if (next == data)
-			found = 1;
+	llist_for_each_entry(link, &set->links, entry) {
+		link->sls_quota = 0;
+		if (link->available)
+			total += link->weight;
 	}
 
-	/* try to find any one */
-	llist_for_each_entry(next, &set->links, entry)
-		if (next->available)
-			return next;
+	if (total == 0)
+		return;
 
-	return NULL;
+	llist_for_each_entry(link, &set->links, entry) {
+		if (!link->available)
+			continue;
+		link->sls_quota = ARRAY_SIZE(set->slc) * link->weight / total;
+		assigned += link->sls_quota;
+	}
+
+	while (assigned < ARRAY_SIZE(set->slc)) {
+		int best_frac = -1;
+
+		best = NULL;
+		llist_for_each_entry(link, &set->links, entry) {
+			int frac;
+
+			if (!link->available)
+				continue;
+
+			/* the part lost by the division, minus what we handed out */
+			frac = ARRAY_SIZE(set->slc) * link->weight
+				- link->sls_quota * total;
+			if (frac > best_frac) {
+				best_frac = frac;
+				best = link;
+			}
+		}
+
+		best->sls_quota += 1;
+		assigned += 1;
+	}
 }
 
+/*
+ * Update the SLS to link mapping. A slot keeps its link as long as
+ * the link is available and within its quota so a link going up or
+ * down only moves the slots that have to move.
+ */
 void mtp_link_set_init_slc(struct mtp_link_set *set)
 {
-	struct mtp_link *link = NULL, *tmp;
-	int i;
+	struct mtp_link *link, *best;
+	int i, moved = 0;
 
-	llist_for_each_entry(tmp, &set->links, entry)
-		tmp->first_sls = 100;
+	calc_sls_quota(set);
 
+	llist_for_each_entry(link, &set->links, entry) {
+		link->nr_sls = 0;
+		link->first_sls = 100;
+	}
 
+	/* release the slots of links that went away or are over quota */
 	for (i = 0; i < ARRAY_SIZE(set->slc); ++i) {
-		link = find_next_link(set, link);
-		set->slc[i] = link;
+		link = set->slc[i];
+		if (!link)
+			continue;
+
+		if (link->nr_sls < link->sls_quota)
+			link->nr_sls += 1;
+		else
+			set->slc[i] = NULL;
+	}
+
+	/* and hand them to the links with the largest deficit */
+	for (i = 0; i < ARRAY_SIZE(set->slc); ++i) {
+		if (!set->slc[i]) {
+			best = NULL;
+			llist_for_each_entry(link, &set->links, entry) {
+				if (link->nr_sls >= link->sls_quota)
+					continue;
+				if (!best || link->sls_quota - link->nr_sls
+						> best->sls_quota - best->nr_sls)
+					best = link;
+			}
 
-		if (link && i < link->first_sls)
-			link->first_sls = i;
+			if (!best)
+				continue;
+
+			set->slc[i] = best;
+			best->nr_sls += 1;
+			moved += 1;
+		}
+
+		if (i < set->slc[i]->first_sls)
+			set->slc[i]->first_sls = i;
 	}
+
+	if (moved)
+		LOGP(DINP, LOGL_DEBUG, "Moved %d SLS on linkset %d/%s.\n",
+		     moved, set->nr, set->name);
 }
 
 struct mtp_link_set *mtp_link_set_alloc(struct bsc_data *bsc)
@@ -659,6 +1114,7 @@ struct mtp_link_set *mtp_link_set_alloc(struct bsc_data *bsc)
 
 	set->ni = MTP_NI_NATION_NET;
 	INIT_LLIST_HEAD(&set->links);
+	INIT_LLIST_HEAD(&set->routes);
 
 	set->nr = bsc->num_linksets++;
 	set->sccp_opc = set->isup_opc = -1;
@@ -674,6 +1130,9 @@ struct mtp_link_set *mtp_link_set_alloc(struct bsc_data *bsc)
 	set->T18.data = set;
 	set->T20.cb = linkset_t20_cb;
 	set->T20.data = set;
+	set->restart.tfx_timer.cb = linkset_tfx_cb;
+	set->restart.tfx_timer.data = set;
+	set->restart.tfx_batch = 32;
 
 	llist_add_tail(&set->entry, &bsc->linksets);
 
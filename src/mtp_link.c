@@ -30,28 +30,18 @@
 
 static struct msgb *mtp_create_sltm(struct mtp_link *link)
 {
-	const uint8_t test_ptrn[14] = { 'G', 'S', 'M', 'M', 'M', 'S', };
 	struct mtp_level_3_hdr *hdr;
 	struct mtp_level_3_mng *mng;
-	struct msgb *msg = mtp_msg_alloc(link->set);
-	uint8_t *data;
+	struct msgb *msg = mtp_tmpl_alloc(link->set, MTP_TMPL_SLTM);
 	if (!msg)
 		return NULL;
 
 	hdr = (struct mtp_level_3_hdr *) msg->l2h;
-	hdr->ser_ind = MTP_SI_MNT_REG_MSG;
 	hdr->addr = MTP_ADDR(link->nr % 16, link->set->dpc, link->set->opc);
 
-	mng = (struct mtp_level_3_mng *) msgb_put(msg, sizeof(*mng));
-	mng->cmn.h0 = MTP_TST_MSG_GRP;
-	mng->cmn.h1 = MTP_TST_MSG_SLTM;
-	mng->length = ARRAY_SIZE(test_ptrn);
-
-	data = msgb_put(msg, ARRAY_SIZE(test_ptrn));
-	memcpy(data, test_ptrn, ARRAY_SIZE(test_ptrn));
-
 	/* remember the last tst ptrn... once we have some */
-	memcpy(link->test_ptrn, test_ptrn, ARRAY_SIZE(test_ptrn));
+	mng = (struct mtp_level_3_mng *) &hdr->data[0];
+	memcpy(link->test_ptrn, mng->data, sizeof(link->test_ptrn));
 
 	return msg;
 }
@@ -198,6 +188,156 @@ void mtp_link_unblock(struct mtp_link *link)
 	link->reset(link);
 }
 
+/* management goes first, ISUP before SCCP */
+int mtp_msg_prio(struct msgb *msg)
+{
+	struct mtp_level_3_hdr *hdr = (struct mtp_level_3_hdr *) msg->l2h;
+	int si;
+
+	if (MTP_MSG_CB(msg)->native)
+		si = MTP_MSG_CB(msg)->si;
+	else
+		si = hdr->ser_ind;
+
+	switch (si) {
+	case MTP_SI_MNT_SNM_MSG:
+	case MTP_SI_MNT_REG_MSG:
+		return MTP_PRIO_3;
+	case MTP_SI_MNT_ISUP:
+		return MTP_PRIO_1;
+	default:
+		return MTP_PRIO_0;
+	}
+}
+
+static void tx_write(struct mtp_link *link, struct msgb *msg)
+{
+	rate_ctr_inc(&link->ctrg->ctr[MTP_LNK_OUT]);
+	rate_ctr_inc(&link->set->ctrg->ctr[MTP_LSET_TOTA_OUT_MSG]);
+	link->write(link, msg);
+}
+
+static void tx_drop(struct mtp_link *link, struct msgb *msg, int prio)
+{
+	rate_ctr_inc(&link->ctrg->ctr[MTP_LNK_DRP]);
+	rate_ctr_inc(&link->ctrg->ctr[MTP_LNK_DRP_PRIO_0 + prio]);
+	rate_ctr_inc(&link->set->ctrg->ctr[MTP_LSET_TOTA_DRP_MSG]);
+	msgb_free(msg);
+}
+
+static int tx_room(struct mtp_link *link)
+{
+	return link->tx_room ? link->tx_room(link) : 1;
+}
+
+/*
+ * Congestion level n starts at n/4 of the queue and ends below
+ * (2n - 1)/8 of it, the gap avoids flapping between the levels.
+ */
+static void tx_update_congestion(struct mtp_link *link)
+{
+	int level = link->congestion;
+
+	while (level < MTP_PRIO_3 && link->tx_depth >= (level + 1) * link->tx_max / 4)
+		level += 1;
+	while (level > 0 && link->tx_depth < (2 * level - 1) * link->tx_max / 8)
+		level -= 1;
+
+	if (level == link->congestion)
+		return;
+
+	if (level > link->congestion)
+		rate_ctr_inc(&link->ctrg->ctr[MTP_LNK_CONGESTION]);
+	LOGP(DINP, LOGL_NOTICE, "Congestion level %d on link %d/%s of %d/%s.\n",
+	     level, link->nr, link->name, link->set->nr, link->set->name);
+	link->congestion = level;
+}
+
+/* drop the newest message below prio to make room */
+static int tx_drop_lower(struct mtp_link *link, int prio)
+{
+	struct msgb *msg;
+	int i;
+
+	for (i = MTP_PRIO_0; i < prio; ++i) {
+		if (llist_empty(&link->tx_queue[i]))
+			continue;
+
+		msg = llist_entry(link->tx_queue[i].prev, struct msgb, list);
+		llist_del(&msg->list);
+		link->tx_depth -= 1;
+		rate_ctr_inc(&link->ctrg->ctr[MTP_LNK_TX_DEQUEUED]);
+		tx_drop(link, msg, i);
+		return 1;
+	}
+
+	return 0;
+}
+
+void mtp_link_tx(struct mtp_link *link, struct msgb *msg)
+{
+	int prio = mtp_msg_prio(msg);
+
+	/* nothing is waiting and the transport has room */
+	if (link->tx_depth == 0 && tx_room(link) > 0) {
+		tx_write(link, msg);
+		return;
+	}
+
+	/* the congestion level discards the lower priorities */
+	if (prio < link->congestion) {
+		tx_drop(link, msg, prio);
+		return;
+	}
+
+	if (link->tx_depth >= link->tx_max && !tx_drop_lower(link, prio)) {
+		tx_drop(link, msg, prio);
+		return;
+	}
+
+	llist_add_tail(&msg->list, &link->tx_queue[prio]);
+	link->tx_depth += 1;
+	rate_ctr_inc(&link->ctrg->ctr[MTP_LNK_TX_QUEUED]);
+	tx_update_congestion(link);
+}
+
+/* to be called by the transport when it has room again */
+void mtp_link_tx_drain(struct mtp_link *link)
+{
+	struct msgb *msg;
+	int prio;
+
+	if (link->tx_depth == 0)
+		return;
+
+	while (link->tx_depth > 0 && tx_room(link) > 0) {
+		for (prio = MTP_PRIO_3; prio > MTP_PRIO_0; --prio)
+			if (!llist_empty(&link->tx_queue[prio]))
+				break;
+
+		msg = msgb_dequeue(&link->tx_queue[prio]);
+		link->tx_depth -= 1;
+		rate_ctr_inc(&link->ctrg->ctr[MTP_LNK_TX_DEQUEUED]);
+		tx_write(link, msg);
+	}
+
+	tx_update_congestion(link);
+}
+
+void mtp_link_tx_clear(struct mtp_link *link)
+{
+	struct msgb *msg;
+	int prio;
+
+	for (prio = MTP_PRIO_0; prio < _NUM_MTP_PRIO; ++prio)
+		while ((msg = msgb_dequeue(&link->tx_queue[prio])))
+			msgb_free(msg);
+
+	rate_ctr_add(&link->ctrg->ctr[MTP_LNK_TX_DEQUEUED], link->tx_depth);
+	link->tx_depth = 0;
+	link->congestion = 0;
+}
+
 static int dummy_arg1(struct mtp_link *link)
 {
 	LOGP(DINP, LOGL_ERROR, "The link %d/%s of linkset %d/%s is not typed.\n",
@@ -216,6 +356,7 @@ static int dummy_arg2(struct mtp_link *link, struct msgb *msg)
 struct mtp_link *mtp_link_alloc(struct mtp_link_set *set)
 {
 	struct mtp_link *link;
+	int i;
 
 	link = talloc_zero(set, struct mtp_link);
 	if (!link) {
@@ -239,6 +380,11 @@ struct mtp_link *mtp_link_alloc(struct mtp_link_set *set)
 	link->clear_queue = dummy_arg1;
 
 	link->pcap_fd = -1;
+	link->weight = 1;
+
+	for (i = 0; i < ARRAY_SIZE(link->tx_queue); ++i)
+		INIT_LLIST_HEAD(&link->tx_queue[i]);
+	link->tx_max = MTP_TX_QUEUE_SIZE;
 
 	link->t1_timer.data = link;
 	link->t1_timer.cb = mtp_sltm_t1_timeout;
@@ -0,0 +1,222 @@
+/* MTP3 routing table */
+/* (C) 2017 by Holger Hans Peter Freyther
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <mtp_route.h>
+#include <mtp_data.h>
+#include <bsc_data.h>
+#include <cellmgr_debug.h>
+#include <counter.h>
+
+#include <osmocom/mtp/mtp_level3.h>
+
+#include <osmocom/core/talloc.h>
+
+#include <limits.h>
+#include <string.h>
+
+static int route_usable(struct mtp_route *route)
+{
+	struct mtp_link_set *set = route->set;
+
+	return !route->prohibited && set->available && set->sccp_up;
+}
+
+static void dest_update(struct mtp_route_dest *dest)
+{
+	struct mtp_route *route;
+	int best = INT_MAX;
+	int was_active = dest->nr_active;
+
+	llist_for_each_entry(route, &dest->routes, entry)
+		if (route_usable(route) && route->priority < best)
+			best = route->priority;
+
+	dest->nr_active = 0;
+	llist_for_each_entry(route, &dest->routes, entry) {
+		if (dest->nr_active == MTP_ROUTE_MAX_ACTIVE)
+			break;
+		if (route_usable(route) && route->priority == best)
+			dest->active[dest->nr_active++] = route->set;
+	}
+
+	if (was_active && !dest->nr_active)
+		LOGP(DINP, LOGL_NOTICE, "DPC %d is not reachable anymore.\n", dest->dpc);
+	else if (!was_active && dest->nr_active)
+		LOGP(DINP, LOGL_NOTICE, "DPC %d is reachable via %d linkset(s).\n",
+		     dest->dpc, dest->nr_active);
+}
+
+static struct mtp_route *dest_find_route(struct mtp_route_dest *dest,
+					 struct mtp_link_set *set)
+{
+	struct mtp_route *route;
+
+	llist_for_each_entry(route, &dest->routes, entry)
+		if (route->set == set)
+			return route;
+	return NULL;
+}
+
+int mtp_route_add(struct mtp_route_table *table, int dpc,
+		  struct mtp_link_set *set, int priority)
+{
+	struct mtp_route_dest *dest;
+	struct mtp_route *route;
+
+	dpc &= MTP_ROUTE_NR_PC - 1;
+	dest = table->dests[dpc];
+	if (!dest) {
+		dest = talloc_zero(set->bsc, struct mtp_route_dest);
+		if (!dest) {
+			LOGP(DINP, LOGL_ERROR, "Failed to allocate DPC %d.\n", dpc);
+			return -1;
+		}
+
+		dest->dpc = dpc;
+		INIT_LLIST_HEAD(&dest->routes);
+		table->dests[dpc] = dest;
+	}
+
+	route = dest_find_route(dest, set);
+	if (!route) {
+		route = talloc_zero(dest, struct mtp_route);
+		if (!route) {
+			LOGP(DINP, LOGL_ERROR, "Failed to allocate route for DPC %d.\n", dpc);
+			return -1;
+		}
+
+		route->dest = dest;
+		route->set = set;
+		llist_add_tail(&route->entry, &dest->routes);
+		llist_add_tail(&route->set_entry, &set->routes);
+	}
+
+	route->priority = priority;
+	dest_update(dest);
+	return 0;
+}
+
+int mtp_route_del(struct mtp_route_table *table, int dpc,
+		  struct mtp_link_set *set)
+{
+	struct mtp_route_dest *dest;
+	struct mtp_route *route;
+
+	dpc &= MTP_ROUTE_NR_PC - 1;
+	dest = table->dests[dpc];
+	if (!dest)
+		return -1;
+
+	route = dest_find_route(dest, set);
+	if (!route)
+		return -1;
+
+	llist_del(&route->entry);
+	llist_del(&route->set_entry);
+	talloc_free(route);
+
+	if (llist_empty(&dest->routes)) {
+		table->dests[dpc] = NULL;
+		talloc_free(dest);
+		return 0;
+	}
+
+	dest_update(dest);
+	return 0;
+}
+
+int mtp_route_set_status(struct mtp_route_table *table, int dpc,
+			 struct mtp_link_set *set, int prohibited)
+{
+	struct mtp_route_dest *dest;
+	struct mtp_route *route;
+
+	dest = mtp_route_find(table, dpc);
+	if (!dest)
+		return -1;
+
+	route = dest_find_route(dest, set);
+	if (!route)
+		return -1;
+
+	if (route->prohibited == prohibited)
+		return 0;
+
+	LOGP(DINP, LOGL_NOTICE, "Route to DPC %d via %d/%s is %s.\n",
+	     dest->dpc, set->nr, set->name, prohibited ? "prohibited" : "allowed");
+	route->prohibited = prohibited;
+	dest_update(dest);
+	return 0;
+}
+
+void mtp_route_update_set(struct mtp_link_set *set)
+{
+	struct mtp_route *route;
+
+	llist_for_each_entry(route, &set->routes, set_entry)
+		dest_update(route->dest);
+}
+
+static int transfer_copy(struct mtp_link *link, struct msgb *msg,
+			 struct mtp_level_3_hdr *hdr)
+{
+	struct msgb *out;
+	unsigned int len = msg->tail - (uint8_t *) hdr;
+
+	out = mtp_msg_alloc(link->set);
+	if (!out)
+		return -1;
+
+	/* replace the default header with the received one */
+	msgb_trim(out, 0);
+	out->l2h = msgb_put(out, len);
+	memcpy(out->l2h, hdr, len);
+
+	mtp_link_submit(link, out);
+	return MTP_MSG_SENT;
+}
+
+int mtp_route_transfer(struct mtp_link_set *set, struct msgb *msg,
+		       struct mtp_level_3_hdr *hdr)
+{
+	struct mtp_link_set *out;
+	struct mtp_link *link;
+	int dpc, sls;
+
+	dpc = MTP_READ_DPC(hdr->addr);
+	if (!mtp_route_find(&set->bsc->routes, dpc))
+		return 0;
+
+	sls = MTP_LINK_SLS(hdr->addr);
+	out = mtp_route_lookup(&set->bsc->routes, dpc, sls);
+	link = out ? out->slc[sls] : NULL;
+	if (!link) {
+		LOGP(DINP, LOGL_DEBUG, "No route to DPC %d from %d/%s.\n",
+		     dpc, set->nr, set->name);
+		rate_ctr_inc(&set->ctrg->ctr[MTP_LSET_TOTA_DRP_MSG]);
+		return -1;
+	}
+
+	/* keep the routing label and send the same msgb out */
+	if ((uint8_t *) hdr - msg->head < MTP_RELAY_HEADROOM)
+		return transfer_copy(link, msg, hdr);
+
+	msgb_pull(msg, (uint8_t *) hdr - msg->data);
+	msg->l2h = (uint8_t *) hdr;
+	mtp_link_submit(link, msg);
+	return MTP_MSG_CONSUMED;
+}
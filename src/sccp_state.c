@@ -29,6 +29,7 @@
 #include <bsc_sccp.h>
 #include <bsc_ussd.h>
 #include <ss7_application.h>
+#include <msgb_pool.h>
 
 #include <osmocom/core/talloc.h>
 
@@ -49,11 +50,13 @@
 static void send_reset_ack(struct mtp_link_set *set, int sls);
 static void handle_local_sccp(struct mtp_link_set *set, struct msgb *inp, struct sccp_parse_result *res, int sls);
 static void send_local_rlsd(struct mtp_link_set *set, struct sccp_parse_result *res);
-static void update_con_state(struct ss7_application *ss7, int rc, struct sccp_parse_result *result, struct msgb *msg, int from_msc, int sls);
+static void send_local_cref(struct mtp_link_set *set, struct msgb *inp, int sls);
+static void release_con_conflict(struct ss7_application *app, struct msc_connection *msc, struct active_sccp_con *con, struct sccp_source_reference *msc_ref);
+static int update_con_state(struct ss7_application *ss7, struct msc_connection *msc, int rc, struct sccp_parse_result *result, struct msgb *msg, int from_msc, int sls);
 
 static void send_direct(struct msc_connection *msc, struct msgb *_msg)
 {
-	struct msgb *msg = msgb_alloc_headroom(4096, 128, "SCCP to MSC");
+	struct msgb *msg = msgb_pool_alloc(4096, 128, "SCCP to MSC");
 	if (!msg) {
 		LOGP(DMSC, LOGL_ERROR, "Failed to alloc MSC msg.\n");
 		return;
@@ -64,12 +67,108 @@ static void send_direct(struct msc_connection *msc, struct msgb *_msg)
 	msc_send_direct(msc, msg);
 }
 
+/*
+ * Pick the MSC for a new connection. Start at the hashed slot and skip
+ * the MSCs that are down. If all of them are down the primary is
+ * returned and the caller will handle the message locally.
+ */
+struct msc_connection *app_select_msc(struct ss7_application *app, uint32_t hash)
+{
+	int i;
+
+	for (i = 0; i < app->nr_mscs; ++i) {
+		struct msc_connection *msc = app->mscs[(hash + i) % app->nr_mscs];
+		if (!msc->msc_link_down)
+			return msc;
+	}
+
+	return app->route_dst.msc;
+}
+
+/* an MSC that keeps its connections during a reconnect counts as up */
+int app_mscs_up(struct ss7_application *app)
+{
+	int i, up = 0;
+
+	for (i = 0; i < app->nr_mscs; ++i)
+		if (!app->mscs[i]->msc_link_down || app->mscs[i]->hold_connections)
+			up += 1;
+	return up;
+}
+
+static int is_reset_ack(struct msgb *msg, struct sccp_parse_result *result)
+{
+	return result->data_len >= 3 && msg->l3h[0] == 0 &&
+		msg->l3h[2] == BSS_MAP_MSG_RESET_ACKNOWLEDGE;
+}
+
+/*
+ * A CR is hashed onto the pool by its source reference, everything
+ * else follows the connection to the MSC that got the CR.
+ */
+static struct msc_connection *msc_for_msg(struct ss7_application *app,
+					  int rc, struct sccp_parse_result *result,
+					  struct msgb *msg)
+{
+	struct sccp_connection_request *cr;
+	struct active_sccp_con *con = NULL;
+
+	if (rc < 0 || app->nr_mscs <= 1)
+		return app->route_dst.msc;
+
+	if (msg->l2h[0] == SCCP_MSG_TYPE_CR) {
+		cr = (struct sccp_connection_request *) msg->l2h;
+		return app_select_msc(app,
+				sccp_src_ref_to_int(&cr->source_local_reference));
+	}
+
+	if (result->source_local_reference)
+		con = find_con_by_src_ref(app, result->source_local_reference);
+	if (!con && result->destination_local_reference)
+		con = find_con_by_dest_ref(app, result->destination_local_reference);
+	if (con && con->msc)
+		return con->msc;
+
+	return app_select_msc(app, 0);
+}
+
+/*
+ * Most of the traffic is DT1 that is not patched. It is sent to the
+ * MSC in the received msgb, the IPA header goes where the MTP header
+ * was. Returns 1 if the msgb was taken.
+ */
+static int forward_dt1_fast(struct ss7_application *app, struct msgb *msg)
+{
+	struct sccp_data_form1 *form1;
+	struct active_sccp_con *con;
+	struct msc_connection *msc;
+
+	if (!bss_dt1_passthrough(msg))
+		return 0;
+
+	form1 = (struct sccp_data_form1 *) msg->l2h;
+	con = find_con_by_dest_ref(app, &form1->destination_local_reference);
+	if (!con)
+		return 0;
+
+	msc = con->msc ? con->msc : app->route_dst.msc;
+	if (!msc || msc->msc_link_down)
+		return 0;
+
+	if (msg->l2h - msg->head < sizeof(struct ipaccess_head))
+		return 0;
+
+	msgb_pull(msg, msg->l2h - msg->data);
+	msc_send_direct(msc, msg);
+	return 1;
+}
+
 /*
  * methods called from the MTP Level3 part
  */
-void app_forward_sccp(struct ss7_application *app, struct msgb *_msg, int sls)
+int app_forward_sccp(struct ss7_application *app, struct msgb *_msg, int sls)
 {
-	int rc;
+	int rc, i;
 	struct sccp_parse_result result;
 	struct msc_connection *msc;
 	struct mtp_link_set *set;
@@ -77,59 +176,84 @@ void app_forward_sccp(struct ss7_application *app, struct msgb *_msg, int sls)
 	struct msgb *msg;
 
 	set = app->route_src.set;
-	msc = app->route_dst.msc;
 
 	if (app->forward_only) {
-		send_direct(msc, _msg);
-		return;
+		send_direct(app_select_msc(app, sls), _msg);
+		return 0;
 	}
 
+	if (forward_dt1_fast(app, _msg))
+		return MTP_MSG_CONSUMED;
+
 	rc = bss_patch_filter_msg(app, _msg, &result, BSS_DIR_MSC);
 	if (rc == BSS_FILTER_RESET) {
 		LOGP(DMSC, LOGL_NOTICE, "Filtering BSS Reset from the BSC\n");
-		msc_mgcp_reset(msc);
+		for (i = 0; i < app->nr_mscs; ++i)
+			msc_mgcp_reset(app->mscs[i]);
 		send_reset_ack(set, sls);
-		return;
+		return 0;
+	}
+
+	msc = msc_for_msg(app, rc, &result, _msg);
+
+	/* the connections wait for the reconnect, new ones are refused */
+	if (msc->msc_link_down && msc->hold_connections &&
+	    _msg->l2h[0] == SCCP_MSG_TYPE_CR) {
+		LOGP(DINP, LOGL_NOTICE, "Refusing a CR while MSC %d/%s reconnects.\n",
+		     msc->nr, msc->name);
+		send_local_cref(set, _msg, sls);
+		return 0;
 	}
 
 	/* special responder */
-	if (msc->msc_link_down) {
+	if (msc->msc_link_down && !msc->hold_connections) {
 		if (rc == BSS_FILTER_RESET_ACK && app->reset_count > 0) {
 			LOGP(DMSC, LOGL_ERROR, "Received reset ack for closing.\n");
 			app_clear_connections(app);
 			app_resources_released(app);
-			return;
+			return 0;
 		}
 
 		if (rc != 0 && rc != BSS_FILTER_RLSD && rc != BSS_FILTER_RLC) {
 			LOGP(DMSC, LOGL_ERROR, "Ignoring unparsable msg during closedown.\n");
-			return;
+			return 0;
 		}
 
-		return handle_local_sccp(set, _msg, &result, sls);
+		/* connectionless data can wait for the MSC to come back */
+		if (msc->replay_max_bytes > 0 && rc == 0 &&
+		    _msg->l2h[0] == SCCP_MSG_TYPE_UDT && !is_reset_ack(_msg, &result))
+			goto send;
+
+		handle_local_sccp(set, _msg, &result, sls);
+		return 0;
 	}
 
-	/* update the connection state */
-	update_con_state(app, rc, &result, _msg, 0, sls);
+	/* update the connection state, refuse it if we can not track it */
+	if (update_con_state(app, msc, rc, &result, _msg, 0, sls) != 0) {
+		send_local_cref(set, _msg, sls);
+		return 0;
+	}
 
 	if (rc == BSS_FILTER_CLEAR_COMPL) {
 		send_local_rlsd(set, &result);
 	} else if (rc == BSS_FILTER_RLC || rc == BSS_FILTER_RLSD) {
 		LOGP(DMSC, LOGL_DEBUG, "Not forwarding RLC/RLSD to the MSC.\n");
-		return;
+		return 0;
 	}
 
+send:
 	/* now send it out */
 	bsc_ussd_handle_out_msg(msc, &result, _msg);
 
-	msg = msgb_alloc_headroom(4096, 128, "SCCP to MSC");
+	msg = msgb_pool_alloc(4096, 128, "SCCP to MSC");
 	if (!msg) {
 		LOGP(DMSC, LOGL_ERROR, "Failed to alloc MSC msg.\n");
-		return;
+		return 0;
 	}
 
 	bss_rewrite_header_for_msc(rc, msg, _msg, &result);
 	msc_send_direct(msc, msg);
+	return 0;
 }
 
 /*
@@ -139,16 +263,8 @@ static void handle_local_sccp(struct mtp_link_set *set, struct msgb *inpt, struc
 {
 	/* Handle msg with a reject */
 	if (inpt->l2h[0] == SCCP_MSG_TYPE_CR) {
-		struct sccp_connection_request *cr;
-		struct msgb *msg;
-
 		LOGP(DINP, LOGL_NOTICE, "Handling CR localy.\n");
-		cr = (struct sccp_connection_request *) inpt->l2h;
-		msg = create_sccp_refuse(&cr->source_local_reference);
-		if (msg) {
-			mtp_link_set_submit_sccp_data(set, sls, msg->l2h, msgb_l2len(msg));
-			msgb_free(msg);
-		}
+		send_local_cref(set, inpt, sls);
 		return;
 	} else if (inpt->l2h[0] == SCCP_MSG_TYPE_DT1 && result->data_len >= 3) {
 		struct active_sccp_con *con;
@@ -160,23 +276,21 @@ static void handle_local_sccp(struct mtp_link_set *set, struct msgb *inpt, struc
 
 			form1 = (struct sccp_data_form1 *) inpt->l2h;
 
-			llist_for_each_entry(con, &set->app->sccp_connections, entry) {
-				if (memcmp(&form1->destination_local_reference,
-					   &con->dst_ref, sizeof(con->dst_ref)) == 0) {
-					LOGP(DINP, LOGL_DEBUG, "Sending a release request now.\n");
-					msg = create_sccp_rlsd(&con->dst_ref, &con->src_ref);
-					if (msg) {
-						mtp_link_set_submit_sccp_data(set, con->sls, msg->l2h, msgb_l2len(msg));
-						msgb_free(msg);
-					}
-					return;
+			con = find_con_by_dest_ref(set->app, &form1->destination_local_reference);
+			if (con) {
+				LOGP(DINP, LOGL_DEBUG, "Sending a release request now.\n");
+				msg = create_sccp_rlsd(&con->dst_ref, &con->src_ref);
+				if (msg) {
+					mtp_link_set_submit_sccp_data(set, con->sls, msg->l2h, msgb_l2len(msg));
+					msgb_free(msg);
 				}
+				return;
 			}
 
 			LOGP(DINP, LOGL_ERROR, "Could not find connection for the Clear Command.\n");
 		}
-	} else if (inpt->l2h[0] == SCCP_MSG_TYPE_UDT && result->data_len >= 3) {
-		if (inpt->l3h[0] == 0 && inpt->l3h[2] == BSS_MAP_MSG_RESET_ACKNOWLEDGE) {
+	} else if (inpt->l2h[0] == SCCP_MSG_TYPE_UDT) {
+		if (is_reset_ack(inpt, result)) {
 			LOGP(DINP, LOGL_NOTICE, "Reset ACK. Connecting to the MSC again.\n");
 			app_resources_released(set->app);
 			return;
@@ -185,7 +299,7 @@ static void handle_local_sccp(struct mtp_link_set *set, struct msgb *inpt, struc
 
 
 	/* Update the state, maybe the connection was released? */
-	update_con_state(set->app, 0, result, inpt, 0, sls);
+	update_con_state(set->app, NULL, 0, result, inpt, 0, sls);
 	if (llist_empty(&set->app->sccp_connections))
 		app_resources_released(set->app);
 	return;
@@ -247,6 +361,8 @@ static void bsc_reset_timeout(void *_app)
  *
  * To make things worse we need to buffer the BSC messages... atfer
  * everything has been sent we will try to connect to the MSC again.
+ * With a replay buffer this is only called once the MSC did not come
+ * back within its maximum age, until then the connections are kept.
  *
  * We will have to veriy that all connections are closed properly..
  * this means we need to parse response message. In the case the
@@ -263,6 +379,7 @@ void release_bsc_resources(struct msc_connection *fw)
 	struct mtp_link_set *set;
 	struct active_sccp_con *tmp;
 	struct active_sccp_con *con;
+	int pending = 0;
 
 	if (!fw->app) {
 		LOGP(DINP, LOGL_ERROR, "No app assigned to the MSC connection %d/%s\n",
@@ -272,18 +389,21 @@ void release_bsc_resources(struct msc_connection *fw)
 
 	app = fw->app;
 	set = app->route_src.set;
-	osmo_timer_del(&app->reset_timeout);
 
 	/* 2. clear the MGCP endpoints */
 	msc_mgcp_reset(fw);
 
-	/* 1. send BSSMAP Cleanup.. if we have any connection */
+	/* 1. send BSSMAP Cleanup.. for the connections of this MSC */
 	llist_for_each_entry_safe(con, tmp, &app->sccp_connections, entry) {
+		if (con->msc && con->msc != fw)
+			continue;
+
 		if (!con->has_dst_ref) {
 			free_con(con);
 			continue;
 		}
 
+		pending += 1;
 		struct msgb *msg = create_clear_command(&con->src_ref);
 		if (!msg)
 			continue;
@@ -293,6 +413,17 @@ void release_bsc_resources(struct msc_connection *fw)
 		msgb_free(msg);
 	}
 
+	/*
+	 * The reset of the BSC would take down the connections of the
+	 * other MSCs as well. Only arm it once the whole pool is gone.
+	 */
+	if (app_mscs_up(app) > 0) {
+		LOGP(DMSC, LOGL_NOTICE, "Clearing %d connections of MSC %d/%s.\n",
+		     pending, fw->nr, fw->name);
+		return;
+	}
+
+	osmo_timer_del(&app->reset_timeout);
 	if (llist_empty(&app->sccp_connections)) {
 		app_resources_released(app);
 	} else {
@@ -321,10 +452,10 @@ static void send_rlc_to_bsc(struct mtp_link_set *set,
 	msgb_free(msg);
 }
 
-static void handle_rlsd(struct ss7_application *app, struct sccp_connection_released *rlsd, int from_msc)
+static void handle_rlsd(struct ss7_application *app, struct msc_connection *msc,
+			struct sccp_connection_released *rlsd, int from_msc)
 {
 	struct active_sccp_con *con;
-	struct msc_connection *msc = app->route_dst.msc;
 	struct mtp_link_set *set = app->route_src.set;
 
 	if (from_msc) {
@@ -353,7 +484,8 @@ static void handle_rlsd(struct ss7_application *app, struct sccp_connection_rele
 			     sccp_src_ref_to_int(&rlsd->source_local_reference));
 
 			if (con->released_from_msc)
-				msc_send_rlc(msc, &con->src_ref, &con->dst_ref);
+				msc_send_rlc(con->msc ? con->msc : msc,
+					     &con->src_ref, &con->dst_ref);
 			sls = con->sls;
 			free_con(con);
 		} else {
@@ -379,28 +511,35 @@ static void handle_rlsd(struct ss7_application *app, struct sccp_connection_rele
  * RLC from BSC:
  *      1.) We are destroying the connection, we might send a RLC to
  *          the MSC if we are waiting for one.
+ * CR from BSC:
+ *      1.) Returns -1 when the connection pool is exhausted. The CR
+ *          must not be forwarded then.
+ * CC from MSC:
+ *      1.) Returns -1 when it does not come from the MSC of the CR or
+ *          the reference is used by another MSC of the pool. The CC
+ *          must not be forwarded then.
  */
-void update_con_state(struct ss7_application *app, int rc, struct sccp_parse_result *res, struct msgb *msg, int from_msc, int sls)
+int update_con_state(struct ss7_application *app, struct msc_connection *msc, int rc, struct sccp_parse_result *res, struct msgb *msg, int from_msc, int sls)
 {
-	struct active_sccp_con *con;
+	struct active_sccp_con *con, *other;
 	struct sccp_connection_request *cr;
 	struct sccp_connection_confirm *cc;
 	struct sccp_connection_release_complete *rlc;
 	struct sccp_connection_refused *cref;
-	struct msc_connection *msc;
 
 	/* was the header okay? */
 	if (rc < 0)
-		return;
+		return 0;
 
-	msc = app->route_dst.msc;
+	if (!msc)
+		msc = app->route_dst.msc;
 
 	/* the header was size checked */
 	switch (msg->l2h[0]) {
 	case SCCP_MSG_TYPE_CR:
 		if (from_msc) {
 			LOGP(DMSC, LOGL_ERROR, "CR from MSC is not handled.\n");
-			return;
+			return 0;
 		}
 
 		cr = (struct sccp_connection_request *) msg->l2h;
@@ -411,32 +550,48 @@ void update_con_state(struct ss7_application *app, int rc, struct sccp_parse_res
 			free_con(con);
 		}
 
-		con = talloc_zero(NULL, struct active_sccp_con);
+		con = alloc_con(app);
 		if (!con) {
-			LOGP(DINP, LOGL_ERROR, "Failed to allocate\n");
-			return;
+			LOGP(DINP, LOGL_ERROR, "No free connection on app %d for: 0x%x\n",
+			     app->nr, sccp_src_ref_to_int(&cr->source_local_reference));
+			return -1;
 		}
 
 		con->src_ref = cr->source_local_reference;
 		con->sls = sls;
-		con->app = app;
-		llist_add_tail(&con->entry, &app->sccp_connections);
+		con->msc = msc;
+		add_con(app, con);
 		LOGP(DINP, LOGL_DEBUG, "Adding CR: local ref: 0x%x\n", sccp_src_ref_to_int(&con->src_ref));
 		break;
 	case SCCP_MSG_TYPE_CC:
 		if (!from_msc) {
 			LOGP(DINP, LOGL_ERROR, "CC from BSC is not handled.\n");
-			return;
+			return 0;
 		}
 
 		cc = (struct sccp_connection_confirm *) msg->l2h;
 		con = find_con_by_src_ref(app, &cc->destination_local_reference);
+		if (con && con->msc && con->msc != msc) {
+			LOGP(DINP, LOGL_ERROR, "CC for 0x%x from MSC %d but the CR went to MSC %d\n",
+			     sccp_src_ref_to_int(&con->src_ref), msc->nr, con->msc->nr);
+			return -1;
+		}
+
 		if (con) {
-			con->dst_ref = cc->source_local_reference;
-			con->has_dst_ref = 1;
+			/* the dest hash is shared by all MSCs of the pool */
+			other = find_con_by_dest_ref(app, &cc->source_local_reference);
+			if (other && other != con) {
+				LOGP(DINP, LOGL_ERROR, "MSC %d reused the reference 0x%x of MSC %d\n",
+				     msc->nr, sccp_src_ref_to_int(&cc->source_local_reference),
+				     other->msc ? other->msc->nr : -1);
+				release_con_conflict(app, msc, con, &cc->source_local_reference);
+				return -1;
+			}
+
+			con_set_dst_ref(con, &cc->source_local_reference);
 			LOGP(DINP, LOGL_DEBUG, "Updating CC: local: 0x%x remote: 0x%x\n",
 				sccp_src_ref_to_int(&con->src_ref), sccp_src_ref_to_int(&con->dst_ref));
-			return;
+			return 0;
 		}
 
 		LOGP(DINP, LOGL_ERROR, "CCed connection can not be found: 0x%x\n",
@@ -445,7 +600,7 @@ void update_con_state(struct ss7_application *app, int rc, struct sccp_parse_res
 	case SCCP_MSG_TYPE_CREF:
 		if (!from_msc) {
 			LOGP(DINP, LOGL_ERROR, "CREF from BSC is not handled.\n");
-			return;
+			return 0;
 		}
 
 		cref = (struct sccp_connection_refused *) msg->l2h;
@@ -453,18 +608,18 @@ void update_con_state(struct ss7_application *app, int rc, struct sccp_parse_res
 		if (con) {
 			LOGP(DINP, LOGL_DEBUG, "Releasing local: 0x%x\n", sccp_src_ref_to_int(&con->src_ref));
 			free_con(con);
-			return;
+			return 0;
 		}
 
 		LOGP(DINP, LOGL_ERROR, "CREF from BSC is not handled.\n");
 		break;
 	case SCCP_MSG_TYPE_RLSD:
-		handle_rlsd(app, (struct sccp_connection_released *) msg->l2h, from_msc);
+		handle_rlsd(app, msc, (struct sccp_connection_released *) msg->l2h, from_msc);
 		break;
 	case SCCP_MSG_TYPE_RLC:
 		if (from_msc) {
 			LOGP(DINP, LOGL_ERROR, "RLC from MSC is wrong.\n");
-			return;
+			return 0;
 		}
 
 		rlc = (struct sccp_connection_release_complete *) msg->l2h;
@@ -473,9 +628,10 @@ void update_con_state(struct ss7_application *app, int rc, struct sccp_parse_res
 		if (con) {
 			LOGP(DINP, LOGL_DEBUG, "Releasing local: 0x%x\n", sccp_src_ref_to_int(&con->src_ref));
 			if (con->released_from_msc)
-				msc_send_rlc(msc, &con->src_ref, &con->dst_ref);
+				msc_send_rlc(con->msc ? con->msc : msc,
+					     &con->src_ref, &con->dst_ref);
 			free_con(con);
-			return;
+			return 0;
 		}
 
 		LOGP(DINP, LOGL_ERROR, "RLC can not be found. 0x%x 0x%x\n",
@@ -483,6 +639,32 @@ void update_con_state(struct ss7_application *app, int rc, struct sccp_parse_res
 		     sccp_src_ref_to_int(&rlc->destination_local_reference));
 		break;
 	}
+
+	return 0;
+}
+
+/*
+ * Two MSCs of the pool picked the same reference. Release the new
+ * connection on the MSC and refuse it towards the BSC.
+ */
+static void release_con_conflict(struct ss7_application *app, struct msc_connection *msc,
+				 struct active_sccp_con *con,
+				 struct sccp_source_reference *msc_ref)
+{
+	struct msgb *msg;
+
+	msg = create_sccp_rlsd(&con->src_ref, msc_ref);
+	if (msg)
+		msc_send_direct(msc, msg);
+
+	msg = create_sccp_refuse(&con->src_ref);
+	if (msg) {
+		mtp_link_set_submit_sccp_data(app->route_src.set, con->sls,
+					      msg->l2h, msgb_l2len(msg));
+		msgb_free(msg);
+	}
+
+	free_con(con);
 }
 
 static void send_local_rlsd_for_con(void *data)
@@ -522,12 +704,27 @@ static void send_local_rlsd(struct mtp_link_set *set, struct sccp_parse_result *
 	LOGP(DINP, LOGL_DEBUG, "Received GSM Clear Complete. Sending RLSD locally.\n");
 
 	con = find_con_by_dest_ref(set->app, res->destination_local_reference);
-	if (!con)
+	if (!con) {
+		LOGP(DINP, LOGL_ERROR, "Could not find connection for the Clear Complete.\n");
 		return;
+	}
 	con->rls_tries = 0;
 	send_local_rlsd_for_con(con);
 }
 
+static void send_local_cref(struct mtp_link_set *set, struct msgb *inpt, int sls)
+{
+	struct sccp_connection_request *cr;
+	struct msgb *msg;
+
+	cr = (struct sccp_connection_request *) inpt->l2h;
+	msg = create_sccp_refuse(&cr->source_local_reference);
+	if (msg) {
+		mtp_link_set_submit_sccp_data(set, sls, msg->l2h, msgb_l2len(msg));
+		msgb_free(msg);
+	}
+}
+
 static void send_reset_ack(struct mtp_link_set *set, int sls)
 {
 	static const uint8_t reset_ack[] = {
@@ -568,7 +765,7 @@ void msc_dispatch_sccp(struct msc_connection *msc, struct msgb *msg)
 			LOGP(DMSC, LOGL_NOTICE, "Filtering reset ack from the MSC\n");
 		} else if (rc == BSS_FILTER_RLSD) {
 			LOGP(DMSC, LOGL_DEBUG, "Filtering RLSD from the MSC\n");
-			update_con_state(msc->app, rc, &result, msg, 1, 0);
+			update_con_state(msc->app, msc, rc, &result, msg, 1, 0);
 		} else if (rc == BSS_FILTER_RLC) {
 			/* if we receive this we have forwarded a RLSD to the network */
 			LOGP(DMSC, LOGL_ERROR, "RLC from the network. BAD!\n");
@@ -577,7 +774,8 @@ void msc_dispatch_sccp(struct msc_connection *msc, struct msgb *msg)
 		} else if (set->sccp_up) {
 			unsigned int sls;
 
-			update_con_state(msc->app, rc, &result, msg, 1, 0);
+			if (update_con_state(msc->app, msc, rc, &result, msg, 1, 0) != 0)
+				return;
 			sls = sls_for_src_ref(msc->app, result.destination_local_reference);
 
 			/* Check for Location Update Accept */
@@ -19,12 +19,16 @@
 #include <bsc_data.h>
 #include <cellmgr_debug.h>
 #include <counter.h>
+#include <msgb_pool.h>
 #include <mtp_data.h>
 #include <mtp_pcap.h>
+#include <sctp_streams.h>
+#include <xua_data.h>
 
 #include <osmocom/core/talloc.h>
 
 #include <osmocom/sigtran/m2ua_types.h>
+#include <osmocom/mtp/mtp_level3.h>
 
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -35,6 +39,11 @@
 
 #define SCTP_PPID_M2UA 2
 
+/* sndrcvinfo, common header, interface identifier and the DATA tag */
+#define M2UA_DATA_HEADROOM \
+	(sizeof(struct sctp_sndrcvinfo) + sizeof(struct xua_common_hdr) \
+	 + sizeof(struct xua_parameter_hdr) * 2 + 4)
+
 
 int sctp_m2ua_conn_count(struct sctp_m2ua_transport *trans)
 {
@@ -49,14 +58,18 @@ int sctp_m2ua_conn_count(struct sctp_m2ua_transport *trans)
 
 static struct mtp_m2ua_link *find_m2ua_link(struct sctp_m2ua_transport *trans, int link_index)
 {
-	struct mtp_m2ua_link *link;
+	struct link_index_entry *entry;
 
-	llist_for_each_entry(link, &trans->links, entry) {
-		if (link->link_index == link_index)
-			return link;
-	}
+	entry = link_index_find(&trans->link_table, link_index);
+	if (!entry)
+		return NULL;
+	return container_of(entry, struct mtp_m2ua_link, index_entry);
+}
 
-	return NULL;
+void mtp_m2ua_link_set_index(struct mtp_m2ua_link *link, int link_index)
+{
+	link->link_index = link_index;
+	link_index_set(&link->transport->link_table, &link->index_entry, link_index);
 }
 
 static void link_down(struct mtp_link *link)
@@ -65,27 +78,151 @@ static void link_down(struct mtp_link *link)
 	mtp_link_down(link);
 }
 
+static int link_conn_index(struct mtp_m2ua_link *link,
+			   struct sctp_m2ua_conn *conn)
+{
+	int i;
+
+	for (i = 0; i < link->nr_conns; ++i)
+		if (link->conns[i] == conn)
+			return i;
+	return -1;
+}
+
+static int link_add_conn(struct mtp_m2ua_link *link,
+			 struct sctp_m2ua_conn *conn, int mode)
+{
+	if (link_conn_index(link, conn) >= 0)
+		return 0;
+
+	/* override mode takes the link away from the other ASPs */
+	if (mode != M2UA_TRAFFIC_LOADSHARE) {
+		link->nr_conns = 0;
+	} else if (link->nr_conns == M2UA_MAX_ASPS) {
+		LOGP(DINP, LOGL_ERROR,
+		     "Too many ASPs on M2UA link-index %d.\n", link->link_index);
+		return -1;
+	}
+
+	link->conns[link->nr_conns++] = conn;
+	link->asp_active = 1;
+	return 0;
+}
+
+static void link_remove_conn(struct mtp_m2ua_link *link,
+			     struct sctp_m2ua_conn *conn)
+{
+	int i = link_conn_index(link, conn);
+
+	if (i < 0)
+		return;
+
+	link->nr_conns -= 1;
+	memmove(&link->conns[i], &link->conns[i + 1],
+		(link->nr_conns - i) * sizeof(link->conns[0]));
+	link->asp_active = link->nr_conns > 0;
+}
+
+static struct sctp_m2ua_conn *link_conn_for_sls(struct mtp_m2ua_link *link, int sls)
+{
+	return link->conns[sls % link->nr_conns];
+}
+
+/*
+ * The ASP is no longer serving the link. Only take the link down
+ * when no other ASP is left for it.
+ */
+static void link_drop_conn(struct mtp_m2ua_link *link,
+			   struct sctp_m2ua_conn *conn)
+{
+	link_remove_conn(link, conn);
+	if (link->nr_conns > 0) {
+		LOGP(DINP, LOGL_NOTICE,
+		     "M2UA link-index %d continues on %d ASP(s).\n",
+		     link->link_index, link->nr_conns);
+		return;
+	}
+
+	if (link->established)
+		link_down(link->base);
+	link->established = 0;
+	link->active = 0;
+}
+
+/*
+ * Move the queued DATA of links the ASP no longer serves to the
+ * remaining ASPs of these links. The SLS picks the new ASP and the
+ * stream like in the write path.
+ */
+static void m2ua_conn_failover(struct sctp_m2ua_conn *conn)
+{
+	struct mtp_m2ua_link *link;
+	struct sctp_m2ua_conn *other;
+	struct sctp_sndrcvinfo *info;
+	struct xua_common_hdr *hdr;
+	struct mtp_level_3_hdr *mtp;
+	struct msgb *msg, *tmp;
+	uint32_t interface;
+	uint16_t len;
+	uint8_t *data;
+	int sls, moved = 0;
+
+	llist_for_each_entry_safe(msg, tmp, &conn->queue.msg_queue, list) {
+		hdr = (struct xua_common_hdr *) msg->l2h;
+		if (hdr->msg_class != M2UA_CLS_MAUP
+		    || hdr->msg_type != M2UA_MAUP_DATA)
+			continue;
+
+		data = xua_data_find_tag(hdr, MUA_TAG_IDENT_INT, &len);
+		if (!data || len != 4)
+			continue;
+
+		memcpy(&interface, data, 4);
+		link = find_m2ua_link(conn->trans, ntohl(interface));
+		if (!link || link->nr_conns == 0 || link_conn_index(link, conn) >= 0)
+			continue;
+
+		mtp = (struct mtp_level_3_hdr *)
+				xua_data_find_tag(hdr, M2UA_TAG_DATA, &len);
+		if (!mtp || len < sizeof(*mtp))
+			continue;
+
+		llist_del(&msg->list);
+		conn->queue.current_length -= 1;
+
+		sls = MTP_LINK_SLS(mtp->addr);
+		other = link_conn_for_sls(link, sls);
+		info = (struct sctp_sndrcvinfo *) msg->data;
+		info->sinfo_stream = sctp_sls_to_stream(other->nr_streams, sls);
+		if (sctp_queue_enqueue(&other->queue, &other->queue_stats, msg) != 0) {
+			rate_ctr_inc(&link->base->ctrg->ctr[MTP_LNK_DRP]);
+			rate_ctr_inc(&link->base->set->ctrg->ctr[MTP_LSET_TOTA_DRP_MSG]);
+			msgb_free(msg);
+			continue;
+		}
+		moved += 1;
+	}
+
+	if (moved)
+		LOGP(DINP, LOGL_NOTICE,
+		     "Moved %d message(s) to the remaining ASPs.\n", moved);
+}
+
 static void m2ua_conn_destroy(struct sctp_m2ua_conn *conn)
 {
 	struct mtp_m2ua_link *link;
 
 	close(conn->queue.bfd.fd);
 	osmo_fd_unregister(&conn->queue.bfd);
-	osmo_wqueue_clear(&conn->queue);
 	llist_del(&conn->entry);
 
-	llist_for_each_entry(link, &conn->trans->links, entry) {
-		if (link->conn != conn)
-			continue;
-
-		if (link->established)
-			link_down(link->base);
-		link->established = 0;
-		link->asp_active = 0;
-		link->active = 0;
-		link->conn = NULL;
-	}
+	llist_for_each_entry(link, &conn->trans->links, entry)
+		if (link_conn_index(link, conn) >= 0)
+			link_drop_conn(link, conn);
 
+	m2ua_conn_failover(conn);
+	sctp_queue_stop(&conn->queue, &conn->queue_stats);
+	osmo_wqueue_clear(&conn->queue);
 	talloc_free(conn);
 
 	#warning "Notify any other AS(P) for failover scenario"
@@ -105,7 +242,7 @@ static int m2ua_conn_send(struct sctp_m2ua_conn *conn,
 	msgb_push(msg, sizeof(*info));
 	memcpy(msg->data, info, sizeof(*info));
 
-	if (osmo_wqueue_enqueue(&conn->queue, msg) != 0) {
+	if (sctp_queue_enqueue(&conn->queue, &conn->queue_stats, msg) != 0) {
 		LOGP(DINP, LOGL_ERROR, "Failed to enqueue.\n");
 		msgb_free(msg);
 		return -1;
@@ -114,6 +251,55 @@ static int m2ua_conn_send(struct sctp_m2ua_conn *conn,
 	return 0;
 }
 
+/*
+ * Put the M2UA header of a DATA message into the headroom of the MSU
+ * and queue it as it is. Returns -1 if the header does not fit and the
+ * msgb still belongs to the caller, otherwise it was consumed.
+ */
+static int m2ua_conn_send_data(struct sctp_m2ua_conn *conn,
+			       uint32_t interface, struct msgb *msg,
+			       struct sctp_sndrcvinfo *info)
+{
+	struct xua_common_hdr *hdr;
+	struct xua_parameter_hdr *part;
+	unsigned int data_len = msg->len;
+	unsigned int pad = (4 - (data_len % 4)) % 4;
+
+	if (msgb_headroom(msg) < M2UA_DATA_HEADROOM || msgb_tailroom(msg) < pad)
+		return -1;
+
+	/* the TLVs are padded to four bytes, the length is not */
+	memset(msgb_put(msg, pad), 0, pad);
+
+	part = (struct xua_parameter_hdr *) msgb_push(msg, sizeof(*part));
+	part->tag = htons(M2UA_TAG_DATA);
+	part->len = htons(sizeof(*part) + data_len);
+
+	part = (struct xua_parameter_hdr *) msgb_push(msg, sizeof(*part) + 4);
+	part->tag = htons(MUA_TAG_IDENT_INT);
+	part->len = htons(sizeof(*part) + 4);
+	memcpy(part->data, &interface, 4);
+
+	hdr = (struct xua_common_hdr *) msgb_push(msg, sizeof(*hdr));
+	hdr->version = M2UA_VERSION;
+	hdr->spare = 0;
+	hdr->msg_class = M2UA_CLS_MAUP;
+	hdr->msg_type = M2UA_MAUP_DATA;
+	hdr->msg_length = htonl(msg->len);
+
+	/* save the OOB data in front of the message */
+	msg->l2h = msg->data;
+	msgb_push(msg, sizeof(*info));
+	memcpy(msg->data, info, sizeof(*info));
+
+	if (sctp_queue_enqueue(&conn->queue, &conn->queue_stats, msg) != 0) {
+		LOGP(DINP, LOGL_ERROR, "Failed to enqueue.\n");
+		msgb_free(msg);
+	}
+
+	return 0;
+}
+
 static int m2ua_conn_send_ntfy(struct mtp_m2ua_link *link,
 			       struct sctp_m2ua_conn *conn,
 			       struct sctp_sndrcvinfo *info)
@@ -224,6 +410,13 @@ static int m2ua_handle_asptm_act(struct sctp_m2ua_conn *conn,
 {
 	struct xua_msg_part *part;
 	struct xua_msg *ack;
+	uint32_t mode = M2UA_TRAFFIC_OVERRIDE;
+
+	part = xua_msg_find_tag(m2ua, MUA_TAG_TRAFFIC_MODE);
+	if (part && part->len == 4) {
+		memcpy(&mode, part->dat, 4);
+		mode = ntohl(mode);
+	}
 
 	ack = xua_msg_alloc();
 	if (!ack)
@@ -253,8 +446,8 @@ static int m2ua_handle_asptm_act(struct sctp_m2ua_conn *conn,
 			continue;
 		}
 
-		link->conn = conn;
-		link->asp_active = 1;
+		if (link_add_conn(link, conn, mode) != 0)
+			continue;
 		xua_msg_add_data(ack, MUA_TAG_IDENT_INT, 4, (uint8_t *) &interf);
 	}
 
@@ -286,6 +479,58 @@ static int m2ua_handle_asptm_act(struct sctp_m2ua_conn *conn,
 	return 0;
 }
 
+/*
+ * The ASP leaves the listed links, or all of its links if there is no
+ * interface identifier. The other ASPs take over the queued DATA.
+ */
+static int m2ua_handle_asptm_inact(struct sctp_m2ua_conn *conn,
+				   struct xua_msg *m2ua,
+				   struct sctp_sndrcvinfo *info)
+{
+	struct mtp_m2ua_link *link;
+	struct xua_msg_part *part;
+	struct xua_msg *ack;
+	uint32_t interf;
+	int all = 1;
+
+	ack = xua_msg_alloc();
+	if (!ack)
+		return -1;
+
+	ack->hdr.msg_class = M2UA_CLS_ASPTM;
+	ack->hdr.msg_type = M2UA_ASPTM_INACTIV_ACK;
+
+	llist_for_each_entry(part, &m2ua->headers, entry) {
+		if (part->tag != MUA_TAG_IDENT_INT)
+			continue;
+		if (part->len != 4)
+			continue;
+
+		all = 0;
+		memcpy(&interf, part->dat, 4);
+		link = find_m2ua_link(conn->trans, ntohl(interf));
+		if (link)
+			link_drop_conn(link, conn);
+		xua_msg_add_data(ack, MUA_TAG_IDENT_INT, 4, (uint8_t *) &interf);
+	}
+
+	if (all) {
+		llist_for_each_entry(link, &conn->trans->links, entry)
+			if (link_conn_index(link, conn) >= 0)
+				link_drop_conn(link, conn);
+	}
+
+	m2ua_conn_failover(conn);
+
+	if (m2ua_conn_send(conn, ack, info) != 0) {
+		xua_msg_free(ack);
+		return -1;
+	}
+
+	xua_msg_free(ack);
+	return 0;
+}
+
 static int m2ua_handle_asptm(struct sctp_m2ua_conn *conn,
 			     struct xua_msg *m2ua,
 			     struct sctp_sndrcvinfo *info)
@@ -294,6 +539,9 @@ static int m2ua_handle_asptm(struct sctp_m2ua_conn *conn,
 	case M2UA_ASPTM_ACTIV:
 		m2ua_handle_asptm_act(conn, m2ua, info);
 		break;
+	case M2UA_ASPTM_INACTIV:
+		m2ua_handle_asptm_inact(conn, m2ua, info);
+		break;
 	default:
 		LOGP(DINP, LOGL_ERROR, "Unhandled msg_type %d\n",
 			m2ua->hdr.msg_type);
@@ -412,45 +660,6 @@ static int m2ua_handle_rel_req(struct mtp_m2ua_link *link,
 	return 0;
 }
 
-static int m2ua_handle_data(struct mtp_m2ua_link *_link,
-			    struct sctp_m2ua_conn *conn,
-			    struct xua_msg *m2ua,
-			    struct sctp_sndrcvinfo *info)
-{
-	struct msgb *msg;
-	struct xua_msg_part *data;
-	struct mtp_link *link;
-
-	data = xua_msg_find_tag(m2ua, M2UA_TAG_DATA);
-	if (!data) {
-		LOGP(DINP, LOGL_ERROR, "No DATA in DATA message.\n");
-		return -1;
-	}
-
-	if (data->len > 2048) {
-		LOGP(DINP, LOGL_ERROR, "TOO much data for us to handle.\n");
-		return -1;
-	}
-
-	msg = msgb_alloc(2048, "m2ua-data");
-	if (!msg) {
-		LOGP(DINP, LOGL_ERROR, "Failed to allocate storage.\n");
-		return -1;
-	}
-
-	msg->l2h = msgb_put(msg, data->len);
-	memcpy(msg->l2h, data->dat, data->len);
-
-	link = _link->base;
-	if (!link->blocked) {
-		mtp_handle_pcap(link, NET_IN, msg->l2h, msgb_l2len(msg));
-		mtp_link_set_data(link, msg);
-	}
-	msgb_free(msg);
-
-	return 0;
-}
-
 static int m2ua_handle_maup(struct mtp_m2ua_link *link,
 			    struct sctp_m2ua_conn *conn,
 			    struct xua_msg *m2ua,
@@ -462,15 +671,14 @@ static int m2ua_handle_maup(struct mtp_m2ua_link *link,
 	}
 
 	/* fixup for a broken MSC */
-	if (!link->conn && m2ua->hdr.msg_type == M2UA_MAUP_STATE_REQ) {
+	if (link->nr_conns == 0 && m2ua->hdr.msg_type == M2UA_MAUP_STATE_REQ) {
 		LOGP(DINP, LOGL_NOTICE,
 		     "No ASP Activate but no connection is on link-index %d.\n",
 		     link->link_index);
-		link->conn = conn;
-		link->asp_active = 1;
+		link_add_conn(link, conn, M2UA_TRAFFIC_OVERRIDE);
 	}
 
-	if (link->conn != conn) {
+	if (link_conn_index(link, conn) < 0) {
 		LOGP(DINP, LOGL_ERROR,
 		     "Someone forgot the ASP Activate on link-index %d\n",
 		     link->link_index);
@@ -487,9 +695,6 @@ static int m2ua_handle_maup(struct mtp_m2ua_link *link,
 	case M2UA_MAUP_REL_REQ:
 		m2ua_handle_rel_req(link, conn, m2ua, info);
 		break;
-	case M2UA_MAUP_DATA:
-		m2ua_handle_data(link, conn, m2ua, info);
-		break;
 	default:
 		LOGP(DINP, LOGL_ERROR, "Unhandled msg_type %d\n",
 			m2ua->hdr.msg_type);
@@ -527,11 +732,66 @@ static int m2ua_find_interface(struct xua_msg *m2ua, int def)
 	return def;
 }
 
+/*
+ * DATA is handled where it was received, the MSU points into the SCTP
+ * buffer. Returns MTP_MSG_CONSUMED if the MTP layer kept the msgb.
+ */
+static int m2ua_conn_handle_data(struct sctp_m2ua_conn *conn,
+				 struct xua_common_hdr *hdr, struct msgb *msg)
+{
+	struct mtp_m2ua_link *link;
+	uint32_t interface = 0;
+	uint16_t len;
+	uint8_t *data;
+
+	data = xua_data_find_tag(hdr, MUA_TAG_IDENT_INT, &len);
+	if (data && len == 4) {
+		memcpy(&interface, data, 4);
+		interface = ntohl(interface);
+	}
+
+	link = find_m2ua_link(conn->trans, interface);
+	if (!link) {
+		LOGP(DINP, LOGL_ERROR, "Link is required.\n");
+		return -1;
+	}
+
+	if (link_conn_index(link, conn) < 0) {
+		LOGP(DINP, LOGL_ERROR,
+		     "Someone forgot the ASP Activate on link-index %d\n",
+		     link->link_index);
+		return -1;
+	}
+
+	data = xua_data_find_tag(hdr, M2UA_TAG_DATA, &len);
+	if (!data) {
+		LOGP(DINP, LOGL_ERROR, "No DATA in DATA message.\n");
+		return -1;
+	}
+
+	if (link->base->blocked)
+		return 0;
+
+	/* strip the padding, the M2UA header stays as headroom */
+	msg->l2h = data;
+	msgb_trim(msg, data + len - msg->data);
+
+	mtp_handle_pcap(link->base, NET_IN, msg->l2h, msgb_l2len(msg));
+	return mtp_link_set_data(link->base, msg);
+}
+
 static int m2ua_conn_handle(struct sctp_m2ua_conn *conn,
 			    struct msgb *msg, struct sctp_sndrcvinfo *info)
 {
 	struct mtp_m2ua_link *link;
+	struct xua_common_hdr *hdr;
 	struct xua_msg *m2ua;
+
+	hdr = xua_data_hdr(msg, M2UA_VERSION);
+	if (hdr && hdr->msg_class == M2UA_CLS_MAUP
+	    && hdr->msg_type == M2UA_MAUP_DATA)
+		return m2ua_conn_handle_data(conn, hdr, msg);
+
 	m2ua = xua_from_msg(M2UA_VERSION, msg->len, msg->data);
 	if (!m2ua) {
 		LOGP(DINP, LOGL_ERROR, "Failed to parse the message.\n");
@@ -571,23 +831,24 @@ static int m2ua_conn_read(struct osmo_fd *fd)
 	struct msgb *msg;
 	int rc;
 
-	msg = msgb_alloc(2048, "m2ua buffer");
+	/* DATA is passed on in this msgb, leave room to relay it */
+	msg = msgb_pool_alloc(4096, 128, "m2ua buffer");
 	if (!msg) {
 		LOGP(DINP, LOGL_ERROR, "Failed to allocate buffer.\n");
 		m2ua_conn_destroy(fd->data);
-		return -1;
+		return -EBADF;
 	}
 
 	memset(&info, 0, sizeof(info));
 	memset(&addr, 0, sizeof(addr));
-	rc = sctp_recvmsg(fd->fd, msg->data, msg->data_len,
+	rc = sctp_recvmsg(fd->fd, msg->data, msgb_tailroom(msg),
 			  (struct sockaddr *) &addr, &len, &info, NULL);
 	if (rc <= 0) {
 		LOGP(DINP, LOGL_ERROR, "Failed to read: %d errno: %d\n",
 			rc, errno);
 		msgb_free(msg);
 		m2ua_conn_destroy(fd->data);
-		return -1;
+		return -EBADF;
 	}
 
 	if (ntohl(info.sinfo_ppid) != SCTP_PPID_M2UA) {
@@ -599,22 +860,44 @@ static int m2ua_conn_read(struct osmo_fd *fd)
 	msgb_put(msg, rc);
 	LOGP(DINP, LOGL_DEBUG, "Read %d on stream: %d ssn: %d assoc: %d\n",
 		rc, info.sinfo_stream, info.sinfo_ssn, info.sinfo_assoc_id);
-	m2ua_conn_handle(fd->data, msg, &info);
-	msgb_free(msg);
+	if (m2ua_conn_handle(fd->data, msg, &info) != MTP_MSG_CONSUMED)
+		msgb_free(msg);
 	return 0;
 }
 
+/*
+ * Any SLS can pick any of the ASPs, the fullest one limits the link.
+ * Without an ASP the write drops the message, do not hold it back.
+ */
+static int sctp_m2ua_tx_room(struct mtp_link *link)
+{
+	struct mtp_m2ua_link *mlink = link->data;
+	struct sctp_m2ua_conn *conn;
+	int i, room, min = -1;
+
+	for (i = 0; i < mlink->nr_conns; ++i) {
+		conn = mlink->conns[i];
+		room = sctp_queue_room(&conn->queue, &conn->queue_stats);
+		if (min < 0 || room < min)
+			min = room;
+	}
+
+	return min < 0 ? 1 : min;
+}
+
 static int sctp_m2ua_write(struct mtp_link *link, struct msgb *msg)
 {
 	struct mtp_m2ua_link *mlink;
+	struct sctp_m2ua_conn *conn;
 	struct sctp_sndrcvinfo info;
 	struct xua_msg *m2ua;
 	uint32_t interface;
+	int sls;
 
 	mlink = (struct mtp_m2ua_link *) link->data;
 
 
-	if (!mlink->conn) {
+	if (mlink->nr_conns == 0) {
 		LOGP(DINP, LOGL_ERROR, "M2UA write with no ASP for %d/%s of %d/%s.\n",
 		     link->nr, link->name, link->set->nr, link->set->name);
 		goto clean;
@@ -626,25 +909,32 @@ static int sctp_m2ua_write(struct mtp_link *link, struct msgb *msg)
 		goto clean;
 	}
 
+	mtp_handle_pcap(link, NET_OUT, msg->data, msg->len);
+
+	sls = MTP_LINK_SLS(((struct mtp_level_3_hdr *) msg->l2h)->addr);
+	conn = link_conn_for_sls(mlink, sls);
+
+	memset(&info, 0, sizeof(info));
+	info.sinfo_stream = sctp_sls_to_stream(conn->nr_streams, sls);
+	info.sinfo_assoc_id = 1;
+	info.sinfo_ppid = htonl(SCTP_PPID_M2UA);
+
+	interface = htonl(mlink->link_index);
+	if (m2ua_conn_send_data(conn, interface, msg, &info) == 0)
+		return 0;
+
+	/* not enough room in the msgb, build it the slow way */
 	m2ua = xua_msg_alloc();
 	if (!m2ua)
 		goto clean;
 
-	mtp_handle_pcap(link, NET_OUT, msg->data, msg->len);
-
 	m2ua->hdr.msg_class = M2UA_CLS_MAUP;
 	m2ua->hdr.msg_type = M2UA_MAUP_DATA;
 
-	interface = htonl(mlink->link_index);
 	xua_msg_add_data(m2ua, MUA_TAG_IDENT_INT, 4, (uint8_t *) &interface);
 	xua_msg_add_data(m2ua, M2UA_TAG_DATA, msg->len, msg->data);
 
-	memset(&info, 0, sizeof(info));
-	info.sinfo_stream = 1;
-	info.sinfo_assoc_id = 1;
-	info.sinfo_ppid = htonl(SCTP_PPID_M2UA);
-
-	m2ua_conn_send(mlink->conn, m2ua, &info);
+	m2ua_conn_send(conn, m2ua, &info);
 	xua_msg_free(m2ua);
 
 clean:
@@ -652,17 +942,24 @@ clean:
 	return 0;
 }
 
-static int m2ua_conn_write(struct osmo_fd *fd, struct msgb *msg)
+static int m2ua_conn_cb(struct osmo_fd *fd, unsigned int what)
 {
-	int ret;
-	struct sctp_sndrcvinfo info;
-	memcpy(&info, msg->data, sizeof(info));
+	struct sctp_m2ua_conn *conn = fd->data;
+	struct mtp_m2ua_link *link;
+
+	/* the connection is gone when the read failed */
+	if (what & BSC_FD_READ && m2ua_conn_read(fd) == -EBADF)
+		return 0;
+	if ((what & BSC_FD_WRITE) == 0)
+		return 0;
 
-	ret = sctp_send(fd->fd, msg->l2h, msgb_l2len(msg),
-			&info, 0);
+	if (sctp_queue_flush(&conn->queue, &conn->queue_stats) == 0)
+		return 0;
 
-	if (ret != msgb_l2len(msg))
-		LOGP(DINP, LOGL_ERROR, "Failed to send %d.\n", ret);
+	/* refill from the links using this ASP */
+	llist_for_each_entry(link, &conn->trans->links, entry)
+		if (link_conn_index(link, conn) >= 0)
+			mtp_link_tx_drain(link->base);
 
 	return 0;
 }
@@ -708,13 +1005,13 @@ static int sctp_trans_accept(struct osmo_fd *fd, unsigned int what)
 	}
 
 	conn->trans = trans;
+	conn->nr_streams = sctp_streams_outbound(s);
 
-	osmo_wqueue_init(&conn->queue, 10);
+	sctp_queue_init(&conn->queue, &conn->queue_stats, &trans->queue_cfg);
 	conn->queue.bfd.fd = s;
 	conn->queue.bfd.data = conn;
 	conn->queue.bfd.when = BSC_FD_READ;
-	conn->queue.read_cb = m2ua_conn_read;
-	conn->queue.write_cb = m2ua_conn_write;
+	conn->queue.bfd.cb = m2ua_conn_cb;
 
 	if (osmo_fd_register(&conn->queue.bfd) != 0) {
 		LOGP(DINP, LOGL_ERROR, "Failed to register.\n");
@@ -727,7 +1024,8 @@ static int sctp_trans_accept(struct osmo_fd *fd, unsigned int what)
 
 
 	count = sctp_m2ua_conn_count(trans);
-	LOGP(DINP, LOGL_NOTICE, "Now having %d SCTP connection(s).\n", count);
+	LOGP(DINP, LOGL_NOTICE, "Now having %d SCTP connection(s), the new one has %d stream(s).\n",
+	     count, conn->nr_streams);
 	return 0;
 }
 
@@ -748,7 +1046,7 @@ static int sctp_m2ua_reset(struct mtp_link *_link)
 	LOGP(DINP, LOGL_ERROR,
 	     "M2UA link-index %d not doing the reset.\n", link->link_index);
 
-	if (link->conn && link->asp_active && link->established)
+	if (link->nr_conns > 0 && link->asp_active && link->established)
 		mtp_link_start_link_test(_link);
 
 	return 0;
@@ -766,6 +1064,8 @@ struct sctp_m2ua_transport *sctp_m2ua_transp_create(struct bsc_data *bsc)
 
 	INIT_LLIST_HEAD(&trans->conns);
 	INIT_LLIST_HEAD(&trans->links);
+	link_index_table_init(&trans->link_table);
+	sctp_queue_cfg_init(&trans->queue_cfg);
 
 
 	return trans;
@@ -794,6 +1094,9 @@ int sctp_m2ua_transport_bind(struct sctp_m2ua_transport *trans,
 		return -2;
 	}
 
+	/* the accepted associations inherit it */
+	sctp_streams_request(sctp, SCTP_NR_STREAMS);
+
 	if (listen(sctp, 1) != 0) {
 		LOGP(DINP, LOGL_ERROR, "Failed to listen.\n");
 		close(sctp);
@@ -838,7 +1141,9 @@ struct mtp_m2ua_link *mtp_m2ua_link_init(struct mtp_link *blnk)
 	lnk->base->clear_queue = sctp_m2ua_dummy;
 	lnk->base->reset = sctp_m2ua_reset;
 	lnk->base->write = sctp_m2ua_write;
+	lnk->base->tx_room = sctp_m2ua_tx_room;
 
 	lnk->transport = trans;
+	mtp_m2ua_link_set_index(lnk, 0);
 	return lnk;
 }
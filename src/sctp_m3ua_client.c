@@ -20,6 +20,9 @@
 #include <string.h>
 #include <bsc_data.h>
 #include <counter.h>
+#include <msgb_pool.h>
+#include <sctp_streams.h>
+#include <xua_data.h>
 
 #include <osmocom/sigtran/xua_msg.h>
 #include <osmocom/sigtran/m3ua_types.h>
@@ -33,6 +36,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
+#include <limits.h>
 
 #define SCTP_PPID_M3UA 3
 
@@ -43,12 +47,13 @@
 /*
  * State machine code
  */
-static void m3ua_handle_aspsm(struct mtp_m3ua_client_link *link, struct xua_msg *msg);
-static void m3ua_handle_asptm(struct mtp_m3ua_client_link *link, struct xua_msg *msg);
-static void m3ua_handle_trans(struct mtp_m3ua_client_link *link, struct xua_msg *msg);
-static void m3ua_send_daud(struct mtp_m3ua_client_link *link, uint32_t pc);
-static void m3ua_send_aspup(struct mtp_m3ua_client_link *link);
-static void m3ua_send_aspac(struct mtp_m3ua_client_link *link);
+static void m3ua_handle_aspsm(struct mtp_m3ua_asp *asp, struct xua_msg *msg);
+static void m3ua_handle_asptm(struct mtp_m3ua_asp *asp, struct xua_msg *msg);
+static int m3ua_handle_trans(struct mtp_m3ua_asp *asp,
+			     struct xua_common_hdr *hdr, struct msgb *msg);
+static void m3ua_send_daud(struct mtp_m3ua_asp *asp, uint32_t pc);
+static void m3ua_send_aspup(struct mtp_m3ua_asp *asp);
+static void m3ua_send_aspac(struct mtp_m3ua_asp *asp);
 
 // TODO: Share with msc_conn.c:setnonblocking
 static int setnonblocking_fd(int fd)
@@ -74,36 +79,142 @@ static int setnonblocking_fd(int fd)
 /*
  * boilerplate
  */
-static int m3ua_shutdown(struct mtp_link *mtp_link);
 static void m3ua_start(void *data);
 
-static void schedule_restart(struct mtp_m3ua_client_link *link)
+static void schedule_restart(struct mtp_m3ua_asp *asp)
 {
-	link->connect_timer.data = link;
-	link->connect_timer.cb = m3ua_start;
-	osmo_timer_schedule(&link->connect_timer, 1, 0);
+	asp->connect_timer.data = asp;
+	asp->connect_timer.cb = m3ua_start;
+	osmo_timer_schedule(&asp->connect_timer, 1, 0);
 }
 
-static void fail_link(struct mtp_m3ua_client_link *link)
+/* the ASP for the SLS, NULL if none is active */
+static struct mtp_m3ua_asp *asp_for_sls(struct mtp_m3ua_client_link *link, int sls)
 {
-	/* We need to fail the link */
-	m3ua_shutdown(link->base);
-	mtp_link_down(link->base);
-	schedule_restart(link);
+	if (link->nr_active == 0)
+		return NULL;
+	if (link->traffic_mode == M3UA_TRAFFIC_LOADSHARE)
+		return link->active[sls % link->nr_active];
+	return link->active[0];
+}
+
+static void asp_update_active(struct mtp_m3ua_client_link *link)
+{
+	struct mtp_m3ua_asp *asp;
+	int was_active = link->nr_active;
+
+	link->nr_active = 0;
+	llist_for_each_entry(asp, &link->asps, entry)
+		if (asp->asptm_active)
+			link->active[link->nr_active++] = asp;
+
+	LOGP(DINP, LOGL_NOTICE, "M3UA link %d/%s has %d active ASP(s).\n",
+	     link->base->nr, link->base->name, link->nr_active);
+
+	if (!was_active && link->nr_active)
+		mtp_link_up(link->base);
+	else if (was_active && !link->nr_active)
+		mtp_link_down(link->base);
+}
+
+static void asp_stop(struct mtp_m3ua_asp *asp)
+{
+	if (asp->queue.bfd.fd >= 0) {
+		osmo_fd_unregister(&asp->queue.bfd);
+		close(asp->queue.bfd.fd);
+		asp->queue.bfd.fd = -1;
+	}
+	asp->aspsm_active = 0;
+	asp->asptm_active = 0;
+	osmo_timer_del(&asp->connect_timer);
+	osmo_timer_del(&asp->aspac_ack_timer);
+}
+
+/*
+ * Move the DATA still queued for a failed association to the ones that
+ * are left, by the same SLS rule the new messages use. The management
+ * messages belong to the association and are dropped with it, so is
+ * everything in broadcast mode as the others got a copy already.
+ */
+static void asp_failover(struct mtp_m3ua_asp *asp)
+{
+	struct mtp_m3ua_client_link *link = asp->link;
+	struct mtp_m3ua_asp *other;
+	struct sctp_sndrcvinfo *info;
+	struct xua_common_hdr *hdr;
+	struct m3ua_protocol_data *proto;
+	struct msgb *msg, *tmp;
+	uint16_t len;
+	int moved = 0;
+
+	if (link->nr_active == 0 || link->traffic_mode == M3UA_TRAFFIC_BROADCAST)
+		goto clear;
+
+	llist_for_each_entry_safe(msg, tmp, &asp->queue.msg_queue, list) {
+		hdr = (struct xua_common_hdr *) msg->l2h;
+		if (hdr->msg_class != M3UA_CLS_TRANS)
+			continue;
+
+		proto = (struct m3ua_protocol_data *)
+				xua_data_find_tag(hdr, M3UA_TAG_PROTO_DATA, &len);
+		if (!proto || len < sizeof(*proto))
+			continue;
+
+		llist_del(&msg->list);
+		asp->queue.current_length -= 1;
+
+		other = asp_for_sls(link, proto->sls);
+		info = (struct sctp_sndrcvinfo *) msg->data;
+		info->sinfo_stream = sctp_sls_to_stream(other->nr_streams, proto->sls);
+		if (sctp_queue_enqueue(&other->queue, &other->queue_stats, msg) != 0) {
+			rate_ctr_inc(&link->base->ctrg->ctr[MTP_LNK_DRP]);
+			rate_ctr_inc(&link->base->set->ctrg->ctr[MTP_LSET_TOTA_DRP_MSG]);
+			msgb_free(msg);
+			continue;
+		}
+		moved += 1;
+	}
+
+	if (moved)
+		LOGP(DINP, LOGL_NOTICE, "Moved %d message(s) of ASP %d on %d/%s.\n",
+		     moved, asp->nr, link->base->nr, link->base->name);
+
+clear:
+	osmo_wqueue_clear(&asp->queue);
+}
+
+static void fail_asp(struct mtp_m3ua_asp *asp)
+{
+	struct mtp_m3ua_client_link *link = asp->link;
+
+	/* We need to fail the association and try again */
+	asp_stop(asp);
+	asp_update_active(link);
+	asp_failover(asp);
+	if (link->running)
+		schedule_restart(asp);
 }
 
 static void aspac_ack_timeout(void *data)
 {
-	struct mtp_m3ua_client_link *link = data;
+	struct mtp_m3ua_asp *asp = data;
 
-	LOGP(DINP, LOGL_ERROR, "ASP ACK not received. Closing it down.\n");
-	fail_link(link);
+	LOGP(DINP, LOGL_ERROR, "ASP ACK not received on ASP %d. Closing it down.\n",
+	     asp->nr);
+	fail_asp(asp);
 }
 
-static int m3ua_conn_handle(struct mtp_m3ua_client_link *link,
+static int m3ua_conn_handle(struct mtp_m3ua_asp *asp,
 				struct msgb *msg, struct sctp_sndrcvinfo *info)
 {
+	struct xua_common_hdr *hdr;
 	struct xua_msg *m3ua;
+
+	/* DATA is handled in place */
+	hdr = xua_data_hdr(msg, M3UA_VERSION);
+	if (hdr && hdr->msg_class == M3UA_CLS_TRANS)
+		return m3ua_handle_trans(asp, hdr, msg);
+
 	m3ua = xua_from_msg(M3UA_VERSION, msg->len, msg->data);
 	if (!m3ua) {
 		LOGP(DINP, LOGL_ERROR, "Failed to parse the message.\n");
@@ -112,13 +223,10 @@ static int m3ua_conn_handle(struct mtp_m3ua_client_link *link,
 
 	switch (m3ua->hdr.msg_class) {
 	case M3UA_CLS_ASPSM:
-		m3ua_handle_aspsm(link, m3ua);
+		m3ua_handle_aspsm(asp, m3ua);
 		break;
 	case M3UA_CLS_ASPTM:
-		m3ua_handle_asptm(link, m3ua);
-		break;
-	case M3UA_CLS_TRANS:
-		m3ua_handle_trans(link, m3ua);
+		m3ua_handle_asptm(asp, m3ua);
 		break;
 	default:
 		LOGP(DINP, LOGL_ERROR, "Unhandled msg_class %d\n",
@@ -130,25 +238,11 @@ static int m3ua_conn_handle(struct mtp_m3ua_client_link *link,
 	return 0;
 }
 
-static int m3ua_conn_write(struct osmo_fd *fd, struct msgb *msg)
-{
-	int ret;
-	struct sctp_sndrcvinfo info;
-	memcpy(&info, msg->data, sizeof(info));
-
-	ret = sctp_send(fd->fd, msg->l2h, msgb_l2len(msg),
-			&info, 0);
-
-	if (ret != msgb_l2len(msg))
-		LOGP(DINP, LOGL_ERROR, "Failed to send %d.\n", ret);
-
-	return 0;
-}
-
-static int m3ua_conn_send(struct mtp_m3ua_client_link *link,
+static int m3ua_conn_send(struct mtp_m3ua_asp *asp,
 			  struct xua_msg *m3ua,
 			  struct sctp_sndrcvinfo *info)
 {
+	struct mtp_link *link = asp->link->base;
 	struct msgb *msg;
 	msg = xua_to_msg(M3UA_VERSION, m3ua);
 	if (!msg)
@@ -159,10 +253,10 @@ static int m3ua_conn_send(struct mtp_m3ua_client_link *link,
 	msgb_push(msg, sizeof(*info));
 	memcpy(msg->data, info, sizeof(*info));
 
-	if (osmo_wqueue_enqueue(&link->queue, msg) != 0) {
+	if (sctp_queue_enqueue(&asp->queue, &asp->queue_stats, msg) != 0) {
 		LOGP(DINP, LOGL_ERROR, "Failed to enqueue.\n");
-		rate_ctr_inc(&link->base->ctrg->ctr[MTP_LNK_DRP]);
-		rate_ctr_inc(&link->base->set->ctrg->ctr[MTP_LSET_TOTA_DRP_MSG]);
+		rate_ctr_inc(&link->ctrg->ctr[MTP_LNK_DRP]);
+		rate_ctr_inc(&link->set->ctrg->ctr[MTP_LSET_TOTA_DRP_MSG]);
 		msgb_free(msg);
 		return -1;
 	}
@@ -175,26 +269,27 @@ static int m3ua_conn_read(struct osmo_fd *fd)
 	struct sockaddr_in addr;
 	struct sctp_sndrcvinfo info;
 	socklen_t len = sizeof(addr);
-	struct mtp_m3ua_client_link *link = fd->data;
+	struct mtp_m3ua_asp *asp = fd->data;
 	struct msgb *msg;
 	int rc;
 
-	msg = msgb_alloc(2048, "m3ua buffer");
+	/* DATA is passed on in this msgb, leave room to relay it */
+	msg = msgb_pool_alloc(4096, 128, "m3ua buffer");
 	if (!msg) {
 		LOGP(DINP, LOGL_ERROR, "Failed to allocate buffer.\n");
-		fail_link(link);
+		fail_asp(asp);
 		return -1;
 	}
 
 	memset(&info, 0, sizeof(info));
 	memset(&addr, 0, sizeof(addr));
-	rc = sctp_recvmsg(fd->fd, msg->data, msg->data_len,
+	rc = sctp_recvmsg(fd->fd, msg->data, msgb_tailroom(msg),
 			  (struct sockaddr *) &addr, &len, &info, NULL);
 	if (rc <= 0) {
 		LOGP(DINP, LOGL_ERROR, "Failed to read: %d errno: %d\n",
 			rc, errno);
 		msgb_free(msg);
-		fail_link(link);
+		fail_asp(asp);
 		return -1;
 	}
 
@@ -208,22 +303,42 @@ static int m3ua_conn_read(struct osmo_fd *fd)
 	msgb_put(msg, rc);
 	LOGP(DINP, LOGL_DEBUG, "Read %d on stream: %d ssn: %d assoc: %d\n",
 		rc, info.sinfo_stream, info.sinfo_ssn, info.sinfo_assoc_id);
-	m3ua_conn_handle(link, msg, &info);
-	msgb_free(msg);
+	if (m3ua_conn_handle(asp, msg, &info) != MTP_MSG_CONSUMED)
+		msgb_free(msg);
 	return 0;
 }
 
-static void m3ua_connected(struct mtp_m3ua_client_link *link)
+static int m3ua_conn_cb(struct osmo_fd *fd, unsigned int what)
 {
-	link->aspac_ack_timer.data = link;
-	link->aspac_ack_timer.cb = aspac_ack_timeout;
-	osmo_timer_schedule(&link->aspac_ack_timer, link->aspac_ack_timeout, 0);
-	m3ua_send_aspup(link);
+	struct mtp_m3ua_asp *asp = fd->data;
+
+	if (what & BSC_FD_READ)
+		m3ua_conn_read(fd);
+
+	/* a failed read closed the association */
+	if (fd->fd < 0 || (what & BSC_FD_WRITE) == 0)
+		return 0;
+
+	if (sctp_queue_flush(&asp->queue, &asp->queue_stats) > 0)
+		mtp_link_tx_drain(asp->link->base);
+	return 0;
+}
+
+static void m3ua_connected(struct mtp_m3ua_asp *asp)
+{
+	asp->nr_streams = sctp_streams_outbound(asp->queue.bfd.fd);
+	LOGP(DINP, LOGL_NOTICE, "SCTP M3UA association of ASP %d has %d stream(s).\n",
+	     asp->nr, asp->nr_streams);
+
+	asp->aspac_ack_timer.data = asp;
+	asp->aspac_ack_timer.cb = aspac_ack_timeout;
+	osmo_timer_schedule(&asp->aspac_ack_timer, asp->link->aspac_ack_timeout, 0);
+	m3ua_send_aspup(asp);
 }
 
 static int sctp_m3ua_connected(struct osmo_fd *fd, unsigned int what)
 {
-	struct mtp_m3ua_client_link *link = fd->data;
+	struct mtp_m3ua_asp *asp = fd->data;
 	int val, rc;
 	socklen_t len = sizeof(val);
 
@@ -242,17 +357,17 @@ static int sctp_m3ua_connected(struct osmo_fd *fd, unsigned int what)
 	}
 
 	/* go to full operation */
-	fd->cb = osmo_wqueue_bfd_cb;
+	fd->cb = m3ua_conn_cb;
 	fd->when = BSC_FD_READ;
-	if (!llist_empty(&link->queue.msg_queue))
+	if (!llist_empty(&asp->queue.msg_queue))
 		fd->when |= BSC_FD_WRITE;
 
 	LOGP(DINP, LOGL_NOTICE, "SCTP M3UA is now connected.\n");
-	m3ua_connected(link);
+	m3ua_connected(asp);
 	return 0;
 
 error:
-	fail_link(link);
+	fail_asp(asp);
 	return -1;
 }
 
@@ -260,20 +375,21 @@ static void m3ua_start(void *data)
 {
 	int sctp, ret;
 	struct sockaddr_in loc_addr, rem_addr;
-	struct mtp_m3ua_client_link *link = data;
+	struct mtp_m3ua_asp *asp = data;
+	struct mtp_m3ua_client_link *link = asp->link;
 	struct sctp_event_subscribe events;
 	bool is_connected = false;
 
 	sctp = socket(PF_INET, SOCK_STREAM, IPPROTO_SCTP);
 	if (!sctp) {
 		LOGP(DINP, LOGL_ERROR, "Failed to create socket.\n");
-		return fail_link(link);
+		return fail_asp(asp);
 	}
 
 	if (setnonblocking_fd(sctp) != 0)  {
 		LOGP(DINP, LOGL_ERROR, "Failed to set nonblocking\n");
 		close(sctp);
-		return fail_link(link);
+		return fail_asp(asp);
 	}
 
 	memset(&events, 0, sizeof(events));
@@ -282,125 +398,173 @@ static void m3ua_start(void *data)
 	if (ret != 0) {
 		LOGP(DINP, LOGL_ERROR, "Failed to enable SCTP Events. Closing socket.\n");
 		close(sctp);
-		return fail_link(link);
+		return fail_asp(asp);
 	}
 
+	sctp_streams_request(sctp, SCTP_NR_STREAMS);
+
+	/* the source port is left to the kernel for the other ASPs */
 	loc_addr = link->local;
 	loc_addr.sin_family = AF_INET;
+	if (asp->nr != 0)
+		loc_addr.sin_port = 0;
 	if (bind(sctp, (struct sockaddr *) &loc_addr, sizeof(loc_addr)) != 0) {
 		LOGP(DINP, LOGL_ERROR, "Failed to bind.\n");
 		close(sctp);
-		return fail_link(link);
+		return fail_asp(asp);
 	}
 
-	rem_addr = link->remote;
+	rem_addr = asp->remote;
 	rem_addr.sin_family = AF_INET;
 	ret = connect(sctp, (struct sockaddr *) &rem_addr, sizeof(rem_addr));
 
 	/* common code */
-	link->queue.bfd.fd = sctp;
-	link->queue.bfd.data = link;
-	link->queue.read_cb = m3ua_conn_read;
-	link->queue.write_cb = m3ua_conn_write;
+	asp->queue.bfd.fd = sctp;
+	asp->queue.bfd.data = asp;
 
 	if (ret == -1 && errno == EINPROGRESS) {
 		LOGP(DINP, LOGL_NOTICE, "SCTP M3UA async connect in progrss.\n");
-		link->queue.bfd.when = BSC_FD_WRITE;
-		link->queue.bfd.cb = sctp_m3ua_connected;
+		asp->queue.bfd.when = BSC_FD_WRITE;
+		asp->queue.bfd.cb = sctp_m3ua_connected;
 	} else if (ret != 0) {
 		LOGP(DINP, LOGL_ERROR, "Failed to connect\n");
 		close(sctp);
-		return fail_link(link);
+		asp->queue.bfd.fd = -1;
+		return fail_asp(asp);
 	} else {
-		link->queue.bfd.when = BSC_FD_READ;
-		link->queue.bfd.cb = osmo_wqueue_bfd_cb;
+		asp->queue.bfd.when = BSC_FD_READ;
+		asp->queue.bfd.cb = m3ua_conn_cb;
 		is_connected = true;
 	}
 
-	if (osmo_fd_register(&link->queue.bfd) != 0) {
+	if (osmo_fd_register(&asp->queue.bfd) != 0) {
 		LOGP(DINP, LOGL_ERROR, "Failed to register fd\n");
 		close(sctp);
-		return fail_link(link);
+		asp->queue.bfd.fd = -1;
+		return fail_asp(asp);
 	}
 
 	/* begin the messages for bring-up */
 	if (is_connected)
-		return m3ua_connected(link);
+		return m3ua_connected(asp);
 }
 
-static int m3ua_write(struct mtp_link *mtp_link, struct msgb *msg)
+/* what the ASPs the traffic goes to can take */
+static int m3ua_tx_room(struct mtp_link *mtp_link)
 {
 	struct mtp_m3ua_client_link *link = mtp_link->data;
-	struct sctp_sndrcvinfo info;
-	struct xua_msg *m3ua;
-	struct mtp_level_3_hdr *mtp_hdr;
-	struct m3ua_protocol_data proto_data;
-	uint8_t *proto_start;
-
-	if (!link->asptm_active) {
-		LOGP(DINP, LOGL_ERROR, "ASP not ready  for %d/%s of %d/%s.\n",
-			mtp_link->nr, mtp_link->name, mtp_link->set->nr,
-			mtp_link->set->name);
-		goto clean;
+	struct mtp_m3ua_asp *asp;
+	int i, room, min_room = INT_MAX;
+
+	/* without an ASP the write drops the message, do not hold it back */
+	if (link->nr_active == 0)
+		return 1;
+
+	for (i = 0; i < link->nr_active; ++i) {
+		asp = link->active[i];
+		room = sctp_queue_room(&asp->queue, &asp->queue_stats);
+		if (room < min_room)
+			min_room = room;
+		if (link->traffic_mode == M3UA_TRAFFIC_OVERRIDE)
+			break;
 	}
 
-	/*
-	 * TODO.. we could enhance the structure of mtp_link to
-	 * have function pointers for operations like SLTM instead
-	 * of doing what we do here.
-	 * The entire m3ua episode (code + reading the spec) had a
-	 * budget of < 2 man days so the amount of architecture changes
-	 * we can do.
-	 */
+	return min_room;
+}
 
-	/* TODO.. need to terminate MTPL3 locally... */
+/* the Protocol Data replaces the MTP3 header */
+static int m3ua_push_label(struct mtp_link *mtp_link, struct msgb *msg,
+			   int opc, int dpc, int sls, int si)
+{
+	struct m3ua_protocol_data *proto;
+
+	if (msgb_headroom(msg) < sizeof(*proto))
+		return -1;
+
+	proto = (struct m3ua_protocol_data *) msgb_push(msg, sizeof(*proto));
+	proto->opc = htonl(opc);
+	proto->dpc = htonl(dpc);
+	proto->si = si;
+	proto->ni = mtp_link->set->ni;
+	proto->mp = 0;
+	proto->sls = sls;
+
+	msg->l2h = (uint8_t *) proto;
+	MTP_MSG_CB(msg)->native = 1;
+	MTP_MSG_CB(msg)->si = si;
+	return 0;
+}
+
+/* MSUs relayed or routed from the MTP3 links still have the header */
+static int m3ua_from_mtp3(struct mtp_link *mtp_link, struct msgb *msg)
+{
+	struct mtp_level_3_hdr *mtp_hdr;
+	int opc, dpc, sls, si;
 
-	/* TODO.. extract MTP information.. */
 	mtp_hdr = (struct mtp_level_3_hdr *) msg->l2h;
 	switch (mtp_hdr->ser_ind) {
 	case MTP_SI_MNT_SNM_MSG:
 	case MTP_SI_MNT_REG_MSG:
 		LOGP(DINP, LOGL_ERROR,
 			"Dropping SNM/REG message %d\n", mtp_hdr->ser_ind);
+		return -1;
+	}
+
+	opc = MTP_READ_OPC(mtp_hdr->addr);
+	dpc = MTP_READ_DPC(mtp_hdr->addr);
+	sls = MTP_LINK_SLS(mtp_hdr->addr);
+	si = mtp_hdr->ser_ind;
+
+	msg->l3h = mtp_hdr->data;
+	msgb_pull_to_l3(msg);
+	return m3ua_push_label(mtp_link, msg, opc, dpc, sls, si);
+}
+
+static void m3ua_asp_write(struct mtp_m3ua_asp *asp, struct xua_msg *m3ua, int sls)
+{
+	struct sctp_sndrcvinfo info;
+
+	memset(&info, 0, sizeof(info));
+	info.sinfo_stream = sctp_sls_to_stream(asp->nr_streams, sls);
+	info.sinfo_assoc_id = 1;
+	info.sinfo_ppid = htonl(SCTP_PPID_M3UA);
+
+	m3ua_conn_send(asp, m3ua, &info);
+}
+
+static int m3ua_write(struct mtp_link *mtp_link, struct msgb *msg)
+{
+	struct mtp_m3ua_client_link *link = mtp_link->data;
+	struct xua_msg *m3ua;
+	struct m3ua_protocol_data *proto;
+	int i;
+
+	if (link->nr_active == 0) {
+		LOGP(DINP, LOGL_ERROR, "ASP not ready  for %d/%s of %d/%s.\n",
+			mtp_link->nr, mtp_link->name, mtp_link->set->nr,
+			mtp_link->set->name);
+		goto clean;
+	}
+
+	if (!MTP_MSG_CB(msg)->native && m3ua_from_mtp3(mtp_link, msg) != 0)
 		goto clean;
-		break;
-	case MTP_SI_MNT_ISUP:
-	case MTP_SI_MNT_SCCP:
-	default:
-		memset(&proto_data, 0, sizeof(proto_data));
-		proto_data.opc = htonl(MTP_READ_OPC(mtp_hdr->addr));
-		proto_data.dpc = htonl(MTP_READ_DPC(mtp_hdr->addr));
-		proto_data.sls = MTP_LINK_SLS(mtp_hdr->addr);
-		proto_data.si = mtp_hdr->ser_ind;
-		proto_data.ni = mtp_link->set->ni;
-
-		msg->l3h = mtp_hdr->data;
-		msgb_pull_to_l3(msg);
-		proto_start = msgb_push(msg, sizeof(proto_data));
-		memcpy(proto_start, &proto_data, sizeof(proto_data));
-		break;
-	};
 
 	m3ua = xua_msg_alloc();
 	if (!m3ua)
 		goto clean;
 
-	mtp_handle_pcap(mtp_link, NET_OUT, msg->data, msg->len);
+	proto = (struct m3ua_protocol_data *) msg->l2h;
+	mtp_handle_pcap(mtp_link, NET_OUT, msg->l2h, msgb_l2len(msg));
 
 	m3ua->hdr.msg_class = M3UA_CLS_TRANS;
 	m3ua->hdr.msg_type = M3UA_TRANS_DATA;
+	xua_msg_add_data(m3ua, M3UA_TAG_PROTO_DATA, msgb_l2len(msg), msg->l2h);
 
-	/*
-	 * Modify the data...to create a true protocol data..
-	 */
-	xua_msg_add_data(m3ua, M3UA_TAG_PROTO_DATA, msg->len, msg->data);
-
-	memset(&info, 0, sizeof(info));
-	info.sinfo_stream = 1;
-	info.sinfo_assoc_id = 1;
-	info.sinfo_ppid = htonl(SCTP_PPID_M3UA);
-
-	m3ua_conn_send(link, m3ua, &info);
+	if (link->traffic_mode == M3UA_TRAFFIC_BROADCAST) {
+		for (i = 0; i < link->nr_active; ++i)
+			m3ua_asp_write(link->active[i], m3ua, proto->sls);
+	} else
+		m3ua_asp_write(asp_for_sls(link, proto->sls), m3ua, proto->sls);
 	xua_msg_free(m3ua);
 
 clean:
@@ -411,37 +575,98 @@ clean:
 static int m3ua_shutdown(struct mtp_link *mtp_link)
 {
 	struct mtp_m3ua_client_link *link = mtp_link->data;
+	struct mtp_m3ua_asp *asp;
 
-	if (link->queue.bfd.fd >= 0) {
-		osmo_fd_unregister(&link->queue.bfd);
-		close(link->queue.bfd.fd);
-		link->queue.bfd.fd = -1;
+	link->running = 0;
+	link->nr_active = 0;
+	llist_for_each_entry(asp, &link->asps, entry) {
+		asp_stop(asp);
+		osmo_wqueue_clear(&asp->queue);
 	}
-	osmo_wqueue_clear(&link->queue);
-	link->aspsm_active = 0;
-	link->asptm_active = 0;
-	osmo_timer_del(&link->connect_timer);
-	osmo_timer_del(&link->aspac_ack_timer);
 	return 0;
 }
 
 static int m3ua_reset(struct mtp_link *mtp_link)
 {
 	struct mtp_m3ua_client_link *link = mtp_link->data;
+	struct mtp_m3ua_asp *asp;
 
 	/* stop things in case they run.. */
 	m3ua_shutdown(mtp_link);
-	schedule_restart(link);
+	link->running = 1;
+	llist_for_each_entry(asp, &link->asps, entry)
+		schedule_restart(asp);
 	return 0;
 }
 
 static int m3ua_clear_queue(struct mtp_link *mtp_link)
 {
 	struct mtp_m3ua_client_link *link = mtp_link->data;
-	osmo_wqueue_clear(&link->queue);
+	struct mtp_m3ua_asp *asp;
+
+	llist_for_each_entry(asp, &link->asps, entry)
+		osmo_wqueue_clear(&asp->queue);
 	return 0;
 }
 
+struct mtp_m3ua_asp *mtp_m3ua_client_asp_num(struct mtp_m3ua_client_link *link, int nr)
+{
+	struct mtp_m3ua_asp *asp;
+
+	llist_for_each_entry(asp, &link->asps, entry)
+		if (asp->nr == nr)
+			return asp;
+	return NULL;
+}
+
+struct mtp_m3ua_asp *mtp_m3ua_client_asp_alloc(struct mtp_m3ua_client_link *link, int nr)
+{
+	struct mtp_m3ua_asp *asp, *next;
+
+	if (nr < 0 || nr >= M3UA_MAX_ASPS)
+		return NULL;
+
+	asp = mtp_m3ua_client_asp_num(link, nr);
+	if (asp)
+		return asp;
+
+	asp = talloc_zero(link, struct mtp_m3ua_asp);
+	if (!asp) {
+		LOGP(DINP, LOGL_ERROR, "Failed to allocate ASP %d.\n", nr);
+		return NULL;
+	}
+
+	asp->link = link;
+	asp->nr = nr;
+	sctp_queue_init(&asp->queue, &asp->queue_stats, &link->queue_cfg);
+	asp->queue.bfd.fd = -1;
+	asp->remote.sin_port = htons(2905);
+
+	/* keep the list ordered, the active ASPs follow it */
+	llist_for_each_entry(next, &link->asps, entry)
+		if (next->nr > nr)
+			break;
+	llist_add_tail(&asp->entry, &next->entry);
+
+	if (link->running)
+		schedule_restart(asp);
+	return asp;
+}
+
+void mtp_m3ua_client_asp_free(struct mtp_m3ua_asp *asp)
+{
+	struct mtp_m3ua_client_link *link = asp->link;
+	int was_active = asp->asptm_active;
+
+	asp_stop(asp);
+	llist_del(&asp->entry);
+	if (was_active)
+		asp_update_active(link);
+	asp_failover(asp);
+	sctp_queue_stop(&asp->queue, &asp->queue_stats);
+	talloc_free(asp);
+}
+
 struct mtp_m3ua_client_link *mtp_m3ua_client_link_init(struct mtp_link *blnk)
 {
 	struct mtp_m3ua_client_link *lnk;
@@ -464,14 +689,22 @@ struct mtp_m3ua_client_link *mtp_m3ua_client_link_init(struct mtp_link *blnk)
 	lnk->base->shutdown = m3ua_shutdown;
 	lnk->base->reset = m3ua_reset;
 	lnk->base->clear_queue = m3ua_clear_queue;
+	lnk->base->tx_room = m3ua_tx_room;
+	lnk->base->push_label = m3ua_push_label;
 
-	osmo_wqueue_init(&lnk->queue, 10);
-	lnk->queue.bfd.fd = -1;
-	lnk->traffic_mode = 2;
+	INIT_LLIST_HEAD(&lnk->asps);
+	lnk->traffic_mode = M3UA_TRAFFIC_LOADSHARE;
 	lnk->aspac_ack_timeout = 10;
+	sctp_queue_cfg_init(&lnk->queue_cfg);
 
 	/* default ports */
-	lnk->local.sin_port = lnk->remote.sin_port = htons(2905);
+	lnk->local.sin_port = htons(2905);
+
+	if (!mtp_m3ua_client_asp_alloc(lnk, 0)) {
+		talloc_free(lnk);
+		blnk->data = NULL;
+		return NULL;
+	}
 
 	return lnk;
 }
@@ -480,7 +713,7 @@ struct mtp_m3ua_client_link *mtp_m3ua_client_link_init(struct mtp_link *blnk)
 /*
  * asp handling
  */
-static void m3ua_send_aspup(struct mtp_m3ua_client_link *link)
+static void m3ua_send_aspup(struct mtp_m3ua_asp *asp)
 {
 	struct sctp_sndrcvinfo info;
 	struct xua_msg *aspup;
@@ -488,7 +721,7 @@ static void m3ua_send_aspup(struct mtp_m3ua_client_link *link)
 
 	aspup = xua_msg_alloc();
 	if (!aspup) {
-		fail_link(link);
+		fail_asp(asp);
 		return;
 	}
 
@@ -500,14 +733,14 @@ static void m3ua_send_aspup(struct mtp_m3ua_client_link *link)
 	aspup->hdr.msg_class = M3UA_CLS_ASPSM;
 	aspup->hdr.msg_type = M3UA_ASPSM_UP;
 
-	asp_ident = htonl(link->link_index);
+	asp_ident = htonl(asp->link->link_index);
 	xua_msg_add_data(aspup, MUA_TAG_ASP_IDENT, 4, (uint8_t *) &asp_ident);
 
-	m3ua_conn_send(link, aspup, &info);
+	m3ua_conn_send(asp, aspup, &info);
 	xua_msg_free(aspup);
 }
 
-static void m3ua_send_aspac(struct mtp_m3ua_client_link *link)
+static void m3ua_send_aspac(struct mtp_m3ua_asp *asp)
 {
 	struct sctp_sndrcvinfo info;
 	struct xua_msg *aspac;
@@ -516,7 +749,7 @@ static void m3ua_send_aspac(struct mtp_m3ua_client_link *link)
 
 	aspac = xua_msg_alloc();
 	if (!aspac) {
-		fail_link(link);
+		fail_asp(asp);
 		return;
 	}
 
@@ -528,17 +761,17 @@ static void m3ua_send_aspac(struct mtp_m3ua_client_link *link)
 	aspac->hdr.msg_class = M3UA_CLS_ASPTM;
 	aspac->hdr.msg_type = M3UA_ASPTM_ACTIV;
 
-	traffic_mode = htonl(link->traffic_mode);
+	traffic_mode = htonl(asp->link->traffic_mode);
 	xua_msg_add_data(aspac, 11, 4, (uint8_t *) &traffic_mode);
 
-	routing_ctx = htonl(link->routing_context);
+	routing_ctx = htonl(asp->link->routing_context);
 	xua_msg_add_data(aspac, MUA_TAG_ROUTING_CTX, 4, (uint8_t *) &routing_ctx);
 
-	m3ua_conn_send(link, aspac, &info);
+	m3ua_conn_send(asp, aspac, &info);
 	xua_msg_free(aspac);
 }
 
-static void m3ua_send_daud(struct mtp_m3ua_client_link *link, uint32_t dpc)
+static void m3ua_send_daud(struct mtp_m3ua_asp *asp, uint32_t dpc)
 {
 	struct sctp_sndrcvinfo info;
 	struct xua_msg *daud;
@@ -546,7 +779,7 @@ static void m3ua_send_daud(struct mtp_m3ua_client_link *link, uint32_t dpc)
 
 	daud = xua_msg_alloc();
 	if (!daud) {
-		fail_link(link);
+		fail_asp(asp);
 		return;
 	}
 
@@ -558,23 +791,23 @@ static void m3ua_send_daud(struct mtp_m3ua_client_link *link, uint32_t dpc)
 	daud->hdr.msg_class = M3UA_CLS_SSNM;
 	daud->hdr.msg_type = M3UA_SSNM_DAUD;
 
-	routing_ctx = htonl(link->routing_context);
+	routing_ctx = htonl(asp->link->routing_context);
 	xua_msg_add_data(daud, MUA_TAG_ROUTING_CTX, 4, (uint8_t *) &routing_ctx);
 
 	dpc = htonl(dpc);
 	xua_msg_add_data(daud, MUA_TAG_AFF_PC, 4, (uint8_t *) &dpc);
 
-	m3ua_conn_send(link, daud, &info);
+	m3ua_conn_send(asp, daud, &info);
 	xua_msg_free(daud);
 }
 
-static void m3ua_handle_aspsm(struct mtp_m3ua_client_link *link, struct xua_msg *m3ua)
+static void m3ua_handle_aspsm(struct mtp_m3ua_asp *asp, struct xua_msg *m3ua)
 {
 	switch (m3ua->hdr.msg_type) {
 	case M3UA_ASPSM_UP_ACK:
 		LOGP(DINP, LOGL_NOTICE, "Received ASP_UP_ACK.. sending ASPAC\n");
-		link->aspsm_active = 1;
-		m3ua_send_aspac(link);
+		asp->aspsm_active = 1;
+		m3ua_send_aspac(asp);
 		break;
 	default:
 		LOGP(DINP, LOGL_ERROR, "Unhandled msg_type %d\n",
@@ -583,17 +816,20 @@ static void m3ua_handle_aspsm(struct mtp_m3ua_client_link *link, struct xua_msg
 	}
 }
 
-static void m3ua_handle_asptm(struct mtp_m3ua_client_link *link, struct xua_msg *m3ua)
+static void m3ua_handle_asptm(struct mtp_m3ua_asp *asp, struct xua_msg *m3ua)
 {
+	struct mtp_link_set *set = asp->link->base->set;
+
 	switch (m3ua->hdr.msg_type) {
 	case M3UA_ASPTM_ACTIV_ACK:
-		LOGP(DINP, LOGL_NOTICE, "Received ASPAC_ACK.. taking link up\n");
-		osmo_timer_del(&link->aspac_ack_timer);
-		link->asptm_active = 1;
-		mtp_link_up(link->base);
-		m3ua_send_daud(link, link->base->set->dpc);
-		if (link->base->set->sccp_dpc != -1)
-			m3ua_send_daud(link, link->base->set->sccp_dpc);
+		LOGP(DINP, LOGL_NOTICE, "Received ASPAC_ACK on ASP %d.. taking it up\n",
+		     asp->nr);
+		osmo_timer_del(&asp->aspac_ack_timer);
+		asp->asptm_active = 1;
+		asp_update_active(asp->link);
+		m3ua_send_daud(asp, set->dpc);
+		if (set->sccp_dpc != -1)
+			m3ua_send_daud(asp, set->sccp_dpc);
 		break;
 	default:
 		LOGP(DINP, LOGL_ERROR, "Unhandled msg_type %d\n",
@@ -602,71 +838,55 @@ static void m3ua_handle_asptm(struct mtp_m3ua_client_link *link, struct xua_msg
 	}
 }
 
-static void m3ua_handle_trans(struct mtp_m3ua_client_link *link, struct xua_msg *m3ua)
+/*
+ * The label of the Protocol Data is passed on as it is and the user
+ * data stays in the received buffer. Returns MTP_MSG_CONSUMED if the
+ * MTP layer kept the msgb.
+ */
+static int m3ua_handle_trans(struct mtp_m3ua_asp *asp,
+			     struct xua_common_hdr *hdr, struct msgb *msg)
 {
-	struct msgb *msg;
-	struct xua_msg_part *data;
 	struct mtp_link *mtp_link;
 	struct m3ua_protocol_data *proto;
-	struct mtp_level_3_hdr *mtp_hdr;
 	uint32_t opc, dpc;
 	uint8_t sls, si;
+	uint16_t len;
 
-	mtp_link = link->base;
+	mtp_link = asp->link->base;
 
 	/* ignore everything if the link is blocked */
 	if (mtp_link->blocked)
-		return;
+		return 0;
 
-	if (m3ua->hdr.msg_type != M3UA_TRANS_DATA) {
+	if (hdr->msg_type != M3UA_TRANS_DATA) {
 		LOGP(DINP, LOGL_ERROR, "msg_type(%d) is not known. Ignoring\n",
-			m3ua->hdr.msg_type);
-		return;
+			hdr->msg_type);
+		return 0;
 	}
 
-	data = xua_msg_find_tag(m3ua, M3UA_TAG_PROTO_DATA);
-	if (!data) {
+	proto = (struct m3ua_protocol_data *)
+			xua_data_find_tag(hdr, M3UA_TAG_PROTO_DATA, &len);
+	if (!proto) {
 		LOGP(DINP, LOGL_ERROR, "No PROTO_DATA in DATA message.\n");
-		return;
-	}
-
-	if (data->len > 2048) {
-		LOGP(DINP, LOGL_ERROR, "TOO much data for us to handle.\n");
-		return;
+		return -1;
 	}
 
-	if (data->len < sizeof(struct m3ua_protocol_data)) {
+	if (len < sizeof(*proto)) {
 		LOGP(DINP, LOGL_ERROR, "Too little data..\n");
-		return;
-	}
-
-	msg = msgb_alloc(2048, "m3ua-data");
-	if (!msg) {
-		LOGP(DINP, LOGL_ERROR, "Failed to allocate storage.\n");
-		return;
+		return -1;
 	}
 
-	msg->l2h = msgb_put(msg, data->len);
-	memcpy(msg->l2h, data->dat, data->len);
-
-	proto = (struct m3ua_protocol_data *) msg->l2h;
 	opc = ntohl(proto->opc);
 	dpc = ntohl(proto->dpc);
 	sls = proto->sls;
 	si = proto->si;
 	LOGP(DINP, LOGL_DEBUG, "Got data for OPC(%d)/DPC(%d)/SLS(%d) len(%zu)\n",
-		opc, dpc, sls, msgb_l2len(msg) - sizeof(*proto));
+		opc, dpc, sls, len - sizeof(*proto));
 
-
-	/* put a MTP3 header in front */
+	msgb_trim(msg, (uint8_t *) proto + len - msg->data);
+	msg->l2h = (uint8_t *) proto;
 	msg->l3h = proto->data;
-	msgb_pull_to_l3(msg);
-	msg->l2h = msgb_push(msg, sizeof(*mtp_hdr));
-	mtp_hdr = (struct mtp_level_3_hdr *) msg->l2h;
-	mtp_hdr->ser_ind = si;
-	mtp_hdr->addr = MTP_ADDR(sls % 16, dpc, opc);
 
 	mtp_handle_pcap(mtp_link, NET_IN, msg->l2h, msgb_l2len(msg));
-	mtp_link_set_data(mtp_link, msg);
-	msgb_free(msg);
+	return mtp_link_set_user_data(mtp_link, msg, opc, dpc, sls, si);
 }
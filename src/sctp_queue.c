@@ -0,0 +1,237 @@
+/* SCTP write queue handling shared by M2UA and M3UA */
+/* (C) 2017 by Holger Hans Peter Freyther
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sctp_queue.h>
+#include <cellmgr_debug.h>
+#include <mtp_data.h>
+
+#include <osmocom/core/logging.h>
+#include <osmocom/core/msgb.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/sctp.h>
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+static unsigned long now_us(void)
+{
+	struct timespec tp;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &tp) != 0)
+		return 0;
+	return tp.tv_sec * 1000000UL + tp.tv_nsec / 1000;
+}
+
+static void update_congestion(struct osmo_wqueue *queue,
+			      struct sctp_queue_stats *stats)
+{
+	if (!stats->congested && queue->current_length >= stats->high_water) {
+		stats->congested = 1;
+		stats->onsets += 1;
+		LOGP(DINP, LOGL_NOTICE, "SCTP queue of fd %d is congested at %d.\n",
+		     queue->bfd.fd, queue->current_length);
+	} else if (stats->congested && queue->current_length <= stats->low_water) {
+		stats->congested = 0;
+		LOGP(DINP, LOGL_NOTICE, "SCTP queue of fd %d is no longer congested.\n",
+		     queue->bfd.fd);
+	}
+}
+
+void sctp_queue_cfg_init(struct sctp_queue_cfg *cfg)
+{
+	cfg->length = SCTP_QUEUE_LENGTH;
+	cfg->high_water = SCTP_QUEUE_HIGH_WATER;
+	cfg->low_water = SCTP_QUEUE_LOW_WATER;
+	cfg->batch = 1;
+	cfg->flush_delay = 0;
+}
+
+int sctp_queue_cfg_set(struct sctp_queue_cfg *cfg, int length, int high, int low)
+{
+	if (length <= 0 || high > length || low >= high)
+		return -1;
+
+	cfg->length = length;
+	cfg->high_water = high;
+	cfg->low_water = low;
+	return 0;
+}
+
+int sctp_queue_cfg_batch(struct sctp_queue_cfg *cfg, int batch, int flush_delay)
+{
+	if (batch < 1 || batch > SCTP_MAX_BATCH || flush_delay < 0)
+		return -1;
+
+	cfg->batch = batch;
+	cfg->flush_delay = flush_delay;
+	return 0;
+}
+
+static void flush_timeout(void *data)
+{
+	struct osmo_wqueue *queue = data;
+
+	if (!llist_empty(&queue->msg_queue))
+		queue->bfd.when |= BSC_FD_WRITE;
+}
+
+void sctp_queue_init(struct osmo_wqueue *queue, struct sctp_queue_stats *stats,
+		     const struct sctp_queue_cfg *cfg)
+{
+	osmo_wqueue_init(queue, cfg->length);
+	memset(stats, 0, sizeof(*stats));
+	stats->flush_timer.cb = flush_timeout;
+	stats->flush_timer.data = queue;
+	sctp_queue_configure(queue, stats, cfg);
+}
+
+/* messages beyond a shorter length stay queued, only new ones are refused */
+void sctp_queue_configure(struct osmo_wqueue *queue, struct sctp_queue_stats *stats,
+			  const struct sctp_queue_cfg *cfg)
+{
+	queue->max_length = cfg->length;
+	stats->high_water = cfg->high_water;
+	stats->low_water = cfg->low_water;
+	stats->batch = cfg->batch;
+	stats->flush_delay = cfg->flush_delay;
+	update_congestion(queue, stats);
+}
+
+/* before the queue is freed */
+void sctp_queue_stop(struct osmo_wqueue *queue, struct sctp_queue_stats *stats)
+{
+	osmo_timer_del(&stats->flush_timer);
+}
+
+int sctp_queue_enqueue(struct osmo_wqueue *queue, struct sctp_queue_stats *stats,
+		       struct msgb *msg)
+{
+	int writing = queue->bfd.when & BSC_FD_WRITE;
+
+	if (osmo_wqueue_enqueue(queue, msg) != 0) {
+		stats->dropped += 1;
+		return -1;
+	}
+
+	SCTP_QUEUE_CB(msg) = now_us();
+	update_congestion(queue, stats);
+
+	/* hold the write back until the batch is full or the delay is over */
+	if (stats->flush_delay > 0 && !writing) {
+		if (queue->current_length < stats->batch) {
+			queue->bfd.when &= ~BSC_FD_WRITE;
+			if (!osmo_timer_pending(&stats->flush_timer))
+				osmo_timer_schedule(&stats->flush_timer, 0,
+						    stats->flush_delay * 1000);
+		} else {
+			osmo_timer_del(&stats->flush_timer);
+		}
+	}
+
+	return 0;
+}
+
+static void queue_sent(struct osmo_wqueue *queue, struct sctp_queue_stats *stats,
+		     struct msgb *msg)
+{
+	unsigned long delay = (now_us() - SCTP_QUEUE_CB(msg)) / 1000;
+	int bucket = 0;
+
+	while (bucket < SCTP_QUEUE_DELAY_BUCKETS - 1 && delay >= (1UL << bucket))
+		bucket += 1;
+
+	stats->delay[bucket] += 1;
+	if (delay > stats->max_delay)
+		stats->max_delay = delay;
+
+	update_congestion(queue, stats);
+}
+
+int sctp_queue_flush(struct osmo_wqueue *queue, struct sctp_queue_stats *stats)
+{
+	char cmsgs[SCTP_MAX_BATCH][CMSG_SPACE(sizeof(struct sctp_sndrcvinfo))];
+	struct mmsghdr msgs[SCTP_MAX_BATCH];
+	struct iovec iov[SCTP_MAX_BATCH];
+	struct msgb *queued[SCTP_MAX_BATCH];
+	struct cmsghdr *cmsg;
+	struct msgb *msg;
+	int i, nr, rc, batch;
+
+	batch = stats->batch;
+	if (batch < 1 || batch > SCTP_MAX_BATCH)
+		batch = 1;
+
+	nr = 0;
+	memset(msgs, 0, sizeof(msgs[0]) * batch);
+	llist_for_each_entry(msg, &queue->msg_queue, list) {
+		if (nr == batch)
+			break;
+
+		iov[nr].iov_base = msg->l2h;
+		iov[nr].iov_len = msgb_l2len(msg);
+		msgs[nr].msg_hdr.msg_iov = &iov[nr];
+		msgs[nr].msg_hdr.msg_iovlen = 1;
+		msgs[nr].msg_hdr.msg_control = cmsgs[nr];
+		msgs[nr].msg_hdr.msg_controllen = sizeof(cmsgs[nr]);
+
+		cmsg = CMSG_FIRSTHDR(&msgs[nr].msg_hdr);
+		cmsg->cmsg_level = IPPROTO_SCTP;
+		cmsg->cmsg_type = SCTP_SNDRCV;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(struct sctp_sndrcvinfo));
+		memcpy(CMSG_DATA(cmsg), msg->data, sizeof(struct sctp_sndrcvinfo));
+		queued[nr++] = msg;
+	}
+
+	if (nr == 0) {
+		queue->bfd.when &= ~BSC_FD_WRITE;
+		return 0;
+	}
+
+	rc = sendmmsg(queue->bfd.fd, msgs, nr, 0);
+	if (rc < 0) {
+		if (errno == EAGAIN)
+			return 0;
+
+		/* give up on the first message like a failed sctp_send */
+		LOGP(DINP, LOGL_ERROR, "Failed to send %d.\n", errno);
+		rc = 1;
+	}
+
+	for (i = 0; i < rc; ++i) {
+		msg = queued[i];
+		llist_del(&msg->list);
+		queue->current_length -= 1;
+		queue_sent(queue, stats, msg);
+		msgb_free(msg);
+	}
+
+	if (llist_empty(&queue->msg_queue))
+		queue->bfd.when &= ~BSC_FD_WRITE;
+	return rc;
+}
+
+int sctp_queue_room(struct osmo_wqueue *queue, struct sctp_queue_stats *stats)
+{
+	/* the queue might have been cleared behind our back */
+	update_congestion(queue, stats);
+	if (stats->congested)
+		return 0;
+	return mtp_wqueue_room(queue);
+}
@@ -0,0 +1,58 @@
+/* SCTP stream handling shared by M2UA and M3UA */
+/* (C) 2017 by Holger Hans Peter Freyther
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sctp_streams.h>
+#include <cellmgr_debug.h>
+
+#include <osmocom/core/logging.h>
+
+#include <netinet/in.h>
+#include <netinet/sctp.h>
+
+#include <string.h>
+
+int sctp_streams_request(int fd, int nr_streams)
+{
+	struct sctp_initmsg init;
+
+	memset(&init, 0, sizeof(init));
+	init.sinit_num_ostreams = nr_streams;
+	init.sinit_max_instreams = nr_streams;
+
+	if (setsockopt(fd, IPPROTO_SCTP, SCTP_INITMSG, &init, sizeof(init)) != 0) {
+		LOGP(DINP, LOGL_ERROR, "Failed to request %d SCTP streams.\n", nr_streams);
+		return -1;
+	}
+
+	return 0;
+}
+
+int sctp_streams_outbound(int fd)
+{
+	struct sctp_status status;
+	socklen_t len = sizeof(status);
+
+	memset(&status, 0, sizeof(status));
+	if (getsockopt(fd, IPPROTO_SCTP, SCTP_STATUS, &status, &len) != 0) {
+		LOGP(DINP, LOGL_ERROR, "Failed to query the SCTP status.\n");
+		return 1;
+	}
+
+	if (status.sstat_outstrms == 0)
+		return 1;
+	return status.sstat_outstrms;
+}
@@ -32,61 +32,67 @@
 #include <osmocom/core/talloc.h>
 
 
-/* the SS7 dispatch... maybe as function pointers in the future */
-static void forward_sccp_stp(struct mtp_link_set *set, struct msgb *_msg, int sls)
+/*
+ * the SS7 dispatch... maybe as function pointers in the future
+ *
+ * In STP mode the received msgb is relayed as it is and the routing
+ * label is rewritten in place, see mtp_link_set_relay_sccp_data.
+ */
+static int forward_sccp_stp(struct mtp_link_set *set, struct msgb *_msg, int sls)
 {
 	struct mtp_link_set *other;
 	other = set->app->route_src.set == set ?
 			set->app->route_dst.set : set->app->route_src.set;
-	mtp_link_set_submit_sccp_data(other, sls, _msg->l2h, msgb_l2len(_msg));
+	return mtp_link_set_relay_sccp_data(other, sls, _msg, _msg->l2h);
 }
 
-static void forward_isup_stp(struct mtp_link_set *set, struct msgb *msg, int sls)
+static int forward_isup_stp(struct mtp_link_set *set, struct msgb *msg, int sls)
 {
 	struct mtp_link_set *other;
 	other = set->app->route_src.set == set ?
 			set->app->route_dst.set : set->app->route_src.set;
 	isup_scan_for_reset(set->app, msg);
-	mtp_link_set_submit_isup_data(other, sls, msg->l3h, msgb_l3len(msg));
+	return mtp_link_set_relay_isup_data(other, sls, msg, msg->l3h);
 }
 
-void mtp_link_set_forward_sccp(struct mtp_link_set *set, struct msgb *_msg, int sls)
+int mtp_link_set_forward_sccp(struct mtp_link_set *set, struct msgb *_msg, int sls)
 {
 	if (!set->app) {
 		LOGP(DINP, LOGL_ERROR, "Linkset %d/%s has no application.\n",
 		     set->nr, set->name);
-		return;
+		return -1;
 	}
 
 	switch (set->app->type) {
 	case APP_STP:
-		forward_sccp_stp(set, _msg, sls);
-		break;
+		return forward_sccp_stp(set, _msg, sls);
 	case APP_CELLMGR:
 	case APP_RELAY:
-		app_forward_sccp(set->app, _msg, sls);
-		break;
+		return app_forward_sccp(set->app, _msg, sls);
 	}
+
+	return 0;
 }
 
-void mtp_link_set_forward_isup(struct mtp_link_set *set, struct msgb *msg, int sls)
+int mtp_link_set_forward_isup(struct mtp_link_set *set, struct msgb *msg, int sls)
 {
 	if (!set->app) {
 		LOGP(DINP, LOGL_ERROR, "Linkset %d/%s has no application.\n",
 		     set->nr, set->name);
-		return;
+		return -1;
 	}
 
 
 	switch (set->app->type) {
 	case APP_STP:
-		forward_isup_stp(set, msg, sls);
-		break;
+		return forward_isup_stp(set, msg, sls);
 	case APP_CELLMGR:
 	case APP_RELAY:
 		LOGP(DINP, LOGL_ERROR, "ISUP is not handled.\n");
 		break;
 	}
+
+	return 0;
 }
 
 void mtp_linkset_down(struct mtp_link_set *set)
@@ -103,11 +109,15 @@ void mtp_linkset_down(struct mtp_link_set *set)
 		else
 			set->app->route_dst.up = 0;
 	} else {
+		int i;
+
 		app_clear_connections(set->app);
 
-		/* If we have an A link send a reset to the MSC */
-		msc_mgcp_reset(set->app->route_dst.msc);
-		msc_send_reset(set->app->route_dst.msc);
+		/* If we have an A link send a reset to the MSCs */
+		for (i = 0; i < set->app->nr_mscs; ++i) {
+			msc_mgcp_reset(set->app->mscs[i]);
+			msc_send_reset(set->app->mscs[i]);
+		}
 	}
 }
 
@@ -123,7 +133,7 @@ void mtp_linkset_up(struct mtp_link_set *set)
 			else
 				set->app->route_dst.up = 1;
 		} else if (set->app->type != APP_STP &&
-			   set->app->route_dst.msc->msc_link_down) {
+			   app_mscs_up(set->app) == 0) {
 			app_clear_connections(set->app);
 			app_resources_released(set->app);
 		}
@@ -144,6 +154,14 @@ struct ss7_application *ss7_application_alloc(struct bsc_data *bsc)
 	}
 
 	INIT_LLIST_HEAD(&app->sccp_connections);
+	INIT_LLIST_HEAD(&app->con_free);
+	app->con_pool_size = SCCP_CON_POOL_SIZE;
+	if (sccp_con_table_init(app) != 0) {
+		LOGP(DINP, LOGL_ERROR, "Failed to create the connection table.\n");
+		talloc_free(app);
+		return NULL;
+	}
+
 	llist_add_tail(&app->entry, &bsc->apps);
 	app->nr = bsc->num_apps++;
 	app->bsc = bsc;
@@ -304,6 +322,8 @@ static int ss7_app_setup_relay(struct ss7_application *app, int type,
 	app->route_dst.nr = dst_num;
 	app->route_dst.set = NULL;
 	app->route_dst.msc = msc;
+	app->mscs[0] = msc;
+	app->nr_mscs = 1;
 
 	app->type = type;
 	app->bsc->m2ua_trans->started = 1;
@@ -332,6 +352,45 @@ int ss7_application_setup(struct ss7_application *ss7, int type,
 	}
 }
 
+int ss7_application_add_msc(struct ss7_application *app, int msc_num)
+{
+	struct msc_connection *msc;
+
+	if (!app->route_is_set || app->route_dst.type != SS7_SET_MSC) {
+		LOGP(DINP, LOGL_ERROR,
+		     "SS7 %d/%s needs to be routed to a MSC first.\n",
+		     app->nr, app->name);
+		return -1;
+	}
+
+	if (app->nr_mscs >= APP_MAX_MSCS) {
+		LOGP(DINP, LOGL_ERROR,
+		     "SS7 %d/%s has already %d MSCs.\n",
+		     app->nr, app->name, app->nr_mscs);
+		return -2;
+	}
+
+	msc = msc_connection_num(app->bsc, msc_num);
+	if (!msc) {
+		LOGP(DINP, LOGL_ERROR,
+		     "SS7 %d/%s dest MSC not found with nr: %d.\n",
+		     app->nr, app->name, msc_num);
+		return -4;
+	}
+
+	if (msc->app) {
+		LOGP(DINP, LOGL_ERROR,
+		     "SS7 %d/%s is using MSC connection %d/%s\n",
+		      msc->app->nr, msc->app->name,
+		      msc->nr, msc->name);
+		return -5;
+	}
+
+	msc->app = app;
+	app->mscs[app->nr_mscs++] = msc;
+	return 0;
+}
+
 static void start_mtp(struct mtp_link_set *set)
 {
 	struct mtp_link *link;
@@ -377,12 +436,22 @@ static void shutdown_set(struct mtp_link_set *set)
 
 int ss7_application_start(struct ss7_application *app)
 {
+	int i;
+
 	if (!app->route_is_set) {
 		LOGP(DINP, LOGL_ERROR,
 		     "The routes are not configured on app %d.\n", app->nr);
 		return -1;
 	}
 
+	if ((app->type == APP_CELLMGR || app->type == APP_RELAY)
+	    && sccp_con_pool_init(app, app->con_pool_size) != 0) {
+		LOGP(DINP, LOGL_ERROR,
+		     "Failed to allocate %d connections on app %d.\n",
+		     app->con_pool_size, app->nr);
+		return -1;
+	}
+
 	prepare_set(app, app->route_src.set);
 	prepare_set(app, app->route_dst.set);
 	if (!app->force_down) {
@@ -392,8 +461,8 @@ int ss7_application_start(struct ss7_application *app)
 
 	if (app->route_src.msc)
 		start_msc(app->route_src.msc);
-	if (app->route_dst.msc)
-		start_msc(app->route_dst.msc);
+	for (i = 0; i < app->nr_mscs; ++i)
+		start_msc(app->mscs[i]);
 
 	LOGP(DINP, LOGL_NOTICE, "SS7 Application %d/%s is now running.\n",
 	     app->nr, app->name);
@@ -421,9 +490,7 @@ void mtp_link_submit(struct mtp_link *link, struct msgb *msg)
 		}
 	}
 
-	rate_ctr_inc(&link->ctrg->ctr[MTP_LNK_OUT]);
-	rate_ctr_inc(&link->set->ctrg->ctr[MTP_LSET_TOTA_OUT_MSG]);
-	link->write(link, msg);
+	mtp_link_tx(link, msg);
 }
 
 int mtp_link_set_data(struct mtp_link *link, struct msgb *msg)
@@ -439,6 +506,20 @@ int mtp_link_set_data(struct mtp_link *link, struct msgb *msg)
 	return mtp_link_handle_data(link, msg);
 }
 
+int mtp_link_set_user_data(struct mtp_link *link, struct msgb *msg,
+			   int opc, int dpc, int sls, int si)
+{
+	if (link->set->app && link->set->app->type == APP_STP) {
+		if (!link->set->app->route_src.up || !link->set->app->route_dst.up) {
+			LOGP(DINP, LOGL_NOTICE, "Not handling data as application is down %d/%s.\n",
+			     link->set->app->nr, link->set->app->name);
+			return -1;
+		}
+	}
+
+	return mtp_link_handle_user_data(link, msg, opc, dpc, sls, si);
+}
+
 int ss7_application_mgcp_domain_name(struct ss7_application *app,
 				     const char *name)
 {
@@ -469,6 +550,10 @@ int ss7_application_msc_down(struct ss7_application *app)
 {
 	if (!app->force_down)
 		return 0;
+
+	/* the rest of the pool is still serving */
+	if (app_mscs_up(app) > 0)
+		return 0;
 	shutdown_set(app->route_src.set);
 	shutdown_set(app->route_dst.set);
 	return 0;
@@ -20,6 +20,7 @@
  */
 
 #include <bsc_data.h>
+#include <bsc_sccp.h>
 #include <mtp_pcap.h>
 #include <msc_connection.h>
 #include <sctp_m2ua.h>
@@ -124,7 +125,22 @@ static int config_write_ss7(struct vty *vty)
 {
 	vty_out(vty, "ss7%s", VTY_NEWLINE);
 	vty_out(vty, " udp src-port %d%s", bsc->udp_src_port, VTY_NEWLINE);
+	if (bsc->udp_data.rx_batch > 1)
+		vty_out(vty, " udp receive-batch %d%s",
+			bsc->udp_data.rx_batch, VTY_NEWLINE);
+	if (bsc->udp_data.tx_batch > 1)
+		vty_out(vty, " udp send-batch %d%s",
+			bsc->udp_data.tx_batch, VTY_NEWLINE);
 	vty_out(vty, " m2ua src-port %d%s", bsc->m2ua_src_port, VTY_NEWLINE);
+	vty_out(vty, " m2ua write-queue %d high-water %d low-water %d%s",
+		bsc->m2ua_trans->queue_cfg.length,
+		bsc->m2ua_trans->queue_cfg.high_water,
+		bsc->m2ua_trans->queue_cfg.low_water, VTY_NEWLINE);
+	if (bsc->m2ua_trans->queue_cfg.batch > 1
+	    || bsc->m2ua_trans->queue_cfg.flush_delay > 0)
+		vty_out(vty, " m2ua write-batch %d flush-delay %d%s",
+			bsc->m2ua_trans->queue_cfg.batch,
+			bsc->m2ua_trans->queue_cfg.flush_delay, VTY_NEWLINE);
 	return CMD_SUCCESS;
 }
 
@@ -133,10 +149,15 @@ static void write_link(struct vty *vty, struct mtp_link *link)
 	struct mtp_udp_link *ulnk;
 	struct mtp_m2ua_link *m2ua;
 	struct mtp_m3ua_client_link *m3ua_client;
+	struct mtp_m3ua_asp *asp;
 
 	vty_out(vty, "  link %d%s", link->nr, VTY_NEWLINE);
 	if (link->name && strlen(link->name) > 0)
 		vty_out(vty, "   description %s%s", link->name, VTY_NEWLINE);
+	if (link->weight != 1)
+		vty_out(vty, "   mtp3 weight %d%s", link->weight, VTY_NEWLINE);
+	if (link->tx_max != MTP_TX_QUEUE_SIZE)
+		vty_out(vty, "   mtp3 tx-queue-size %d%s", link->tx_max, VTY_NEWLINE);
 
 	switch (link->type) {
 	case SS7_LTYPE_UDP:
@@ -168,10 +189,19 @@ static void write_link(struct vty *vty, struct mtp_link *link)
 			inet_ntoa(m3ua_client->local.sin_addr), VTY_NEWLINE);
 		vty_out(vty, "   m3ua-client source port %d%s",
 			ntohs(m3ua_client->local.sin_port), VTY_NEWLINE);
-		vty_out(vty, "   m3ua-client dest ip %s%s",
-			inet_ntoa(m3ua_client->remote.sin_addr), VTY_NEWLINE);
-		vty_out(vty, "   m3ua-client dest port %d%s",
-			ntohs(m3ua_client->remote.sin_port), VTY_NEWLINE);
+		llist_for_each_entry(asp, &m3ua_client->asps, entry) {
+			if (asp->nr == 0) {
+				vty_out(vty, "   m3ua-client dest ip %s%s",
+					inet_ntoa(asp->remote.sin_addr), VTY_NEWLINE);
+				vty_out(vty, "   m3ua-client dest port %d%s",
+					ntohs(asp->remote.sin_port), VTY_NEWLINE);
+				continue;
+			}
+
+			vty_out(vty, "   m3ua-client asp %d dest ip %s port %d%s",
+				asp->nr, inet_ntoa(asp->remote.sin_addr),
+				ntohs(asp->remote.sin_port), VTY_NEWLINE);
+		}
 		vty_out(vty, "   m3ua-client link-index %d%s",
 				m3ua_client->link_index, VTY_NEWLINE);
 		vty_out(vty, "   m3ua-client routing-context %d%s",
@@ -181,6 +211,15 @@ static void write_link(struct vty *vty, struct mtp_link *link)
 				VTY_NEWLINE);
 		vty_out(vty, "   m3ua-client link-up-timeout %d%s",
 				m3ua_client->aspac_ack_timeout, VTY_NEWLINE);
+		vty_out(vty, "   m3ua-client write-queue %d high-water %d low-water %d%s",
+				m3ua_client->queue_cfg.length,
+				m3ua_client->queue_cfg.high_water,
+				m3ua_client->queue_cfg.low_water, VTY_NEWLINE);
+		if (m3ua_client->queue_cfg.batch > 1
+		    || m3ua_client->queue_cfg.flush_delay > 0)
+			vty_out(vty, "   m3ua-client write-batch %d flush-delay %d%s",
+				m3ua_client->queue_cfg.batch,
+				m3ua_client->queue_cfg.flush_delay, VTY_NEWLINE);
 		break;
 	case SS7_LTYPE_NONE:
 		break;
@@ -190,6 +229,7 @@ static void write_link(struct vty *vty, struct mtp_link *link)
 static void write_linkset(struct vty *vty, struct mtp_link_set *set)
 {
 	struct mtp_link *link;
+	struct mtp_route *route;
 	int i;
 
 	vty_out(vty, " linkset %d%s", set->nr, VTY_NEWLINE);
@@ -204,6 +244,8 @@ static void write_linkset(struct vty *vty, struct mtp_link_set *set)
 		set->timeout_t18, VTY_NEWLINE);
 	vty_out(vty, "  mtp3 timeout t20 %d%s",
 		set->timeout_t20, VTY_NEWLINE);
+	vty_out(vty, "  mtp3 restart tfx-batch %d%s",
+		set->restart.tfx_batch, VTY_NEWLINE);
 	if (set->sccp_dpc != -1)
 		vty_out(vty, "  mtp3 sccp dpc %d%s", set->sccp_dpc, VTY_NEWLINE);
 	if (set->sccp_opc != -1)
@@ -219,6 +261,10 @@ static void write_linkset(struct vty *vty, struct mtp_link_set *set)
 		vty_out(vty, "  mtp3 ssn %d%s", i, VTY_NEWLINE);
 	}
 
+	llist_for_each_entry(route, &set->routes, set_entry)
+		vty_out(vty, "  route dpc %d priority %d%s",
+			route->dest->dpc, route->priority, VTY_NEWLINE);
+
 	llist_for_each_entry(link, &set->links, entry)
 		write_link(vty, link);
 }
@@ -250,6 +296,11 @@ static void write_msc(struct vty *vty, struct msc_connection *msc)
 		vty_out(vty, "  timeout pong %d%s", msc->pong_time, VTY_NEWLINE);
 	}
 	vty_out(vty, "  timeout restart %d%s", msc->msc_time, VTY_NEWLINE);
+	if (msc->tx_coalesce > 0)
+		vty_out(vty, "  tx-coalesce %d%s", msc->tx_coalesce, VTY_NEWLINE);
+	if (msc->replay_max_bytes > 0)
+		vty_out(vty, "  replay-buffer %d max-age %d%s",
+			msc->replay_max_bytes, msc->replay_max_age, VTY_NEWLINE);
 }
 
 static int config_write_msc(struct vty *vty)
@@ -293,6 +344,8 @@ static const char *link_type(enum ss7_set_type type)
 
 static void write_application(struct vty *vty, struct ss7_application *app)
 {
+	int i;
+
 	vty_out(vty, " application %d%s", app->nr, VTY_NEWLINE);
 	if (app->name && strlen(app->name) > 0)
 		vty_out(vty, "  description %s%s", app->name, VTY_NEWLINE);
@@ -318,12 +371,19 @@ static void write_application(struct vty *vty, struct ss7_application *app)
 			link_type(app->route_src.type), app->route_src.nr,
 			link_type(app->route_dst.type), app->route_dst.nr,
 			VTY_NEWLINE);
+		for (i = 1; i < app->nr_mscs; ++i)
+			vty_out(vty, "  pool msc %d%s",
+				app->mscs[i]->nr, VTY_NEWLINE);
 	}
 	if (app->forward_only)
 		vty_out(vty, "  forward-only%s", VTY_NEWLINE);
 
 	if (app->force_down)
 		vty_out(vty, "  on-msc-down-force-down%s", VTY_NEWLINE);
+
+	if (app->con_pool_size != SCCP_CON_POOL_SIZE)
+		vty_out(vty, "  connection-pool-size %d%s",
+			app->con_pool_size, VTY_NEWLINE);
 }
 
 static int config_write_app(struct vty *vty)
@@ -353,6 +413,26 @@ DEFUN(cfg_ss7_udp_src_port, cfg_ss7_udp_src_port_cmd,
 	return CMD_SUCCESS;
 }
 
+DEFUN(cfg_ss7_udp_rx_batch, cfg_ss7_udp_rx_batch_cmd,
+      "udp receive-batch <1-64>",
+      "UDP related commands\n"
+      "Number of datagrams to read per wakeup\n"
+      "Number of datagrams\n")
+{
+	bsc->udp_data.rx_batch = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_ss7_udp_tx_batch, cfg_ss7_udp_tx_batch_cmd,
+      "udp send-batch <1-64>",
+      "UDP related commands\n"
+      "Number of queued datagrams to send per wakeup\n"
+      "Number of datagrams\n")
+{
+	bsc->udp_data.tx_batch = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
 DEFUN(cfg_ss7_m2ua_src_port, cfg_ss7_m2ua_src_port_cmd,
       "m2ua src-port <1-65535>",
       "M2UA related commands\n"
@@ -363,6 +443,46 @@ DEFUN(cfg_ss7_m2ua_src_port, cfg_ss7_m2ua_src_port_cmd,
 	return CMD_SUCCESS;
 }
 
+#define WRITE_QUEUE_STR \
+	"Write queue of the SCTP association\n" "Messages\n"	\
+	"Congestion onset\n" "Messages\n"				\
+	"Congestion abatement\n" "Messages\n"
+
+DEFUN(cfg_ss7_m2ua_write_queue, cfg_ss7_m2ua_write_queue_cmd,
+      "m2ua write-queue <1-4096> high-water <1-4096> low-water <0-4095>",
+      "M2UA related commands\n" WRITE_QUEUE_STR)
+{
+	struct sctp_m2ua_conn *conn;
+	struct sctp_queue_cfg *cfg = &bsc->m2ua_trans->queue_cfg;
+
+	if (sctp_queue_cfg_set(cfg, atoi(argv[0]), atoi(argv[1]), atoi(argv[2])) != 0) {
+		vty_out(vty, "%%The high-water needs to be above the low-water and within the queue.%s",
+			VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	llist_for_each_entry(conn, &bsc->m2ua_trans->conns, entry)
+		sctp_queue_configure(&conn->queue, &conn->queue_stats, cfg);
+	return CMD_SUCCESS;
+}
+
+#define WRITE_BATCH_STR \
+	"Queued messages to send per wakeup\n" "Messages\n"		\
+	"Time the first message may wait for the batch\n" "Milliseconds\n"
+
+DEFUN(cfg_ss7_m2ua_write_batch, cfg_ss7_m2ua_write_batch_cmd,
+      "m2ua write-batch <1-64> flush-delay <0-1000>",
+      "M2UA related commands\n" WRITE_BATCH_STR)
+{
+	struct sctp_m2ua_conn *conn;
+	struct sctp_queue_cfg *cfg = &bsc->m2ua_trans->queue_cfg;
+
+	sctp_queue_cfg_batch(cfg, atoi(argv[0]), atoi(argv[1]));
+	llist_for_each_entry(conn, &bsc->m2ua_trans->conns, entry)
+		sctp_queue_configure(&conn->queue, &conn->queue_stats, cfg);
+	return CMD_SUCCESS;
+}
+
 DEFUN(cfg_ss7_linkset, cfg_ss7_linkset_cmd,
       "linkset <0-100>",
       "Linkset commands\n" "Linkset number\n")
@@ -474,6 +594,16 @@ DEFUN(cfg_linkset_t20, cfg_linkset_t20_cmd,
 	return CMD_SUCCESS;
 }
 
+DEFUN(cfg_linkset_tfx_batch, cfg_linkset_tfx_batch_cmd,
+      "mtp3 restart tfx-batch <1-1024>",
+      "MTP Level3\n" "MTP Restart\n"
+      "TFA/TFP to send per main loop iteration\n" "Number of messages\n")
+{
+	struct mtp_link_set *set = vty->index;
+	set->restart.tfx_batch = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
 DEFUN(cfg_linkset_mtp3_isup_opc, cfg_linkset_mtp3_isup_opc_cmd,
       "mtp3 isup opc <0-8191>",
       "MTP Level3\n" "ISUP Commands\n" "OPC\n" "OPC Number\n")
@@ -546,6 +676,35 @@ DEFUN(cfg_linkset_no_mtp3_sccp_dpc, cfg_linkset_no_mtp3_sccp_dpc_cmd,
 	return CMD_SUCCESS;
 }
 
+DEFUN(cfg_linkset_route, cfg_linkset_route_cmd,
+      "route dpc <0-8191> priority <0-255>",
+      "MTP3 Route\n" "Destination Point Code\n" "Point Code\n"
+      "Priority of the route\n" "Priority, zero is preferred\n")
+{
+	struct mtp_link_set *set = vty->index;
+
+	if (mtp_route_add(&bsc->routes, atoi(argv[0]), set, atoi(argv[1])) != 0) {
+		vty_out(vty, "%%Failed to add the route.%s", VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_linkset_no_route, cfg_linkset_no_route_cmd,
+      "no route dpc <0-8191>",
+      NO_STR "MTP3 Route\n" "Destination Point Code\n" "Point Code\n")
+{
+	struct mtp_link_set *set = vty->index;
+
+	if (mtp_route_del(&bsc->routes, atoi(argv[0]), set) != 0) {
+		vty_out(vty, "%%No such route on this linkset.%s", VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	return CMD_SUCCESS;
+}
+
 DEFUN(cfg_linkset_link, cfg_linkset_link_cmd,
       "link <0-100>",
       "Link\n" "Link number\n")
@@ -577,6 +736,27 @@ DEFUN(cfg_linkset_link, cfg_linkset_link_cmd,
 	return CMD_SUCCESS;
 }
 
+DEFUN(cfg_link_weight, cfg_link_weight_cmd,
+      "mtp3 weight <1-16>",
+      "MTP Level3\n" "Share of the SLS compared to the other links\n" "Weight\n")
+{
+	struct mtp_link *link = vty->index;
+
+	link->weight = atoi(argv[0]);
+	mtp_link_set_init_slc(link->set);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_link_tx_queue, cfg_link_tx_queue_cmd,
+      "mtp3 tx-queue-size <16-65535>",
+      "MTP Level3\n" "Messages to queue when the transport is busy\n" "Size\n")
+{
+	struct mtp_link *link = vty->index;
+
+	link->tx_max = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
 DEFUN(cfg_link_ss7_transport, cfg_link_ss7_transport_cmd,
       "ss7-transport (none|udp|m2ua|m3ua-client)",
       "SS7 transport for the link\n"
@@ -705,7 +885,7 @@ DEFUN(cfg_link_udp_link_index, cfg_link_udp_link_index_cmd,
 	}
 
 	ulnk = link->data;
-	ulnk->link_index = atoi(argv[0]);
+	mtp_udp_link_set_index(ulnk, atoi(argv[0]));
 	return CMD_SUCCESS;
 }
 
@@ -741,7 +921,7 @@ DEFUN(cfg_link_m2ua_link_index, cfg_link_m2ua_link_index_cmd,
 	}
 
 	m2ua = link->data;
-	m2ua->link_index = atoi(argv[0]);
+	mtp_m2ua_link_set_index(m2ua, atoi(argv[0]));
 	return CMD_SUCCESS;
 }
 
@@ -791,12 +971,26 @@ DEFUN(cfg_link_m3ua_client_source_port, cfg_link_m3ua_client_source_port_cmd,
 	return CMD_SUCCESS;
 }
 
+static int m3ua_asp_dest(struct vty *vty, struct mtp_m3ua_asp *asp, const char *host)
+{
+	struct hostent *hosts;
+
+	talloc_free(asp->dest);
+	asp->dest = talloc_strdup(asp, host);
+
+	hosts = gethostbyname(asp->dest);
+	if (!hosts || hosts->h_length < 1 || hosts->h_addrtype != AF_INET) {
+		vty_out(vty, "Failed to resolve '%s'%s", host, VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	asp->remote.sin_addr = * (struct in_addr *) hosts->h_addr_list[0];
+	return CMD_SUCCESS;
+}
+
 DEFUN(cfg_link_m3ua_client_dest_ip, cfg_link_m3ua_client_dest_ip_cmd,
 	"m3ua-client dest ip HOST_NAME",
 	"M3UA Client\n" "Destination Address\n" "IP\n" "Hostname or IPv4 address\n")
 {
-	struct hostent *hosts;
-
 	struct mtp_link *link = vty->index;
 	struct mtp_m3ua_client_link *m3ua_link;
 
@@ -806,25 +1000,35 @@ DEFUN(cfg_link_m3ua_client_dest_ip, cfg_link_m3ua_client_dest_ip_cmd,
 	}
 
 	m3ua_link = link->data;
+	return m3ua_asp_dest(vty, mtp_m3ua_client_asp_num(m3ua_link, 0), argv[0]);
+}
 
-	talloc_free(m3ua_link->dest);
-	m3ua_link->dest = talloc_strdup(m3ua_link, argv[0]);
+DEFUN(cfg_link_m3ua_client_dest_port, cfg_link_m3ua_client_dest_port_cmd,
+	"m3ua-client dest port <1-65535>",
+	"M3UA Client\n" "Destination Address\n" "Port\n" "Number\n")
+{
+	struct mtp_link *link = vty->index;
+	struct mtp_m3ua_client_link *m3ua_link;
 
-	hosts = gethostbyname(m3ua_link->dest);
-	if (!hosts || hosts->h_length < 1 || hosts->h_addrtype != AF_INET) {
-		vty_out(vty, "Failed to resolve '%s'%s", argv[0], VTY_NEWLINE);
+	if (link->type != SS7_LTYPE_M3UA_CLIENT) {
+		vty_out(vty, "%%This only applies to M3UA client links.%s", VTY_NEWLINE);
 		return CMD_WARNING;
 	}
-	m3ua_link->remote.sin_addr = * (struct in_addr *) hosts->h_addr_list[0];
+
+	m3ua_link = link->data;
+	mtp_m3ua_client_asp_num(m3ua_link, 0)->remote.sin_port = htons(atoi(argv[0]));
 	return CMD_SUCCESS;
 }
 
-DEFUN(cfg_link_m3ua_client_dest_port, cfg_link_m3ua_client_dest_port_cmd,
-	"m3ua-client dest port <1-65535>",
-	"M3UA Client\n" "Destination Address\n" "Port\n" "Number\n")
+DEFUN(cfg_link_m3ua_client_asp, cfg_link_m3ua_client_asp_cmd,
+	"m3ua-client asp <1-7> dest ip HOST_NAME port <1-65535>",
+	"M3UA Client\n" "Additional association\n" "Number\n"
+	"Destination Address\n" "IP\n" "Hostname or IPv4 address\n"
+	"Port\n" "Number\n")
 {
 	struct mtp_link *link = vty->index;
 	struct mtp_m3ua_client_link *m3ua_link;
+	struct mtp_m3ua_asp *asp;
 
 	if (link->type != SS7_LTYPE_M3UA_CLIENT) {
 		vty_out(vty, "%%This only applies to M3UA client links.%s", VTY_NEWLINE);
@@ -832,7 +1036,38 @@ DEFUN(cfg_link_m3ua_client_dest_port, cfg_link_m3ua_client_dest_port_cmd,
 	}
 
 	m3ua_link = link->data;
-	m3ua_link->remote.sin_port = htons(atoi(argv[0]));
+	asp = mtp_m3ua_client_asp_num(m3ua_link, atoi(argv[0]));
+	if (!asp) {
+		asp = mtp_m3ua_client_asp_alloc(m3ua_link, atoi(argv[0]));
+		if (!asp) {
+			vty_out(vty, "%%Failed to allocate the ASP.%s", VTY_NEWLINE);
+			return CMD_WARNING;
+		}
+	}
+
+	asp->remote.sin_port = htons(atoi(argv[2]));
+	return m3ua_asp_dest(vty, asp, argv[1]);
+}
+
+DEFUN(cfg_link_no_m3ua_client_asp, cfg_link_no_m3ua_client_asp_cmd,
+	"no m3ua-client asp <1-7>",
+	NO_STR "M3UA Client\n" "Additional association\n" "Number\n")
+{
+	struct mtp_link *link = vty->index;
+	struct mtp_m3ua_asp *asp;
+
+	if (link->type != SS7_LTYPE_M3UA_CLIENT) {
+		vty_out(vty, "%%This only applies to M3UA client links.%s", VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	asp = mtp_m3ua_client_asp_num(link->data, atoi(argv[0]));
+	if (!asp) {
+		vty_out(vty, "%%ASP %s is not configured.%s", argv[0], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	mtp_m3ua_client_asp_free(asp);
 	return CMD_SUCCESS;
 }
 
@@ -904,6 +1139,52 @@ DEFUN(cfg_link_m3ua_client_lnk_up_tout, cfg_link_m3ua_client_lnk_up_tout_cmd,
 	return CMD_SUCCESS;
 }
 
+DEFUN(cfg_link_m3ua_client_write_queue, cfg_link_m3ua_client_write_queue_cmd,
+	"m3ua-client write-queue <1-4096> high-water <1-4096> low-water <0-4095>",
+	"M3UA Client\n" WRITE_QUEUE_STR)
+{
+	struct mtp_link *link = vty->index;
+	struct mtp_m3ua_client_link *m3ua_link;
+	struct mtp_m3ua_asp *asp;
+
+	if (link->type != SS7_LTYPE_M3UA_CLIENT) {
+		vty_out(vty, "%%This only applies to M3UA client links.%s", VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	m3ua_link = link->data;
+	if (sctp_queue_cfg_set(&m3ua_link->queue_cfg, atoi(argv[0]),
+			       atoi(argv[1]), atoi(argv[2])) != 0) {
+		vty_out(vty, "%%The high-water needs to be above the low-water and within the queue.%s",
+			VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	llist_for_each_entry(asp, &m3ua_link->asps, entry)
+		sctp_queue_configure(&asp->queue, &asp->queue_stats, &m3ua_link->queue_cfg);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_link_m3ua_client_write_batch, cfg_link_m3ua_client_write_batch_cmd,
+	"m3ua-client write-batch <1-64> flush-delay <0-1000>",
+	"M3UA Client\n" WRITE_BATCH_STR)
+{
+	struct mtp_link *link = vty->index;
+	struct mtp_m3ua_client_link *m3ua_link;
+	struct mtp_m3ua_asp *asp;
+
+	if (link->type != SS7_LTYPE_M3UA_CLIENT) {
+		vty_out(vty, "%%This only applies to M3UA client links.%s", VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	m3ua_link = link->data;
+	sctp_queue_cfg_batch(&m3ua_link->queue_cfg, atoi(argv[0]), atoi(argv[1]));
+	llist_for_each_entry(asp, &m3ua_link->asps, entry)
+		sctp_queue_configure(&asp->queue, &asp->queue_stats, &m3ua_link->queue_cfg);
+	return CMD_SUCCESS;
+}
+
 DEFUN(cfg_ss7_msc, cfg_ss7_msc_cmd,
       "msc <0-100>",
       "MSC Connection\n" "MSC Number\n")
@@ -1031,6 +1312,28 @@ DEFUN(cfg_msc_timeout_restart, cfg_msc_timeout_restart_cmd,
 	return CMD_SUCCESS;
 }
 
+DEFUN(cfg_msc_tx_coalesce, cfg_msc_tx_coalesce_cmd,
+      "tx-coalesce <0-100>",
+      "Collect frames before writing them to the MSC\n" "Milliseconds, 0 to disable\n")
+{
+	struct msc_connection *msc = vty->index;
+	msc->tx_coalesce = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_msc_replay_buffer, cfg_msc_replay_buffer_cmd,
+      "replay-buffer <0-1048576> max-age <0-60000>",
+      "Hold the data while the MSC is reconnecting\n"
+      "Bytes, 0 to disable\n"
+      "Maximum age of the data and time to keep the connections\n"
+      "Milliseconds, 0 for no limit and to release the connections\n")
+{
+	struct msc_connection *msc = vty->index;
+	msc->replay_max_bytes = atoi(argv[0]);
+	msc->replay_max_age = atoi(argv[1]);
+	return CMD_SUCCESS;
+}
+
 DEFUN(cfg_ss7_app, cfg_ss7_app_cmd,
       "application <0-100>",
       "Application Commands\n" "Number\n")
@@ -1156,6 +1459,22 @@ DEFUN(cfg_app_route, cfg_app_route_cmd,
 	return CMD_SUCCESS;
 }
 
+DEFUN(cfg_app_pool_msc, cfg_app_pool_msc_cmd,
+      "pool msc <0-100>",
+      "Load-share the connections across several MSCs\n"
+      "Add a MSC to the pool\n" "MSC Nr\n")
+{
+	struct ss7_application *app = vty->index;
+
+	if (ss7_application_add_msc(app, atoi(argv[0])) != 0) {
+		vty_out(vty, "Failed to add msc %d to the pool.%s",
+			atoi(argv[0]), VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	return CMD_SUCCESS;
+}
+
 DEFUN(cfg_app_route_ls, cfg_app_route_ls_cmd,
       "route linkset <0-100> linkset <0-100>",
       "Routing commands\n" "Source Linkset\n" "Linkset Nr\n"
@@ -1289,6 +1608,24 @@ DEFUN(cfg_app_no_hardcode_ass, cfg_app_no_hardcode_ass_cmd,
 	return CMD_SUCCESS;
 }
 
+DEFUN(cfg_app_con_pool, cfg_app_con_pool_cmd,
+      "connection-pool-size <1-65535>",
+      "Number of preallocated SCCP connections\n" "Number of connections\n")
+{
+	struct ss7_application *app = vty->index;
+	int size = atoi(argv[0]);
+
+	/* the pool is created when the application is started */
+	if (app->con_pool && sccp_con_pool_init(app, size) != 0) {
+		vty_out(vty, "%%Failed to resize the pool of app %d.%s",
+			app->nr, VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	app->con_pool_size = size;
+	return CMD_SUCCESS;
+}
+
 static void install_defaults(int node)
 {
 	install_element(node, &cfg_description_cmd);
@@ -1306,7 +1643,11 @@ void cell_vty_init(void)
 	install_node(&ss7_node, config_write_ss7);
 	install_defaults(SS7_NODE);
 	install_element(SS7_NODE, &cfg_ss7_udp_src_port_cmd);
+	install_element(SS7_NODE, &cfg_ss7_udp_rx_batch_cmd);
+	install_element(SS7_NODE, &cfg_ss7_udp_tx_batch_cmd);
 	install_element(SS7_NODE, &cfg_ss7_m2ua_src_port_cmd);
+	install_element(SS7_NODE, &cfg_ss7_m2ua_write_queue_cmd);
+	install_element(SS7_NODE, &cfg_ss7_m2ua_write_batch_cmd);
 
 	install_element(SS7_NODE, &cfg_ss7_linkset_cmd);
 	install_node(&linkset_node, config_write_linkset);
@@ -1320,6 +1661,7 @@ void cell_vty_init(void)
 	install_element(LINKSETS_NODE, &cfg_linkset_sltm_once_cmd);
 	install_element(LINKSETS_NODE, &cfg_linkset_t18_cmd);
 	install_element(LINKSETS_NODE, &cfg_linkset_t20_cmd);
+	install_element(LINKSETS_NODE, &cfg_linkset_tfx_batch_cmd);
 	install_element(LINKSETS_NODE, &cfg_linkset_mtp3_isup_opc_cmd);
 	install_element(LINKSETS_NODE, &cfg_linkset_no_mtp3_isup_opc_cmd);
 	install_element(LINKSETS_NODE, &cfg_linkset_mtp3_sccp_opc_cmd);
@@ -1328,11 +1670,15 @@ void cell_vty_init(void)
 	install_element(LINKSETS_NODE, &cfg_linkset_no_mtp3_isup_dpc_cmd);
 	install_element(LINKSETS_NODE, &cfg_linkset_mtp3_sccp_dpc_cmd);
 	install_element(LINKSETS_NODE, &cfg_linkset_no_mtp3_sccp_dpc_cmd);
+	install_element(LINKSETS_NODE, &cfg_linkset_route_cmd);
+	install_element(LINKSETS_NODE, &cfg_linkset_no_route_cmd);
 
 	install_element(LINKSETS_NODE, &cfg_linkset_link_cmd);
 	install_node(&link_node, dummy_write);
 	install_defaults(LINK_NODE);
 	install_element(LINK_NODE, &cfg_link_ss7_transport_cmd);
+	install_element(LINK_NODE, &cfg_link_weight_cmd);
+	install_element(LINK_NODE, &cfg_link_tx_queue_cmd);
 	install_element(LINK_NODE, &cfg_link_udp_dest_ip_cmd);
 	install_element(LINK_NODE, &cfg_link_udp_dest_port_cmd);
 	install_element(LINK_NODE, &cfg_link_udp_reset_cmd);
@@ -1343,10 +1689,14 @@ void cell_vty_init(void)
 	install_element(LINK_NODE, &cfg_link_m3ua_client_source_port_cmd);
 	install_element(LINK_NODE, &cfg_link_m3ua_client_dest_ip_cmd);
 	install_element(LINK_NODE, &cfg_link_m3ua_client_dest_port_cmd);
+	install_element(LINK_NODE, &cfg_link_m3ua_client_asp_cmd);
+	install_element(LINK_NODE, &cfg_link_no_m3ua_client_asp_cmd);
 	install_element(LINK_NODE, &cfg_link_m3ua_client_link_index_cmd);
 	install_element(LINK_NODE, &cfg_link_m3ua_client_routing_ctx_cmd);
 	install_element(LINK_NODE, &cfg_link_m3ua_client_traffic_mode_cmd);
 	install_element(LINK_NODE, &cfg_link_m3ua_client_lnk_up_tout_cmd);
+	install_element(LINK_NODE, &cfg_link_m3ua_client_write_queue_cmd);
+	install_element(LINK_NODE, &cfg_link_m3ua_client_write_batch_cmd);
 
 	install_element(SS7_NODE, &cfg_ss7_msc_cmd);
 	install_node(&msc_node, config_write_msc);
@@ -1359,6 +1709,8 @@ void cell_vty_init(void)
 	install_element(MSC_NODE, &cfg_msc_timeout_ping_cmd);
 	install_element(MSC_NODE, &cfg_msc_timeout_pong_cmd);
 	install_element(MSC_NODE, &cfg_msc_timeout_restart_cmd);
+	install_element(MSC_NODE, &cfg_msc_tx_coalesce_cmd);
+	install_element(MSC_NODE, &cfg_msc_replay_buffer_cmd);
 
 	install_element(SS7_NODE, &cfg_ss7_app_cmd);
 	install_node(&app_node, config_write_app);
@@ -1369,6 +1721,7 @@ void cell_vty_init(void)
 	install_element(APP_NODE, &cfg_app_no_fail_cmd);
 	install_element(APP_NODE, &cfg_app_route_cmd);
 	install_element(APP_NODE, &cfg_app_route_ls_cmd);
+	install_element(APP_NODE, &cfg_app_pool_msc_cmd);
 	install_element(APP_NODE, &cfg_app_domain_name_cmd);
 	install_element(APP_NODE, &cfg_app_no_domain_name_cmd);
 	install_element(APP_NODE, &cfg_app_trunk_name_cmd);
@@ -1377,6 +1730,7 @@ void cell_vty_init(void)
 	install_element(APP_NODE, &cfg_app_no_forward_only_cmd);
 	install_element(APP_NODE, &cfg_app_hardcode_ass_cmd);
 	install_element(APP_NODE, &cfg_app_no_hardcode_ass_cmd);
+	install_element(APP_NODE, &cfg_app_con_pool_cmd);
 
 	cell_vty_init_cmds();
 }
@@ -23,6 +23,10 @@
 #include <mtp_pcap.h>
 #include <msc_connection.h>
 #include <sctp_m2ua.h>
+#include <sctp_m3ua.h>
+#include <ss7_application.h>
+#include <msgb_pool.h>
+#include <counter.h>
 
 #include <osmocom/core/rate_ctr.h>
 
@@ -31,6 +35,7 @@
 #include <osmocom/vty/vty.h>
 #include <osmocom/vty/misc.h>
 
+#include <inttypes.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -79,14 +84,24 @@ static void dump_state(struct vty *vty, struct mtp_link_set *set)
 		set->sccp_up == 0? "not established" : "established",
 		VTY_NEWLINE);
 
+	vty_out(vty, " MTP restart is %s.%s",
+		mtp_restart_phase_name(set->restart.phase), VTY_NEWLINE);
+	if (set->restart.tra_ms > 0)
+		vty_out(vty, " Last restart: routing data after %d ms, "
+			"%d TFA and %d TFP after %d ms, TRA after %d ms.%s",
+			set->restart.collect_ms, set->restart.nr_tfa,
+			set->restart.nr_tfp, set->restart.broadcast_ms,
+			set->restart.tra_ms, VTY_NEWLINE);
+
 	llist_for_each_entry(link, &set->links, entry) {
 		if (link->blocked)
 			vty_out(vty, " Link %d is blocked.%s",
 				link->nr, VTY_NEWLINE);
 		else
-			vty_out(vty, " Link %d is %s.%s",
+			vty_out(vty, " Link %d is %s, %d queued, congestion level %d.%s",
 				link->nr,
 				link->available == 0 ? "not available" : "available",
+				link->tx_depth, link->congestion,
 				VTY_NEWLINE);
 	}
 }
@@ -123,6 +138,13 @@ DEFUN(show_msc, show_msc_cmd,
 		msc->msc_link_down == 0 ? "up" : "down",
 		msc->first_contact == 1 ? "no contact" : "contact",
 		VTY_NEWLINE);
+	if (msc->replay_max_bytes > 0)
+		vty_out(vty, " Replay buffer %d/%d bytes, replayed %lu, dropped %lu.%s",
+			msc->replay_bytes, msc->replay_max_bytes,
+			msc->replay_sent, msc->replay_dropped, VTY_NEWLINE);
+	if (msc->hold_connections)
+		vty_out(vty, " Keeping the connections until the MSC is back.%s",
+			VTY_NEWLINE);
 
 	return CMD_SUCCESS;
 }
@@ -145,11 +167,50 @@ DEFUN(show_mscs, show_mscs_cmd,
 }
 
 
+DEFUN(show_con_pool, show_con_pool_cmd,
+      "show connection-pool",
+      SHOW_STR "Display the usage of the SCCP connection pools\n")
+{
+	struct ss7_application *app;
+
+	llist_for_each_entry(app, &bsc->apps, entry) {
+		if (!app->con_pool)
+			continue;
+
+		vty_out(vty, "Application %d/%s pool size: %d in use: %d "
+			"high water: %d exhausted: %d%s",
+			app->nr, app->name, app->con_pool_size, app->con_in_use,
+			app->con_high_water, app->con_pool_exhausted,
+			VTY_NEWLINE);
+	}
+
+	return CMD_SUCCESS;
+}
+
+DEFUN(show_msgb_pool, show_msgb_pool_cmd,
+      "show msgb-pool",
+      SHOW_STR "Display the usage of the message buffer pool\n")
+{
+	int i;
+
+	for (i = 0; i < _NUM_MSGB_POOL; ++i) {
+		struct msgb_pool_class *cls = &msgb_pool_classes[i];
+
+		vty_out(vty, "Buffers of %u bytes outstanding: %d cached: %d%s",
+			cls->size, cls->outstanding, cls->nr_free, VTY_NEWLINE);
+		if (cls->ctrg)
+			vty_out_rate_ctr_group(vty, " ", cls->ctrg);
+	}
+
+	return CMD_SUCCESS;
+}
+
 DEFUN(show_slc, show_slc_cmd,
       "show link-set <0-100> slc",
       SHOW_STR "LinkSet\n" "Linkset nr\n" "SLS to SLC\n")
 {
 	struct mtp_link_set *set = NULL;
+	struct mtp_link *link;
 	int i;
 
 	set = mtp_link_set_num(bsc, atoi(argv[0]));
@@ -169,6 +230,38 @@ DEFUN(show_slc, show_slc_cmd,
 				i, VTY_NEWLINE);
 	}
 
+	llist_for_each_entry(link, &set->links, entry)
+		vty_out(vty, " Link %d weight %d has %d SLS and sent %" PRIu64 " messages.%s",
+			link->nr, link->weight, link->nr_sls,
+			link->ctrg->ctr[MTP_LNK_OUT].current, VTY_NEWLINE);
+
+	return CMD_SUCCESS;
+}
+
+DEFUN(show_routes, show_routes_cmd,
+      "show routes",
+      SHOW_STR "Display the MTP3 routing table\n")
+{
+	struct mtp_route_dest *dest;
+	struct mtp_route *route;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(bsc->routes.dests); ++i) {
+		dest = bsc->routes.dests[i];
+		if (!dest)
+			continue;
+
+		vty_out(vty, "DPC %d is %s.%s", dest->dpc,
+			dest->nr_active == 0 ? "not reachable" : "reachable",
+			VTY_NEWLINE);
+		llist_for_each_entry(route, &dest->routes, entry)
+			vty_out(vty, " via linkset %d/%s priority %d is %s%s.%s",
+				route->set->nr, route->set->name, route->priority,
+				route->prohibited ? "prohibited" : "allowed",
+				route->set->sccp_up ? "" : " (linkset down)",
+				VTY_NEWLINE);
+	}
+
 	return CMD_SUCCESS;
 }
 
@@ -287,11 +380,34 @@ DEFUN(show_sctp_count, show_sctp_count_cmd,
 	return CMD_SUCCESS;
 }
 
+static void dump_sctp_queue(struct vty *vty, struct osmo_wqueue *queue,
+			    struct sctp_queue_stats *stats)
+{
+	int i;
+
+	vty_out(vty, " Queue %d/%d, high-water %d, low-water %d, %s.%s",
+		queue->current_length, queue->max_length,
+		stats->high_water, stats->low_water,
+		stats->congested ? "congested" : "not congested", VTY_NEWLINE);
+	vty_out(vty, " Congestion onsets %u, dropped %u, max delay %u ms.%s",
+		stats->onsets, stats->dropped, stats->max_delay, VTY_NEWLINE);
+
+	vty_out(vty, " Delay ms");
+	for (i = 0; i < SCTP_QUEUE_DELAY_BUCKETS - 1; ++i)
+		vty_out(vty, " <%d: %u", 1 << i, stats->delay[i]);
+	vty_out(vty, " >=%d: %u%s", 1 << (SCTP_QUEUE_DELAY_BUCKETS - 2),
+		stats->delay[SCTP_QUEUE_DELAY_BUCKETS - 1], VTY_NEWLINE);
+}
+
 DEFUN(show_sctp_details, show_sctp_details_cmd,
       "show sctp-connections details",
       SHOW_STR "SCTP connections\n" "Details\n")
 {
 	struct sctp_m2ua_conn *conn;
+	struct mtp_m3ua_client_link *m3ua;
+	struct mtp_m3ua_asp *asp;
+	struct mtp_link_set *set;
+	struct mtp_link *link;
 
 	llist_for_each_entry(conn, &bsc->m2ua_trans->conns, entry) {
 		vty_out(vty,
@@ -299,6 +415,24 @@ DEFUN(show_sctp_details, show_sctp_details_cmd,
 			conn->asp_up, conn->asp_ident[0], conn->asp_ident[1],
 			conn->asp_ident[2], conn->asp_ident[3],
 			conn->queue.bfd.fd, conn, VTY_NEWLINE);
+		dump_sctp_queue(vty, &conn->queue, &conn->queue_stats);
+	}
+
+	llist_for_each_entry(set, &bsc->linksets, entry) {
+		llist_for_each_entry(link, &set->links, entry) {
+			if (link->type != SS7_LTYPE_M3UA_CLIENT)
+				continue;
+
+			m3ua = link->data;
+			llist_for_each_entry(asp, &m3ua->asps, entry) {
+				vty_out(vty,
+					"M3UA Link %d/%s ASP %d active: %d fd: %d.%s",
+					link->nr, link->name, asp->nr,
+					asp->asptm_active, asp->queue.bfd.fd,
+					VTY_NEWLINE);
+				dump_sctp_queue(vty, &asp->queue, &asp->queue_stats);
+			}
+		}
 	}
 
 	return CMD_WARNING;
@@ -318,6 +452,9 @@ void cell_vty_init_cmds(void)
 	install_element_ve(&show_stats_cmd);
 	install_element_ve(&show_linksets_cmd);
 	install_element_ve(&show_slc_cmd);
+	install_element_ve(&show_routes_cmd);
+	install_element_ve(&show_con_pool_cmd);
+	install_element_ve(&show_msgb_pool_cmd);
 
 	install_element_ve(&show_msc_cmd);
 	install_element_ve(&show_mscs_cmd);
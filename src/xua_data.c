@@ -0,0 +1,64 @@
+/* In place parsing of xUA DATA messages */
+/* (C) 2017 by Holger Hans Peter Freyther
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <xua_data.h>
+
+#include <osmocom/sigtran/xua_msg.h>
+
+#include <arpa/inet.h>
+
+struct xua_common_hdr *xua_data_hdr(struct msgb *msg, int version)
+{
+	struct xua_common_hdr *hdr;
+	uint32_t len;
+
+	if (msg->len < sizeof(*hdr))
+		return NULL;
+
+	hdr = (struct xua_common_hdr *) msg->data;
+	len = ntohl(hdr->msg_length);
+	if (hdr->version != version || len < sizeof(*hdr) || len > msg->len)
+		return NULL;
+	return hdr;
+}
+
+uint8_t *xua_data_find_tag(struct xua_common_hdr *hdr, uint16_t tag, uint16_t *len)
+{
+	struct xua_parameter_hdr *part;
+	uint8_t *pos = hdr->data;
+	int left = ntohl(hdr->msg_length) - sizeof(*hdr);
+	int part_len;
+
+	while (left >= (int) sizeof(*part)) {
+		part = (struct xua_parameter_hdr *) pos;
+		part_len = ntohs(part->len);
+		if (part_len < sizeof(*part) || part_len > left)
+			return NULL;
+
+		if (ntohs(part->tag) == tag) {
+			*len = part_len - sizeof(*part);
+			return part->data;
+		}
+
+		/* the parameters are padded to four bytes */
+		part_len = (part_len + 3) & ~3;
+		pos += part_len;
+		left -= part_len;
+	}
+
+	return NULL;
+}
@@ -0,0 +1,120 @@
+#include <link_index.h>
+
+#include <sys/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NR_LINKS	64
+#define NR_LOOKUPS	10000000
+
+struct test_link {
+	struct llist_head entry;
+	int link_index;
+	struct link_index_entry index_entry;
+};
+
+static struct test_link links[NR_LINKS];
+
+static double elapsed(struct timeval *start)
+{
+	struct timeval now, diff;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &diff);
+	return diff.tv_sec + diff.tv_usec / 1000000.0;
+}
+
+/* what find_link used to do */
+static struct test_link *find_linear(struct llist_head *list, int link_index)
+{
+	struct test_link *link;
+
+	llist_for_each_entry(link, list, entry)
+		if (link->link_index == link_index)
+			return link;
+	return NULL;
+}
+
+static struct test_link *find_table(struct link_index_table *table, int link_index)
+{
+	struct link_index_entry *entry;
+
+	entry = link_index_find(table, link_index);
+	if (!entry)
+		return NULL;
+	return container_of(entry, struct test_link, index_entry);
+}
+
+static void test_lookup(void)
+{
+	struct link_index_table table;
+	struct timeval start;
+	LLIST_HEAD(list);
+	double linear, hashed;
+	int i, found;
+
+	printf("Testing the lookup of %d links.\n", NR_LINKS);
+
+	link_index_table_init(&table);
+	for (i = 0; i < NR_LINKS; ++i) {
+		links[i].link_index = i + 1;
+		llist_add_tail(&links[i].entry, &list);
+		link_index_set(&table, &links[i].index_entry, i + 1);
+	}
+
+	for (i = 0; i <= NR_LINKS + 1; ++i) {
+		if (find_linear(&list, i) != find_table(&table, i)) {
+			printf("Lookup differs for index %d\n", i);
+			abort();
+		}
+	}
+
+	/* the last link is the worst case for the list */
+	found = 0;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < NR_LOOKUPS; ++i)
+		found += find_linear(&list, NR_LINKS - (i & 7)) != NULL;
+	linear = elapsed(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < NR_LOOKUPS; ++i)
+		found += find_table(&table, NR_LINKS - (i & 7)) != NULL;
+	hashed = elapsed(&start);
+
+	printf("Found %d links.\n", found);
+	fprintf(stderr, "Per MSU list: %.1f ns table: %.1f ns\n",
+		linear * 1e9 / NR_LOOKUPS, hashed * 1e9 / NR_LOOKUPS);
+}
+
+static void test_reindex(void)
+{
+	struct link_index_table table;
+	struct link_index_entry entry;
+
+	printf("Testing re-indexing a link.\n");
+
+	link_index_table_init(&table);
+	memset(&entry, 0, sizeof(entry));
+	link_index_set(&table, &entry, 0);
+	link_index_set(&table, &entry, 300);
+
+	if (link_index_find(&table, 0) || link_index_find(&table, 44)) {
+		printf("The old index is still present.\n");
+		abort();
+	}
+
+	if (link_index_find(&table, 300) != &entry) {
+		printf("The new index is not present.\n");
+		abort();
+	}
+}
+
+int main(int argc, char **argv)
+{
+	test_lookup();
+	test_reindex();
+	printf("All tests passed.\n");
+	return 0;
+}
@@ -0,0 +1,249 @@
+#include <cellmgr_debug.h>
+#include <msc_connection.h>
+#include <ipaccess.h>
+
+#include <osmocom/core/application.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/core/write_queue.h>
+
+#include <arpa/inet.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NR_FRAMES	150
+
+/* UDT with a BSSMAP Overload */
+static const uint8_t udt[] = {
+	0x09, 0x00, 0x03, 0x05, 0x07, 0x02, 0x42, 0xfe,
+	0x02, 0x42, 0xfe, 0x03, 0x00, 0x01, 0x32 };
+
+/* UDT with a BSSMAP Reset */
+static const uint8_t reset[] = {
+	0x09, 0x00, 0x03, 0x05, 0x07, 0x02, 0x42, 0xfe,
+	0x02, 0x42, 0xfe, 0x06, 0x00, 0x04, 0x30, 0x04,
+	0x01, 0x20 };
+
+/* DT1 with a BSSMAP Clear Request */
+static const uint8_t dt1[] = {
+	0x06, 0x01, 0x00, 0x00, 0x00, 0x01, 0x05, 0x00,
+	0x03, 0x22, 0x04, 0x01 };
+
+static struct msgb *sent[NR_FRAMES * 2];
+static int nr_sent;
+
+static struct msgb *create_frame(const uint8_t *data, int len)
+{
+	struct ipaccess_head *hh;
+	struct msgb *msg;
+
+	msg = msgb_alloc_headroom(4096, 128, "test");
+	memcpy(msgb_put(msg, len), data, len);
+
+	hh = (struct ipaccess_head *) msgb_push(msg, sizeof(*hh));
+	hh->len = htons(len);
+	hh->proto = IPAC_PROTO_SCCP;
+	return msg;
+}
+
+/* what msc_conn.c does with a frame for the MSC */
+static int send_frame(struct msc_connection *fw, const uint8_t *data, int len)
+{
+	struct msgb *msg = create_frame(data, len);
+
+	if (msc_replay_take(fw, msg)) {
+		sent[nr_sent++] = msg;
+		return 1;
+	}
+
+	if (fw->msc_link_down) {
+		msgb_free(msg);
+		return 0;
+	}
+
+	if (osmo_wqueue_enqueue(&fw->msc_connection, msg) != 0) {
+		msgb_free(msg);
+		return 0;
+	}
+
+	sent[nr_sent++] = msg;
+	return 1;
+}
+
+static struct msc_connection *create_conn(void)
+{
+	struct msc_connection *fw;
+
+	fw = talloc_zero(NULL, struct msc_connection);
+	fw->name = "test";
+	INIT_LLIST_HEAD(&fw->replay_queue);
+	osmo_wqueue_init(&fw->msc_connection, 100);
+	fw->msc_connection.bfd.fd = -1;
+	nr_sent = 0;
+	return fw;
+}
+
+static int count_frames(struct msc_connection *fw)
+{
+	struct msgb *msg;
+	int count = 0;
+
+	llist_for_each_entry(msg, &fw->replay_queue, list)
+		++count;
+	return count;
+}
+
+static void test_replay_drain(void)
+{
+	struct msc_connection *fw;
+	struct osmo_wqueue *queue;
+	struct msgb *msg, *dt1_msg;
+	int i, held, taken, delivered, in_order, dt1_delivered, max_queued;
+
+	printf("Testing the replay after a reconnect.\n");
+
+	fw = create_conn();
+	queue = &fw->msc_connection;
+	fw->replay_max_bytes = 1048576;
+	fw->replay_max_age = 0;
+	fw->msc_link_down = 1;
+
+	/* only the connectionless data is held while the link is down */
+	held = 0;
+	for (i = 0; i < NR_FRAMES; ++i)
+		held += send_frame(fw, udt, sizeof(udt));
+	printf("Held while down: %d RESET: %d DT1: %d\n", held,
+	       send_frame(fw, reset, sizeof(reset)),
+	       send_frame(fw, dt1, sizeof(dt1)));
+
+	/* the replay never fills the write queue past its limit */
+	fw->msc_link_down = 0;
+	msc_replay_start(fw);
+	printf("Write queue: %u waiting: %d\n",
+	       queue->current_length, nr_sent - queue->current_length);
+
+	/* live traffic during the replay is not subject to the limits */
+	fw->replay_max_bytes = fw->replay_bytes;
+	taken = send_frame(fw, dt1, sizeof(dt1));
+	dt1_msg = sent[nr_sent - 1];
+	for (i = 0; i < 10; ++i)
+		taken += send_frame(fw, udt, sizeof(udt));
+	printf("Live frames taken: %d bytes over the limit: %d dropped: %lu\n",
+	       taken, fw->replay_bytes > fw->replay_max_bytes,
+	       fw->replay_dropped);
+
+	/* write everything like msc_flush would */
+	delivered = 0;
+	in_order = 1;
+	dt1_delivered = 0;
+	max_queued = 0;
+	while (!llist_empty(&queue->msg_queue)) {
+		if (queue->current_length > max_queued)
+			max_queued = queue->current_length;
+
+		while ((msg = msgb_dequeue(&queue->msg_queue))) {
+			queue->current_length -= 1;
+			if (sent[delivered] != msg)
+				in_order = 0;
+			if (msg == dt1_msg)
+				dt1_delivered = 1;
+			delivered += 1;
+			msgb_free(msg);
+		}
+
+		msc_replay_refill(fw);
+	}
+
+	printf("Delivered: %d of %d in order: %d DT1: %d max queued: %d\n",
+	       delivered, nr_sent, in_order, dt1_delivered, max_queued);
+	printf("Replayed: %lu waiting: %d\n",
+	       fw->replay_sent, llist_empty(&fw->replay_queue) ? 0 : 1);
+
+	/* the replay is done and new frames go to the write queue again */
+	send_frame(fw, dt1, sizeof(dt1));
+	printf("After the replay: write queue: %u\n", queue->current_length);
+	osmo_wqueue_clear(queue);
+
+	talloc_free(fw);
+}
+
+static void test_replay_hold(void)
+{
+	struct msc_connection *fw;
+	struct osmo_wqueue *queue;
+	struct msgb *msg;
+	int i, taken, delivered, in_order;
+
+	printf("Testing the replay with the connections kept.\n");
+
+	fw = create_conn();
+	queue = &fw->msc_connection;
+	fw->replay_max_bytes = 100;
+	fw->replay_max_age = 500;
+	fw->msc_link_down = 1;
+	fw->hold_connections = 1;
+
+	/* the connection-oriented data is held as well */
+	taken = 0;
+	for (i = 0; i < 2; ++i) {
+		taken += send_frame(fw, udt, sizeof(udt));
+		taken += send_frame(fw, dt1, sizeof(dt1));
+	}
+	printf("Held with the connections: %d\n", taken);
+
+	/* the MSC came back in time and gets everything */
+	fw->msc_link_down = 0;
+	fw->hold_connections = 0;
+	msc_replay_start(fw);
+	delivered = 0;
+	in_order = 1;
+	while ((msg = msgb_dequeue(&queue->msg_queue))) {
+		queue->current_length -= 1;
+		if (sent[delivered] != msg)
+			in_order = 0;
+		delivered += 1;
+		msgb_free(msg);
+	}
+	printf("Delivered: %d of %d in order: %d\n", delivered, nr_sent, in_order);
+
+	/* a partially written frame is sent again from the start */
+	nr_sent = 0;
+	send_frame(fw, udt, sizeof(udt));
+	send_frame(fw, dt1, sizeof(dt1));
+	send_frame(fw, dt1, sizeof(dt1));
+	fw->tx_offset = 5;
+	fw->msc_link_down = 1;
+	fw->hold_connections = 1;
+	msc_replay_save_queue(fw);
+	printf("Saved on disconnect: %d write queue: %u offset: %d\n",
+	       count_frames(fw), queue->current_length, fw->tx_offset);
+
+	/* nothing is evicted while the connections are kept */
+	for (i = 0; i < 4; ++i) {
+		send_frame(fw, udt, sizeof(udt));
+		send_frame(fw, dt1, sizeof(dt1));
+	}
+	printf("Held: %d over the limit: %d dropped: %lu\n", count_frames(fw),
+	       fw->replay_bytes > fw->replay_max_bytes, fw->replay_dropped);
+
+	/* the connections are released, the connectionless data stays */
+	fw->hold_connections = 0;
+	msc_replay_drop_connections(fw);
+	printf("Released: frames left: %d bytes: %d dropped: %lu\n",
+	       count_frames(fw), fw->replay_bytes, fw->replay_dropped);
+
+	while ((msg = msgb_dequeue(&fw->replay_queue)))
+		msgb_free(msg);
+	talloc_free(fw);
+}
+
+int main(int argc, char **argv)
+{
+	osmo_init_logging(&log_info);
+
+	test_replay_drain();
+	test_replay_hold();
+	return 0;
+}
@@ -1,8 +1,10 @@
 /* MTP Layer3 parsing tests */
 #include "sctp_m3ua.h"
+#include "xua_data.h"
 
 #include <osmocom/mtp/mtp_level3.h>
 #include <osmocom/core/utils.h>
+#include <osmocom/sigtran/xua_msg.h>
 
 #include <arpa/inet.h>
 
@@ -590,6 +592,46 @@ void test_m3ua_traffic_mode(void)
 	OSMO_ASSERT(m3ua_traffic_mode_num("broadcast") == 3);
 }
 
+void test_xua_data(void)
+{
+	/* M2UA DATA with the interface identifier and a padded MSU */
+	static const uint8_t m2ua_data[] = {
+		0x01, 0x00, 0x06, 0x01, 0x00, 0x00, 0x00, 0x18,
+		0x00, 0x01, 0x00, 0x08, 0x00, 0x00, 0x00, 0x02,
+		0x03, 0x00, 0x00, 0x07, 0x83, 0x5c, 0x40, 0x00,
+	};
+	struct xua_common_hdr *hdr;
+	struct msgb *msg;
+	uint16_t len;
+	uint8_t *data;
+
+	msg = msgb_alloc(256, "xua test");
+	memcpy(msgb_put(msg, sizeof(m2ua_data)), m2ua_data, sizeof(m2ua_data));
+
+	OSMO_ASSERT(xua_data_hdr(msg, 2) == NULL);
+	hdr = xua_data_hdr(msg, 1);
+	OSMO_ASSERT(hdr == (struct xua_common_hdr *) msg->data);
+
+	data = xua_data_find_tag(hdr, 0x0001, &len);
+	OSMO_ASSERT(data == msg->data + 12);
+	OSMO_ASSERT(len == 4);
+
+	data = xua_data_find_tag(hdr, 0x0300, &len);
+	OSMO_ASSERT(data == msg->data + 20);
+	OSMO_ASSERT(len == 3);
+
+	OSMO_ASSERT(xua_data_find_tag(hdr, 0x0210, &len) == NULL);
+
+	/* a parameter running past the message */
+	msg->data[11] = 0x20;
+	OSMO_ASSERT(xua_data_find_tag(hdr, 0x0300, &len) == NULL);
+
+	/* the message length is beyond the msgb */
+	msgb_trim(msg, 20);
+	OSMO_ASSERT(xua_data_hdr(msg, 1) == NULL);
+	msgb_free(msg);
+}
+
 int main(int argc, char **argv)
 {
 	uint32_t addr;
@@ -649,6 +691,7 @@ int main(int argc, char **argv)
 	}
 
 	test_m3ua_traffic_mode();
+	test_xua_data();
 	printf("All tests passed.\n");
 	return 0;
 }
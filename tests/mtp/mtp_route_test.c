@@ -0,0 +1,167 @@
+#include <bsc_data.h>
+#include <cellmgr_debug.h>
+#include <counter.h>
+#include <mtp_data.h>
+#include <mtp_route.h>
+
+#include <osmocom/mtp/mtp_level3.h>
+
+#include <osmocom/core/application.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/rate_ctr.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static struct mtp_link_set *last_set;
+static struct msgb *last_msg;
+
+/* stubs for the MTP side */
+void mtp_link_submit(struct mtp_link *link, struct msgb *msg)
+{
+	last_set = link->set;
+	last_msg = msg;
+	msgb_free(msg);
+}
+
+struct msgb *mtp_msg_alloc(struct mtp_link_set *set)
+{
+	struct msgb *msg = msgb_alloc_headroom(4096, 128, "mtp-msg");
+
+	msg->l2h = msgb_put(msg, sizeof(struct mtp_level_3_hdr));
+	return msg;
+}
+
+static struct mtp_link_set *create_set(struct bsc_data *bsc, int nr)
+{
+	struct mtp_link_set *set;
+	struct mtp_link *link;
+	int i;
+
+	set = talloc_zero(bsc, struct mtp_link_set);
+	set->nr = nr;
+	set->name = talloc_asprintf(set, "set%d", nr);
+	set->bsc = bsc;
+	set->available = 1;
+	set->sccp_up = 1;
+	set->ctrg = rate_ctr_group_alloc(set, mtp_link_set_rate_ctr_desc(), nr);
+	INIT_LLIST_HEAD(&set->links);
+	INIT_LLIST_HEAD(&set->routes);
+
+	link = talloc_zero(set, struct mtp_link);
+	link->set = set;
+	for (i = 0; i < ARRAY_SIZE(set->slc); ++i)
+		set->slc[i] = link;
+	return set;
+}
+
+static void count_sets(struct bsc_data *bsc, int dpc, struct mtp_link_set **sets, int nr)
+{
+	int i, j, count;
+
+	for (i = 0; i < nr; ++i) {
+		count = 0;
+		for (j = 0; j < 16; ++j)
+			if (mtp_route_lookup(&bsc->routes, dpc, j) == sets[i])
+				++count;
+		printf(" %s: %d", sets[i]->name, count);
+	}
+	printf("\n");
+}
+
+static struct msgb *create_msu(int dpc, int sls, int headroom)
+{
+	struct mtp_level_3_hdr *hdr;
+	struct msgb *msg;
+
+	msg = msgb_alloc_headroom(4096, headroom, "msu");
+	msg->l2h = msgb_put(msg, sizeof(*hdr) + 4);
+	hdr = (struct mtp_level_3_hdr *) msg->l2h;
+	hdr->ser_ind = MTP_SI_MNT_SCCP;
+	hdr->addr = MTP_ADDR(sls, dpc, 42);
+	return msg;
+}
+
+static void test_routes(void)
+{
+	struct bsc_data *bsc;
+	struct mtp_link_set *sets[3];
+	struct msgb *msg;
+	int rc;
+
+	printf("Testing the routing table.\n");
+
+	bsc = talloc_zero(NULL, struct bsc_data);
+	sets[0] = create_set(bsc, 0);
+	sets[1] = create_set(bsc, 1);
+	sets[2] = create_set(bsc, 2);
+
+	/* nothing is configured for the DPC */
+	msg = create_msu(100, 3, 128);
+	rc = mtp_route_transfer(sets[0], msg, (struct mtp_level_3_hdr *) msg->l2h);
+	printf("Unknown DPC: %d\n", rc);
+	msgb_free(msg);
+
+	/* the preferred route wins */
+	mtp_route_add(&bsc->routes, 100, sets[0], 1);
+	mtp_route_add(&bsc->routes, 100, sets[1], 0);
+	printf("Preferred:");
+	count_sets(bsc, 100, sets, 3);
+
+	/* a TFP moves the traffic to the other priority */
+	mtp_route_set_status(&bsc->routes, 100, sets[1], 1);
+	mtp_route_add(&bsc->routes, 100, sets[2], 1);
+	printf("After TFP:");
+	count_sets(bsc, 100, sets, 3);
+
+	/* the linkset goes down */
+	sets[0]->available = 0;
+	mtp_route_update_set(sets[0]);
+	printf("Linkset down:");
+	count_sets(bsc, 100, sets, 3);
+
+	/* the TFA brings it back */
+	mtp_route_set_status(&bsc->routes, 100, sets[1], 0);
+	printf("After TFA:");
+	count_sets(bsc, 100, sets, 3);
+
+	/* the msgb is sent as it is with the label untouched */
+	msg = create_msu(100, 5, 128);
+	rc = mtp_route_transfer(sets[0], msg, (struct mtp_level_3_hdr *) msg->l2h);
+	printf("Transfer: %d same msgb: %d via %s\n",
+	       rc, last_msg == msg, last_set->name);
+
+	/* without headroom it is copied */
+	msg = create_msu(100, 5, 0);
+	rc = mtp_route_transfer(sets[0], msg, (struct mtp_level_3_hdr *) msg->l2h);
+	printf("Copy: %d same msgb: %d via %s\n",
+	       rc, last_msg == msg, last_set->name);
+	msgb_free(msg);
+
+	/* nothing reachable */
+	sets[1]->sccp_up = 0;
+	mtp_route_update_set(sets[1]);
+	mtp_route_set_status(&bsc->routes, 100, sets[2], 1);
+	msg = create_msu(100, 5, 128);
+	rc = mtp_route_transfer(sets[0], msg, (struct mtp_level_3_hdr *) msg->l2h);
+	printf("Unreachable: %d dropped: %d\n",
+	       rc, (int) sets[0]->ctrg->ctr[MTP_LSET_TOTA_DRP_MSG].current);
+	msgb_free(msg);
+
+	mtp_route_del(&bsc->routes, 100, sets[0]);
+	mtp_route_del(&bsc->routes, 100, sets[1]);
+	mtp_route_del(&bsc->routes, 100, sets[2]);
+	printf("Removed: %d\n", mtp_route_find(&bsc->routes, 100) == NULL);
+
+	talloc_free(bsc);
+}
+
+int main(int argc, char **argv)
+{
+	osmo_init_logging(&log_info);
+
+	test_routes();
+	printf("All tests passed.\n");
+	return 0;
+}
@@ -0,0 +1,355 @@
+#include <bsc_data.h>
+#include <bsc_sccp.h>
+#include <cellmgr_debug.h>
+#include <msc_connection.h>
+#include <mtp_data.h>
+#include <ss7_application.h>
+
+#include <osmocom/core/application.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+
+#include <sys/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NR_CONNECTIONS	50000
+
+/* CR with a BSSMAP Complete Layer3 as payload */
+static const uint8_t cr[] = {
+	0x01, 0x00, 0x00, 0x00, 0x02, 0x02, 0x04, 0x02,
+	0x42, 0xfe, 0x0f, 0x04, 0x00, 0x02, 0x57, 0x00,
+	0x00 };
+
+static const uint8_t cc[] = {
+	0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+	0x01, 0x00 };
+
+static const uint8_t rlsd[] = {
+	0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x01, 0x00 };
+
+/* DT1 with a BSSMAP Clear Request */
+static const uint8_t dt1[] = {
+	0x06, 0x00, 0x00, 0x00, 0x00, 0x01, 0x05, 0x00,
+	0x03, 0x22, 0x04, 0x01 };
+
+static int nr_to_msc;
+static int nr_to_bsc;
+
+/* stubs for the MSC and MTP side */
+void msc_send_direct(struct msc_connection *msc, struct msgb *msg)
+{
+	++nr_to_msc;
+	msgb_free(msg);
+}
+
+void msc_send_rlc(struct msc_connection *msc, struct sccp_source_reference *src,
+		  struct sccp_source_reference *dest)
+{
+	++nr_to_msc;
+}
+
+void msc_mgcp_reset(struct msc_connection *msc)
+{
+}
+
+int mtp_link_set_submit_sccp_data(struct mtp_link_set *set, int sls,
+				  const uint8_t *data, unsigned int length)
+{
+	++nr_to_bsc;
+	return 0;
+}
+
+void mtp_link_set_stop(struct mtp_link_set *set)
+{
+}
+
+int link_reset_all(struct mtp_link_set *set)
+{
+	return 0;
+}
+
+int link_clear_all(struct mtp_link_set *set)
+{
+	return 0;
+}
+
+static void set_ref(uint8_t *data, uint32_t ref)
+{
+	struct sccp_source_reference src_ref = sccp_src_ref_from_int(ref);
+
+	memcpy(data, &src_ref, sizeof(src_ref));
+}
+
+static struct msgb *create_msg(const uint8_t *data, int len)
+{
+	struct msgb *msg = msgb_alloc_headroom(4096, 128, "test");
+
+	msg->l2h = msgb_put(msg, len);
+	memcpy(msg->l2h, data, len);
+	return msg;
+}
+
+static int count_connections(struct ss7_application *app)
+{
+	struct active_sccp_con *con;
+	int count = 0;
+
+	llist_for_each_entry(con, &app->sccp_connections, entry)
+		++count;
+	return count;
+}
+
+static struct active_sccp_con *con_for_ref(struct ss7_application *app, uint32_t ref)
+{
+	struct sccp_source_reference src_ref = sccp_src_ref_from_int(ref);
+
+	return find_con_by_src_ref(app, &src_ref);
+}
+
+static double elapsed(struct timeval *start)
+{
+	struct timeval now, diff;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &diff);
+	return diff.tv_sec + diff.tv_usec / 1000000.0;
+}
+
+static void test_con_table(void)
+{
+	struct ss7_application *app;
+	struct msc_connection *msc;
+	struct mtp_link_set *set;
+	struct active_sccp_con *con;
+	struct sccp_source_reference ref;
+	struct timeval start;
+	struct msgb *msg;
+	uint32_t i;
+
+	printf("Testing the connection table with %d connections.\n", NR_CONNECTIONS);
+
+	app = talloc_zero(NULL, struct ss7_application);
+	INIT_LLIST_HEAD(&app->sccp_connections);
+	INIT_LLIST_HEAD(&app->con_free);
+	if (sccp_con_table_init(app) != 0 ||
+	    sccp_con_pool_init(app, NR_CONNECTIONS) != 0) {
+		printf("Failed to create the table.\n");
+		abort();
+	}
+
+	set = talloc_zero(app, struct mtp_link_set);
+	set->sccp_up = 1;
+	set->app = app;
+
+	msc = talloc_zero(app, struct msc_connection);
+	msc->app = app;
+
+	app->type = APP_CELLMGR;
+	app->route_src.set = set;
+	app->route_dst.msc = msc;
+
+	/* the BSC opens the connections */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < NR_CONNECTIONS; ++i) {
+		msg = create_msg(cr, sizeof(cr));
+		set_ref(&msg->l2h[1], i);
+		app_forward_sccp(app, msg, i & 0xf);
+		msgb_free(msg);
+	}
+	fprintf(stderr, "CR took %f seconds\n", elapsed(&start));
+
+	printf("Connections after CR: %d\n", count_connections(app));
+
+	/* the pool is exhausted and the CR should be refused */
+	msg = create_msg(cr, sizeof(cr));
+	set_ref(&msg->l2h[1], NR_CONNECTIONS);
+	app_forward_sccp(app, msg, 0);
+	msgb_free(msg);
+
+	printf("Connections after exhaustion: %d refused: %d to the MSC: %d to the BSC: %d\n",
+	       count_connections(app), app->con_pool_exhausted, nr_to_msc, nr_to_bsc);
+
+	/* the MSC confirms them */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < NR_CONNECTIONS; ++i) {
+		msg = create_msg(cc, sizeof(cc));
+		set_ref(&msg->l2h[1], i);
+		set_ref(&msg->l2h[4], 0x800000 | i);
+		msc_dispatch_sccp(msc, msg);
+		msgb_free(msg);
+	}
+	fprintf(stderr, "CC took %f seconds\n", elapsed(&start));
+
+	for (i = 0; i < NR_CONNECTIONS; ++i) {
+		ref = sccp_src_ref_from_int(0x800000 | i);
+		con = find_con_by_dest_ref(app, &ref);
+		if (!con || sccp_src_ref_to_int(&con->src_ref) != i) {
+			printf("Failed to find the connection for %u.\n", i);
+			abort();
+		}
+
+		if (con->sls != (i & 0xf)) {
+			printf("Wrong sls for %u.\n", i);
+			abort();
+		}
+	}
+
+	/* the BSC releases them */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < NR_CONNECTIONS; ++i) {
+		msg = create_msg(rlsd, sizeof(rlsd));
+		set_ref(&msg->l2h[1], 0x800000 | i);
+		set_ref(&msg->l2h[4], i);
+		app_forward_sccp(app, msg, i & 0xf);
+		msgb_free(msg);
+	}
+	fprintf(stderr, "RLSD took %f seconds\n", elapsed(&start));
+
+	printf("Connections after RLSD: %d in use: %d high water: %d\n",
+	       count_connections(app), app->con_in_use, app->con_high_water);
+	printf("Messages to the MSC: %d to the BSC: %d\n", nr_to_msc, nr_to_bsc);
+
+	talloc_free(app);
+}
+
+static void test_msc_pool(void)
+{
+	struct ss7_application *app;
+	struct msc_connection *mscs[2];
+	struct mtp_link_set *set;
+	struct active_sccp_con *con;
+	struct msgb *msg;
+	int i, to_bsc, to_msc, confirmed, on_msc[2] = { 0, 0 };
+
+	printf("Testing the MSC pool.\n");
+
+	app = talloc_zero(NULL, struct ss7_application);
+	INIT_LLIST_HEAD(&app->sccp_connections);
+	INIT_LLIST_HEAD(&app->con_free);
+	if (sccp_con_table_init(app) != 0 ||
+	    sccp_con_pool_init(app, 64) != 0) {
+		printf("Failed to create the table.\n");
+		abort();
+	}
+
+	set = talloc_zero(app, struct mtp_link_set);
+	set->sccp_up = 1;
+	set->app = app;
+
+	for (i = 0; i < 2; ++i) {
+		mscs[i] = talloc_zero(app, struct msc_connection);
+		mscs[i]->nr = i;
+		mscs[i]->app = app;
+		app->mscs[i] = mscs[i];
+	}
+
+	app->type = APP_CELLMGR;
+	app->route_src.set = set;
+	app->route_dst.msc = mscs[0];
+	app->nr_mscs = 2;
+
+	/* the CRs are spread across the pool and confirmed by their MSC */
+	for (i = 0; i < 16; ++i) {
+		msg = create_msg(cr, sizeof(cr));
+		set_ref(&msg->l2h[1], i);
+		app_forward_sccp(app, msg, 0);
+		msgb_free(msg);
+
+		msg = create_msg(cc, sizeof(cc));
+		set_ref(&msg->l2h[1], i);
+		set_ref(&msg->l2h[4], 0x800000 | i);
+		msc_dispatch_sccp(mscs[i % 2], msg);
+		msgb_free(msg);
+	}
+
+	confirmed = 0;
+	llist_for_each_entry(con, &app->sccp_connections, entry) {
+		on_msc[con->msc->nr] += 1;
+		confirmed += con->has_dst_ref;
+	}
+	printf("Connections on MSC 0: %d MSC 1: %d confirmed: %d\n",
+	       on_msc[0], on_msc[1], confirmed);
+
+	/* the CR went to MSC 0, a CC from MSC 1 is not forwarded */
+	msg = create_msg(cr, sizeof(cr));
+	set_ref(&msg->l2h[1], 100);
+	app_forward_sccp(app, msg, 0);
+	msgb_free(msg);
+
+	to_bsc = nr_to_bsc;
+	msg = create_msg(cc, sizeof(cc));
+	set_ref(&msg->l2h[1], 100);
+	set_ref(&msg->l2h[4], 0x800100);
+	msc_dispatch_sccp(mscs[1], msg);
+	msgb_free(msg);
+	printf("CC from the wrong MSC: forwarded: %d confirmed: %d\n",
+	       nr_to_bsc - to_bsc, con_for_ref(app, 100)->has_dst_ref);
+
+	/* MSC 0 confirms with a reference MSC 1 is using */
+	to_bsc = nr_to_bsc;
+	msg = create_msg(cc, sizeof(cc));
+	set_ref(&msg->l2h[1], 100);
+	set_ref(&msg->l2h[4], 0x800001);
+	msc_dispatch_sccp(mscs[0], msg);
+	msgb_free(msg);
+	printf("Reused reference: refused: %d connection: %s other: %s\n",
+	       nr_to_bsc - to_bsc,
+	       con_for_ref(app, 100) ? "kept" : "released",
+	       con_for_ref(app, 1)->msc == mscs[1] ? "kept" : "lost");
+
+	/* MSC 1 reconnects and keeps its connections */
+	to_msc = nr_to_msc;
+	to_bsc = nr_to_bsc;
+	mscs[1]->msc_link_down = 1;
+	mscs[1]->hold_connections = 1;
+	msg = create_msg(dt1, sizeof(dt1));
+	set_ref(&msg->l2h[1], 0x800001);
+	app_forward_sccp(app, msg, 0);
+	msgb_free(msg);
+	printf("MSC 1 reconnecting: to MSC: %d to BSC: %d MSCs up: %d\n",
+	       nr_to_msc - to_msc, nr_to_bsc - to_bsc, app_mscs_up(app));
+
+	/* no new connections while the whole pool reconnects */
+	mscs[0]->msc_link_down = 1;
+	mscs[0]->hold_connections = 1;
+	to_bsc = nr_to_bsc;
+	msg = create_msg(cr, sizeof(cr));
+	set_ref(&msg->l2h[1], 200);
+	app_forward_sccp(app, msg, 0);
+	msgb_free(msg);
+	printf("CR while reconnecting: refused: %d connection: %s\n",
+	       nr_to_bsc - to_bsc, con_for_ref(app, 200) ? "added" : "none");
+	mscs[0]->msc_link_down = 0;
+	mscs[0]->hold_connections = 0;
+	mscs[1]->hold_connections = 0;
+
+	/* MSC 1 goes away, only its connections are cleared */
+	to_bsc = nr_to_bsc;
+	mscs[1]->msc_link_down = 1;
+	release_bsc_resources(mscs[1]);
+	printf("MSC 1 down: clear commands: %d connections: %d\n",
+	       nr_to_bsc - to_bsc, count_connections(app));
+
+	/* a new connection avoids the MSC that is down */
+	msg = create_msg(cr, sizeof(cr));
+	set_ref(&msg->l2h[1], 201);
+	app_forward_sccp(app, msg, 0);
+	msgb_free(msg);
+	printf("New CR went to MSC %d\n", con_for_ref(app, 201)->msc->nr);
+
+	talloc_free(app);
+}
+
+int main(int argc, char **argv)
+{
+	osmo_init_logging(&log_info);
+
+	test_con_table();
+	test_msc_pool();
+	printf("All tests passed.\n");
+	return 0;
+}